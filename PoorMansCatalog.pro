@@ -8,29 +8,31 @@ CONFIG += c++11
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+include(core.pri)
+
 SOURCES += \
     about.cpp \
-    dbmanager.cpp \
+    directorytreemodel.cpp \
+    duplicatesdialog.cpp \
+    filelistmodel.cpp \
     main.cpp \
     mainwindow.cpp \
-    scanner.cpp \
-    thumbnailmanager.cpp \
-    thumbnailqueue.cpp
+    metricspanel.cpp \
+    searchworker.cpp
 
 HEADERS += \
     about.h \
-    dbmanager.h \
+    directorytreemodel.h \
+    duplicatesdialog.h \
+    filelistmodel.h \
     mainwindow.h \
-    scanner.h \
-    thumbnailmanager.h \
-    thumbnailqueue.h
+    metricspanel.h \
+    searchworker.h
 
 FORMS += \
     about.ui \
     mainwindow.ui
 
-LIBS += -lstdc++fs
-
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
 else: unix:!android: target.path = /opt/$${TARGET}/bin
@@ -0,0 +1,17 @@
+QT       += core gui sql
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = poorman-bench
+
+include(../core.pri)
+
+SOURCES += \
+    benchsupport.cpp \
+    dbbench.cpp \
+    scanbench.cpp \
+    thumbnailbench.cpp
+
+HEADERS += \
+    benchsupport.h
@@ -0,0 +1,128 @@
+#include "benchsupport.h"
+#include <QDir>
+#include <QFile>
+#include <QImage>
+#include <QStringList>
+#include <QTextStream>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// Cycled through for generated file names, so a scan sees a realistic mix.
+const char *const extensions[] = {"jpg", "txt", "pdf", "png", "mkv", "doc"};
+} // namespace
+
+/**
+ * @brief Create the directories of shape below root and fill them with small files.
+ * @return number of files created
+ */
+int Bench::generateTree(const QString &root, const TreeShape &shape) {
+	QStringList dirs;
+	dirs.append(root);
+	QStringList level = dirs;
+	for (int depth = 0; depth < shape.depth; depth++) {
+		QStringList next;
+		for (const QString &parent : level) {
+			for (int i = 0; i < shape.fanout; i++) {
+				QString dir = parent + QString("/d%1").arg(i);
+				QDir().mkpath(dir);
+				next.append(dir);
+			}
+		}
+		dirs.append(next);
+		level = next;
+	}
+
+	int per_dir = (shape.files + dirs.size() - 1) / dirs.size();
+	int created = 0;
+	for (int d = 0; d < dirs.size() && created < shape.files; d++) {
+		for (int f = 0; f < per_dir && created < shape.files; f++, created++) {
+			QFile file(dirs[d] + QString("/file_%1.%2").arg(f).arg(extensions[created % 6]));
+			file.open(QIODevice::WriteOnly);
+			file.write("xxxxxxx", f % 7);
+		}
+	}
+	return created;
+}
+
+/**
+ * @brief Write count JPEG photos of the given size with enough detail that
+ * decoding them costs about as much as decoding a real photo.
+ * @return number of images written
+ */
+int Bench::generateImages(const QString &dir, int count, const QSize &size) {
+	QDir().mkpath(dir);
+	int written = 0;
+	quint32 noise = 0x9E3779B9u;
+	for (int i = 0; i < count; i++) {
+		QImage image(size, QImage::Format_RGB32);
+		for (int y = 0; y < size.height(); y++) {
+			QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+			for (int x = 0; x < size.width(); x++) {
+				noise = noise * 1664525u + 1013904223u;
+				int grain = (noise >> 24) & 0x1f;
+				line[x] = qRgb((x * 255 / size.width() + i * 13 + grain) & 0xff, (y * 255 / size.height() + grain) & 0xff,
+					       ((x ^ y) + i * 29) & 0xff);
+			}
+		}
+		if (image.save(dir + QString("/photo_%1.jpg").arg(i), "JPEG", 90)) {
+			written++;
+		}
+	}
+	return written;
+}
+
+void Bench::progress(const QString &message) {
+	static QTextStream err(stderr);
+	err << message << "\n";
+	err.flush();
+}
+
+/**
+ * @brief Nearest-rank percentile, p in [0, 100].
+ */
+double Bench::percentile(QVector<double> samples, double p) {
+	if (samples.isEmpty()) {
+		return 0;
+	}
+	std::sort(samples.begin(), samples.end());
+	int rank = int(std::ceil(p / 100.0 * samples.size()));
+	return samples[qBound(0, rank - 1, samples.size() - 1)];
+}
+
+QJsonObject Bench::throughput(const QString &suite, const QString &name, qint64 items, qint64 best_ns, const QString &unit) {
+	double seconds = best_ns / 1e9;
+	QJsonObject result;
+	result.insert("suite", suite);
+	result.insert("name", name);
+	result.insert("items", double(items));
+	result.insert("seconds", seconds);
+	result.insert("rate", seconds > 0 ? items / seconds : 0.0);
+	result.insert("unit", unit);
+	return result;
+}
+
+QJsonObject Bench::latency(const QString &suite, const QString &name, const QVector<double> &samples_ms) {
+	double total = 0;
+	for (double sample : samples_ms) {
+		total += sample;
+	}
+	QJsonObject result;
+	result.insert("suite", suite);
+	result.insert("name", name);
+	result.insert("samples", samples_ms.size());
+	result.insert("mean_ms", samples_ms.isEmpty() ? 0.0 : total / samples_ms.size());
+	result.insert("p50_ms", percentile(samples_ms, 50));
+	result.insert("p99_ms", percentile(samples_ms, 99));
+	result.insert("max_ms", percentile(samples_ms, 100));
+	return result;
+}
+
+/**
+ * @brief Delete a database file together with its WAL files.
+ */
+void Bench::removeDatabase(const QString &db_path) {
+	QFile::remove(db_path);
+	QFile::remove(db_path + "-wal");
+	QFile::remove(db_path + "-shm");
+}
@@ -0,0 +1,50 @@
+#ifndef BENCHSUPPORT_H
+#define BENCHSUPPORT_H
+
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QSize>
+#include <QString>
+#include <QVector>
+
+/**
+ * Shape of a generated directory tree: depth levels below the root, each
+ * directory with fanout subdirectories, files spread evenly over all of them.
+ */
+struct TreeShape {
+	int files;
+	int depth;
+	int fanout;
+};
+
+struct BenchConfig {
+	TreeShape tree;
+	// Existing tree to walk and scan instead of a generated one.
+	QString tree_path;
+	int runs;
+	int threads;
+	int rows;
+	int queries;
+	int images;
+	QSize image_size;
+	// Scratch space for trees, images and databases.
+	QString work_dir;
+};
+
+namespace Bench {
+int generateTree(const QString &root, const TreeShape &shape);
+int generateImages(const QString &dir, int count, const QSize &size);
+void progress(const QString &message);
+double percentile(QVector<double> samples, double p);
+QJsonObject throughput(const QString &suite, const QString &name, qint64 items, qint64 best_ns, const QString &unit);
+QJsonObject latency(const QString &suite, const QString &name, const QVector<double> &samples_ms);
+void removeDatabase(const QString &db_path);
+
+// Suites, each returns one result object per measurement.
+QJsonArray enumerateSuite(const BenchConfig &config, const QString &root);
+QJsonArray scanSuite(const BenchConfig &config, const QString &root);
+QJsonArray insertSearchSuite(const BenchConfig &config, bool insert, bool search);
+QJsonArray thumbnailSuite(const BenchConfig &config);
+} // namespace Bench
+
+#endif // BENCHSUPPORT_H
@@ -0,0 +1,154 @@
+/**
+ * Insert, search and listing benchmarks on a synthetic catalog.
+ */
+
+#include "benchsupport.h"
+#include "dbmanager.h"
+#include <QElapsedTimer>
+#include <QSqlQuery>
+#include <QStringList>
+#include <random>
+
+namespace {
+const int files_per_dir = 100;
+
+const char *const words[] = {"holiday", "invoice", "backup", "project", "family", "camera", "scan",     "music",
+			     "archive", "report",  "summer", "winter",  "garden", "travel", "wedding",  "concert",
+			     "receipt", "draft",   "final",  "export",  "render", "sketch", "document", "source"};
+const int word_count = sizeof(words) / sizeof(words[0]);
+const char *const extensions[] = {"jpg", "png", "pdf", "txt", "mkv", "flac"};
+
+QString word(std::mt19937 &rng) { return QString::fromLatin1(words[rng() % word_count]); }
+
+/**
+ * @brief Fill catalog 1 with rows directories of files_per_dir files each,
+ * through the scanner's batched insert path.
+ * @return ids of the directories
+ */
+QVector<int> populate(DBManager &db, int rows, qint64 &elapsed_ns) {
+	std::mt19937 rng(42);
+	QVector<int> dir_ids;
+	QElapsedTimer timer;
+	timer.start();
+	db.beginBatch(1000, 0);
+	int written = 0;
+	int dir_index = 0;
+	while (written < rows) {
+		QString dir_path = QString("/bench/%1/%2_%3").arg(word(rng), word(rng)).arg(dir_index++);
+		DirEntry dir = DirEntry();
+		dir.directory = "/bench";
+		dir.full_path = dir_path;
+		dir.name = dir_path.mid(dir_path.lastIndexOf('/') + 1);
+		dir.is_directory = true;
+		dir.catalog_id = 1;
+		dir.parent_id = -1;
+		int dir_id = db.batchDirEntry(dir);
+		dir_ids.append(dir_id);
+		written++;
+		for (int f = 0; f < files_per_dir && written < rows; f++, written++) {
+			DirEntry file = DirEntry();
+			file.directory = dir_path;
+			file.name = QString("%1_%2_%3").arg(word(rng), word(rng)).arg(f);
+			file.full_path = dir_path + "/" + file.name + "." + extensions[f % 6];
+			file.filesize = rng() % (64 << 20);
+			file.catalog_id = 1;
+			file.parent_id = dir_id;
+			file.mtime = 1600000000000LL + rng() % 100000000;
+			file.inode = written;
+			file.device = 1;
+			db.batchDirEntry(file);
+		}
+		if (db.batchDue()) {
+			db.commitBatch();
+		}
+	}
+	db.endBatch();
+	elapsed_ns = timer.nsecsElapsed();
+	return dir_ids;
+}
+
+/**
+ * @brief Time a query per call, reading every row the way the views do.
+ */
+template <typename Run> QVector<double> measure(int queries, Run run) {
+	QVector<double> samples;
+	samples.reserve(queries);
+	for (int i = 0; i < queries; i++) {
+		QElapsedTimer timer;
+		timer.start();
+		QSqlQuery query = run(i);
+		while (query.next()) {
+			query.value(0);
+		}
+		samples.append(timer.nsecsElapsed() / 1e6);
+	}
+	return samples;
+}
+} // namespace
+
+/**
+ * @brief Batched insert throughput, then searchFiles and fetchFiles latency
+ * on the rows just written.
+ */
+QJsonArray Bench::insertSearchSuite(const BenchConfig &config, bool insert, bool search) {
+	QJsonArray results;
+	QString db_path = config.work_dir + "/insert.sqlite";
+	QVector<int> dir_ids;
+	qint64 best = -1;
+	int runs = insert ? config.runs : 1;
+	for (int run = 0; run < runs; run++) {
+		removeDatabase(db_path);
+		DBManager db(db_path, QString("bench_insert_%1").arg(run));
+		qint64 elapsed = 0;
+		dir_ids = populate(db, config.rows, elapsed);
+		if (best < 0 || elapsed < best) {
+			best = elapsed;
+		}
+	}
+	if (insert) {
+		results.append(throughput("insert", "batch", config.rows, best, "rows/s"));
+		progress(QString("insert: %1 rows/s").arg(results.last().toObject().value("rate").toDouble(), 0, 'f', 0));
+	}
+
+	if (search) {
+		DBManager db(db_path, "bench_search");
+		std::mt19937 rng(7);
+		QVector<QString> single;
+		QVector<QString> pair;
+		QVector<QString> fragment;
+		QVector<int> parents;
+		for (int i = 0; i < config.queries; i++) {
+			single.append(word(rng));
+			pair.append(word(rng) + " " + word(rng));
+			// Two letters are below the trigram index and take the LIKE path.
+			fragment.append(word(rng).mid(int(rng() % 4), 2));
+			parents.append(dir_ids[int(rng() % dir_ids.size())]);
+		}
+		struct Case {
+			const char *name;
+			const QVector<QString> *terms;
+			bool and_join;
+		};
+		const Case cases[] = {{"searchFiles_word", &single, true},
+				      {"searchFiles_all_of_two", &pair, true},
+				      {"searchFiles_any_of_two", &pair, false},
+				      {"searchFiles_fragment", &fragment, true}};
+		for (const Case &search_case : cases) {
+			QVector<double> samples = measure(config.queries, [&](int i) {
+				return db.searchFiles(search_case.terms->at(i), search_case.and_join, -1);
+			});
+			results.append(latency("search", search_case.name, samples));
+			progress(QString("search %1: p50 %2 ms, p99 %3 ms")
+				     .arg(search_case.name)
+				     .arg(percentile(samples, 50), 0, 'f', 2)
+				     .arg(percentile(samples, 99), 0, 'f', 2));
+		}
+		QVector<double> samples = measure(config.queries, [&](int i) { return db.fetchFiles(parents[i], 1); });
+		results.append(latency("search", "fetchFiles", samples));
+		progress(QString("search fetchFiles: p50 %1 ms, p99 %2 ms")
+			     .arg(percentile(samples, 50), 0, 'f', 2)
+			     .arg(percentile(samples, 99), 0, 'f', 2));
+	}
+	removeDatabase(db_path);
+	return results;
+}
@@ -0,0 +1,340 @@
+/**
+ * Poor Man's Catalog benchmark suite.
+ *
+ * Generates synthetic directory trees and photo sets and measures directory
+ * enumeration, full scans, batched inserts, search and listing latency and
+ * thumbnail generation. Results are written as one JSON document so runs
+ * can be compared with --baseline; progress goes to stderr.
+ */
+
+#include "benchsupport.h"
+#include "dbmanager.h"
+#include "direnumerator.h"
+#include "scanner.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QSqlQuery>
+#include <QSysInfo>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+#include <algorithm>
+
+namespace {
+qint64 walkIterator(const QString &root) {
+	qint64 count = 0;
+	QDir dir(root);
+	QDirIterator it(dir, QDirIterator::Subdirectories);
+	while (it.hasNext()) {
+		QFileInfo info(it.next());
+		QString basename = info.fileName();
+		if (basename == "." || basename == "..") {
+			continue;
+		}
+		info.isDir();
+		info.completeBaseName();
+		info.absolutePath();
+		info.absoluteFilePath();
+		info.size();
+		count++;
+	}
+	return count;
+}
+
+qint64 walkEnumerator(const QString &root, DirEnumerator::Backend backend) {
+	DirEnumerator::setBackend(backend);
+	qint64 count = 0;
+	QStringList stack;
+	stack.append(root);
+	QVector<ScanEntry> entries;
+	while (!stack.isEmpty()) {
+		QString dir = stack.takeLast();
+		entries.clear();
+		DirEnumerator::list(dir, entries);
+		for (const ScanEntry &entry : entries) {
+			if (entry.is_dir && !entry.is_symlink) {
+				stack.append(entry.full_path);
+			}
+			count++;
+		}
+	}
+	return count;
+}
+
+/**
+ * @brief Run one scan to completion.
+ * @param catalog_id catalog to rescan, or -1 for a new one
+ * @return rows in the catalog afterwards
+ */
+qint64 runScanner(QString db_path, const QString &root, int catalog_id, int threads, qint64 &elapsed_ns) {
+	Scanner scanner(nullptr, db_path);
+	scanner.withThumbs(false);
+	scanner.setPath(root);
+	scanner.setCatalogId(catalog_id);
+	scanner.setCatalogName("bench");
+	scanner.setIncremental(catalog_id != -1);
+	scanner.setThreadCount(threads);
+	QElapsedTimer timer;
+	timer.start();
+	scanner.start();
+	scanner.wait();
+	elapsed_ns = timer.nsecsElapsed();
+
+	static int connection = 0;
+	DBManager db(db_path, QString("bench_scan_%1").arg(connection++));
+	QSqlQuery catalogs = db.fetchCatalogs();
+	if (!catalogs.next()) {
+		return 0;
+	}
+	CatalogStats stats = db.catalogStats(catalogs.value("ids").toInt());
+	return stats.files + stats.directories;
+}
+
+/**
+ * @brief The catalog code logs every table it creates; keep stderr for progress.
+ */
+void messageHandler(QtMsgType type, const QMessageLogContext &context, const QString &message) {
+	Q_UNUSED(context);
+	if (type != QtDebugMsg) {
+		Bench::progress(message);
+	}
+}
+} // namespace
+
+QJsonArray Bench::enumerateSuite(const BenchConfig &config, const QString &root) {
+	QJsonArray results;
+	struct Variant {
+		const char *name;
+		int backend;
+	};
+	const Variant variants[] = {{"qdiriterator", -1}, {"generic", DirEnumerator::Generic}, {"native", DirEnumerator::Native}};
+	for (const Variant &variant : variants) {
+#ifndef Q_OS_LINUX
+		if (variant.backend == DirEnumerator::Native) {
+			continue;
+		}
+#endif
+		qint64 best = -1;
+		qint64 entries = 0;
+		for (int run = 0; run < config.runs; run++) {
+			QElapsedTimer timer;
+			timer.start();
+			if (variant.backend < 0) {
+				entries = walkIterator(root);
+			} else {
+				entries = walkEnumerator(root, (DirEnumerator::Backend)variant.backend);
+			}
+			qint64 elapsed = timer.nsecsElapsed();
+			if (best < 0 || elapsed < best) {
+				best = elapsed;
+			}
+		}
+		results.append(throughput("enumerate", variant.name, entries, best, "entries/s"));
+		double rate = results.last().toObject().value("rate").toDouble();
+		progress(QString("enumerate %1: %2 entries/s").arg(variant.name).arg(rate, 0, 'f', 0));
+	}
+	DirEnumerator::setBackend(DirEnumerator::Auto);
+	return results;
+}
+
+/**
+ * @brief Full scan into an empty database, then a rescan of the unchanged tree.
+ */
+QJsonArray Bench::scanSuite(const BenchConfig &config, const QString &root) {
+	QJsonArray results;
+	QString db_path = config.work_dir + "/scan.sqlite";
+	qint64 best_full = -1;
+	qint64 best_rescan = -1;
+	qint64 rows = 0;
+	for (int run = 0; run < config.runs; run++) {
+		removeDatabase(db_path);
+		qint64 elapsed = 0;
+		rows = runScanner(db_path, root, -1, config.threads, elapsed);
+		if (best_full < 0 || elapsed < best_full) {
+			best_full = elapsed;
+		}
+		runScanner(db_path, root, 1, config.threads, elapsed);
+		if (best_rescan < 0 || elapsed < best_rescan) {
+			best_rescan = elapsed;
+		}
+	}
+	removeDatabase(db_path);
+	results.append(throughput("scan", "full", rows, best_full, "files/s"));
+	results.append(throughput("scan", "rescan_unchanged", rows, best_rescan, "files/s"));
+	progress(QString("scan: %1 files/s, unchanged rescan %2 files/s")
+		     .arg(results[0].toObject().value("rate").toDouble(), 0, 'f', 0)
+		     .arg(results[1].toObject().value("rate").toDouble(), 0, 'f', 0));
+	return results;
+}
+
+namespace {
+/**
+ * @brief Print how each rate or latency moved against an earlier run.
+ */
+void compareWithBaseline(const QJsonArray &results, const QString &baseline_path) {
+	QFile file(baseline_path);
+	if (!file.open(QIODevice::ReadOnly)) {
+		Bench::progress("Unable to read baseline " + baseline_path);
+		return;
+	}
+	QHash<QString, QJsonObject> baseline;
+	for (const QJsonValue &value : QJsonDocument::fromJson(file.readAll()).object().value("results").toArray()) {
+		QJsonObject result = value.toObject();
+		baseline.insert(result.value("suite").toString() + "/" + result.value("name").toString(), result);
+	}
+	for (const QJsonValue &value : results) {
+		QJsonObject result = value.toObject();
+		QString key = result.value("suite").toString() + "/" + result.value("name").toString();
+		auto old = baseline.constFind(key);
+		if (old == baseline.constEnd()) {
+			continue;
+		}
+		// Higher is better for rates, lower for latencies.
+		QString field = result.contains("rate") ? "rate" : "p50_ms";
+		double before = old.value().value(field).toDouble();
+		double now = result.value(field).toDouble();
+		if (before > 0) {
+			Bench::progress(QString("%1 %2: %3 -> %4 (%5%)")
+					    .arg(key, field)
+					    .arg(before, 0, 'f', 2)
+					    .arg(now, 0, 'f', 2)
+					    .arg((now - before) * 100 / before, 0, 'f', 1));
+		}
+	}
+}
+
+QSize parseSize(const QString &text, const QSize &fallback) {
+	QStringList parts = text.split('x');
+	if (parts.size() != 2 || parts[0].toInt() <= 0 || parts[1].toInt() <= 0) {
+		return fallback;
+	}
+	return QSize(parts[0].toInt(), parts[1].toInt());
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+	QCoreApplication app(argc, argv);
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Poor Man's Catalog benchmark suite");
+	parser.addHelpOption();
+	QCommandLineOption suites_option("suites", "Comma separated: enumerate, scan, insert, search, thumbnail.", "list",
+					 "enumerate,scan,insert,search,thumbnail");
+	QCommandLineOption files_option("files", "Number of files in the synthetic tree.", "count", "200000");
+	QCommandLineOption depth_option("depth", "Directory levels below the root.", "count", "4");
+	QCommandLineOption fanout_option("fanout", "Subdirectories per directory.", "count", "8");
+	QCommandLineOption runs_option("runs", "Runs per measurement, the best one is reported.", "count", "3");
+	QCommandLineOption threads_option("threads", "Scanner threads.", "count", "1");
+	QCommandLineOption rows_option("rows", "Rows for the insert and search suites.", "count", "200000");
+	QCommandLineOption queries_option("queries", "Queries per search measurement.", "count", "200");
+	QCommandLineOption images_option("images", "Photos for the thumbnail suite.", "count", "100");
+	QCommandLineOption image_size_option("image-size", "Photo size, WIDTHxHEIGHT.", "size", "2400x1600");
+	QCommandLineOption path_option("path", "Walk and scan an existing tree instead of generating one.", "dir");
+	QCommandLineOption output_option("output", "Write the JSON results to a file instead of stdout.", "file");
+	QCommandLineOption baseline_option("baseline", "Compare against the JSON results of an earlier run.", "file");
+	parser.addOption(suites_option);
+	parser.addOption(files_option);
+	parser.addOption(depth_option);
+	parser.addOption(fanout_option);
+	parser.addOption(runs_option);
+	parser.addOption(threads_option);
+	parser.addOption(rows_option);
+	parser.addOption(queries_option);
+	parser.addOption(images_option);
+	parser.addOption(image_size_option);
+	parser.addOption(path_option);
+	parser.addOption(output_option);
+	parser.addOption(baseline_option);
+	parser.process(app);
+	qInstallMessageHandler(messageHandler);
+
+	QTemporaryDir temp;
+	BenchConfig config;
+	config.tree = TreeShape{qMax(0, parser.value(files_option).toInt()), qMax(0, parser.value(depth_option).toInt()),
+				qMax(1, parser.value(fanout_option).toInt())};
+	config.tree_path = parser.value(path_option);
+	config.runs = qMax(1, parser.value(runs_option).toInt());
+	config.threads = qMax(1, parser.value(threads_option).toInt());
+	config.rows = qMax(1, parser.value(rows_option).toInt());
+	config.queries = qMax(1, parser.value(queries_option).toInt());
+	config.images = qMax(1, parser.value(images_option).toInt());
+	config.image_size = parseSize(parser.value(image_size_option), QSize(2400, 1600));
+	config.work_dir = temp.path();
+	QStringList suites = parser.value(suites_option).split(',', Qt::SkipEmptyParts);
+
+	QString root = config.tree_path;
+	if (root.isEmpty() && (suites.contains("enumerate") || suites.contains("scan"))) {
+		root = config.work_dir + "/tree";
+		QDir().mkpath(root);
+		Bench::progress(QString("Generating %1 files, depth %2, fan-out %3 in %4")
+				    .arg(config.tree.files)
+				    .arg(config.tree.depth)
+				    .arg(config.tree.fanout)
+				    .arg(root));
+		Bench::generateTree(root, config.tree);
+	}
+
+	QJsonArray results;
+	auto append = [&results](const QJsonArray &suite_results) {
+		for (const QJsonValue &value : suite_results) {
+			results.append(value);
+		}
+	};
+	if (suites.contains("enumerate")) {
+		append(Bench::enumerateSuite(config, root));
+	}
+	if (suites.contains("scan")) {
+		append(Bench::scanSuite(config, root));
+	}
+	if (suites.contains("insert") || suites.contains("search")) {
+		append(Bench::insertSearchSuite(config, suites.contains("insert"), suites.contains("search")));
+	}
+	if (suites.contains("thumbnail")) {
+		append(Bench::thumbnailSuite(config));
+	}
+
+	QJsonObject host;
+	host.insert("cpus", QThread::idealThreadCount());
+	host.insert("os", QSysInfo::prettyProductName());
+	host.insert("qt", QString(qVersion()));
+	QJsonObject settings;
+	settings.insert("files", config.tree.files);
+	settings.insert("depth", config.tree.depth);
+	settings.insert("fanout", config.tree.fanout);
+	settings.insert("path", config.tree_path);
+	settings.insert("runs", config.runs);
+	settings.insert("threads", config.threads);
+	settings.insert("rows", config.rows);
+	settings.insert("queries", config.queries);
+	settings.insert("images", config.images);
+	settings.insert("image_size", QString("%1x%2").arg(config.image_size.width()).arg(config.image_size.height()));
+	QJsonObject document;
+	document.insert("version", 1);
+	document.insert("timestamp", QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+	document.insert("host", host);
+	document.insert("config", settings);
+	document.insert("results", results);
+	QByteArray json = QJsonDocument(document).toJson(QJsonDocument::Indented);
+
+	if (parser.isSet(output_option)) {
+		QFile file(parser.value(output_option));
+		if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size()) {
+			Bench::progress("Unable to write " + parser.value(output_option));
+			return 1;
+		}
+	} else {
+		QTextStream out(stdout);
+		out << json;
+	}
+	if (parser.isSet(baseline_option)) {
+		compareWithBaseline(results, parser.value(baseline_option));
+	}
+	return 0;
+}
@@ -0,0 +1,83 @@
+/**
+ * Thumbnail generation benchmarks on a synthetic photo set.
+ */
+
+#include "benchsupport.h"
+#include "dbmanager.h"
+#include "thumbnailmanager.h"
+#include "thumbnailqueue.h"
+#include <QDir>
+#include <QElapsedTimer>
+#include <QStringList>
+
+/**
+ * @brief ThumbnailManager on one thread, then the whole ThumbnailQueue
+ * pipeline including the database writes.
+ */
+QJsonArray Bench::thumbnailSuite(const BenchConfig &config) {
+	QJsonArray results;
+	QString image_dir = config.work_dir + "/images";
+	progress(QString("Generating %1 photos of %2x%3")
+		     .arg(config.images)
+		     .arg(config.image_size.width())
+		     .arg(config.image_size.height()));
+	int images = generateImages(image_dir, config.images, config.image_size);
+	QStringList paths;
+	for (const QString &name : QDir(image_dir).entryList(QStringList() << "*.jpg", QDir::Files, QDir::Name)) {
+		paths.append(image_dir + "/" + name);
+	}
+
+	qint64 best = -1;
+	for (int run = 0; run < config.runs; run++) {
+		ThumbnailManager mgr;
+		QElapsedTimer timer;
+		timer.start();
+		for (const QString &path : paths) {
+			mgr.generateThumbnail(path, 256);
+		}
+		qint64 elapsed = timer.nsecsElapsed();
+		if (best < 0 || elapsed < best) {
+			best = elapsed;
+		}
+	}
+	results.append(throughput("thumbnail", "manager_single_thread", images, best, "thumbnails/s"));
+
+	QString db_path = config.work_dir + "/thumbnails.sqlite";
+	removeDatabase(db_path);
+	QVector<ThumbnailRequest> requests;
+	{
+		DBManager db(db_path, "bench_thumbnails");
+		db.beginBatch(1000, 0);
+		for (const QString &path : paths) {
+			DirEntry entry = DirEntry();
+			entry.full_path = path;
+			entry.directory = image_dir;
+			entry.name = QDir(path).dirName();
+			entry.catalog_id = 1;
+			entry.parent_id = -1;
+			entry.thumbnail_state = ThumbnailPending;
+			requests.append(ThumbnailRequest{db.batchDirEntry(entry), path, 256});
+		}
+		db.endBatch();
+	}
+	best = -1;
+	for (int run = 0; run < config.runs; run++) {
+		ThumbnailQueue queue(nullptr, db_path);
+		QElapsedTimer timer;
+		timer.start();
+		for (const ThumbnailRequest &request : requests) {
+			queue.addRequest(request);
+		}
+		queue.waitForIdle();
+		qint64 elapsed = timer.nsecsElapsed();
+		if (best < 0 || elapsed < best) {
+			best = elapsed;
+		}
+	}
+	results.append(throughput("thumbnail", "queue", images, best, "thumbnails/s"));
+	removeDatabase(db_path);
+	progress(QString("thumbnail: %1/s on one thread, %2/s through the queue")
+		     .arg(results[0].toObject().value("rate").toDouble(), 0, 'f', 1)
+		     .arg(results[1].toObject().value("rate").toDouble(), 0, 'f', 1));
+	return results;
+}
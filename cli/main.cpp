@@ -0,0 +1,405 @@
+/**
+ * poorman-cli: scan, search and maintain catalogs without a display.
+ *
+ * Works on the same database as the GUI and goes through the same
+ * DBManager, Scanner and ThumbnailQueue, so catalogs written by one can be
+ * browsed with the other. Results go to stdout as TSV or JSON lines,
+ * diagnostics to stderr.
+ */
+
+#include "dbmanager.h"
+#include "scanmetrics.h"
+#include "scanner.h"
+#include "thumbnailqueue.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QEventLoop>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSqlQuery>
+#include <QTextStream>
+#include <QThread>
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+enum ExitCode { ExitOk = 0, ExitFailure = 1, ExitUsage = 2 };
+
+// Same as the size the GUI requests.
+const int thumbnail_size = 256;
+const int pending_page = 1024;
+
+bool verbose = false;
+
+QTextStream &out() {
+	static QTextStream stream(stdout);
+	return stream;
+}
+
+QTextStream &err() {
+	static QTextStream stream(stderr);
+	return stream;
+}
+
+/**
+ * @brief Keep stderr quiet for cron unless --verbose was given.
+ */
+void messageHandler(QtMsgType type, const QMessageLogContext &context, const QString &message) {
+	Q_UNUSED(context);
+	if (type == QtDebugMsg && !verbose) {
+		return;
+	}
+	fprintf(stderr, "%s\n", qPrintable(message));
+}
+
+struct Output {
+	bool json;
+
+	/**
+	 * @brief Write one record. keys and values are in column order.
+	 */
+	void record(const QStringList &keys, const QVariantList &values) const {
+		if (json) {
+			QJsonObject object;
+			for (int i = 0; i < keys.size(); i++) {
+				object.insert(keys[i], QJsonValue::fromVariant(values[i]));
+			}
+			out() << QJsonDocument(object).toJson(QJsonDocument::Compact) << "\n";
+			return;
+		}
+		QStringList fields;
+		for (const QVariant &value : values) {
+			fields.append(tsvField(value.toString()));
+		}
+		out() << fields.join('\t') << "\n";
+	}
+
+	static QString tsvField(QString value) {
+		return value.replace('\\', "\\\\").replace('\t', "\\t").replace('\n', "\\n").replace('\r', "\\r");
+	}
+};
+
+QHash<int, QString> catalogNames(DBManager &db) {
+	QHash<int, QString> names;
+	QSqlQuery catalogs = db.fetchCatalogs();
+	while (catalogs.next()) {
+		names.insert(catalogs.value("ids").toInt(), catalogs.value("name").toString());
+	}
+	return names;
+}
+
+/**
+ * @brief Catalog id from an id or a name, -1 if there is no such catalog.
+ *
+ * Names are not unique; the most recently created catalog wins.
+ */
+int resolveCatalog(DBManager &db, const QString &spec) {
+	QHash<int, QString> names = catalogNames(db);
+	bool numeric = false;
+	int id = spec.toInt(&numeric);
+	if (numeric && names.contains(id)) {
+		return id;
+	}
+	int found = -1;
+	for (auto it = names.constBegin(); it != names.constEnd(); ++it) {
+		if (it.value() == spec && it.key() > found) {
+			found = it.key();
+		}
+	}
+	return found;
+}
+
+QString catalogPath(DBManager &db, int catalog_id) {
+	QSqlQuery catalogs = db.fetchCatalogs();
+	while (catalogs.next()) {
+		if (catalogs.value("ids").toInt() == catalog_id) {
+			return catalogs.value("original_path").toString();
+		}
+	}
+	return QString();
+}
+
+void printStats(DBManager &db, const Output &output, int catalog_id, const QString &name) {
+	CatalogStats stats = db.catalogStats(catalog_id);
+	output.record({"catalog_id", "catalog", "files", "directories", "bytes", "deleted", "thumbnails_ready",
+		       "thumbnails_pending", "thumbnails_failed"},
+		      {catalog_id, name, stats.files, stats.directories, stats.total_size, stats.deleted, stats.thumbnails_ready,
+		       stats.thumbnails_pending, stats.thumbnails_failed});
+}
+
+/**
+ * @brief Generate every thumbnail still pending in the database.
+ *
+ * Covers what the scan queued as well as work an earlier, interrupted run
+ * left behind, for the catalogs whose files can be reached.
+ */
+void drainThumbnails(DBManager &db, ThumbnailQueue &queue) {
+	queue.waitForIdle();
+	QVector<int> catalogs = db.reachableCatalogs();
+	int after = 0;
+	for (;;) {
+		QVector<QPair<int, QString>> pending = db.pendingThumbnails(after, pending_page, catalogs);
+		if (pending.isEmpty()) {
+			break;
+		}
+		for (const QPair<int, QString> &entry : pending) {
+			queue.addRequest(ThumbnailRequest{entry.first, entry.second, thumbnail_size});
+			after = entry.first;
+		}
+	}
+	queue.waitForIdle();
+}
+
+/**
+ * @brief Run a scan on its thread and wait for it, thumbnails included.
+ * @param catalog_id existing catalog, or -1 to create one called name
+ * @param hashes hash files afterwards so duplicates can be listed
+ * @param threads walker threads, 0 for one per core
+ * @param metrics_log file the scan metrics are appended to, or empty
+ */
+int runScan(QString db_path, const QString &path, int catalog_id, const QString &name, bool incremental, bool thumbnails,
+	    bool hashes, int threads, const QString &metrics_log) {
+	ScanMetrics *metrics = ScanMetrics::instance();
+	ThumbnailQueue *queue = thumbnails ? new ThumbnailQueue(nullptr, db_path) : nullptr;
+	Scanner scanner(nullptr, db_path);
+	scanner.setThumbnailQueue(queue);
+	scanner.withThumbs(thumbnails);
+	scanner.setPath(path);
+	scanner.setCatalogId(catalog_id);
+	scanner.setCatalogName(name);
+	scanner.setIncremental(incremental);
+	scanner.setHashing(hashes);
+	scanner.setThreadCount(threads > 0 ? threads : QThread::idealThreadCount());
+
+	QEventLoop loop;
+	bool failed = false;
+	QObject::connect(&scanner, &Scanner::scanFailed, &loop, [&failed](QString message) {
+		err() << message << "\n";
+		err().flush();
+		failed = true;
+	});
+	if (verbose) {
+		scanner.setProgressInterval(1000);
+		QObject::connect(&scanner, &Scanner::progress, &loop, [](ScanProgress progress) {
+			if (progress.hashing) {
+				err() << "Hashing, " << progress.hashed << " files read\n";
+				err().flush();
+				return;
+			}
+			err() << progress.files << " files, " << progress.dirs << " directories, "
+			      << qRound64(progress.files_per_sec) << " files/s  " << progress.directory << "\n";
+			err().flush();
+		});
+	}
+	QObject::connect(&scanner, &QThread::finished, &loop, &QEventLoop::quit);
+	scanner.start();
+	loop.exec();
+
+	if (queue) {
+		if (!failed) {
+			DBManager db(db_path, "cli_thumbnails");
+			drainThumbnails(db, *queue);
+		}
+		delete queue;
+	}
+	// Written after the thumbnails, so their timings are in the same line.
+	if (!metrics_log.isEmpty() && !failed && !ScanMetrics::appendToLog(metrics_log, metrics->snapshot())) {
+		err() << "Unable to write the scan metrics to " << metrics_log << "\n";
+	}
+	return failed ? ExitFailure : ExitOk;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setOrganizationName("PoorMansCatalog");
+	QCoreApplication::setApplicationName("poorman-cli");
+	qInstallMessageHandler(messageHandler);
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Scan, search and maintain Poor Man's Catalog databases without a display.");
+	parser.addHelpOption();
+	QCommandLineOption db_option("db", "Catalog database (default: ~/poorman.sqlite).", "file",
+				     QDir::home().absolutePath() + "/poorman.sqlite");
+	QCommandLineOption format_option("format", "Output format: tsv or json (one object per line).", "format", "tsv");
+	QCommandLineOption verbose_option("verbose", "Log progress and diagnostics to stderr.");
+	parser.addOption(db_option);
+	parser.addOption(format_option);
+	parser.addOption(verbose_option);
+	parser.addPositionalArgument("command", "scan, rescan, search, duplicates, prune or stats.");
+	parser.parse(app.arguments());
+
+	QStringList args = parser.positionalArguments();
+	QString command = args.isEmpty() ? QString() : args.first();
+	QCommandLineOption name_option("name", "Catalog name (default: the directory name).", "name");
+	QCommandLineOption no_thumbs_option("no-thumbnails", "Do not generate thumbnails.");
+	QCommandLineOption threads_option("threads", "Threads listing directories, 0 for one per core (default: 0).", "count", "0");
+	QCommandLineOption hash_option("hash", "Hash file contents afterwards so duplicates can be listed.");
+	QCommandLineOption metrics_option("metrics-log", "Append the scan metrics as a JSON line to this file.", "file");
+	QCommandLineOption full_option("full", "Compare every file instead of skipping unchanged directories.");
+	QCommandLineOption catalog_option("catalog", "Only search this catalog (id or name).", "catalog");
+	QCommandLineOption any_option("any", "Match any of the terms instead of all of them.");
+	QCommandLineOption vacuum_option("vacuum", "Compact the database file afterwards.");
+	parser.clearPositionalArguments();
+	if (command == "scan") {
+		parser.addPositionalArgument("scan", "Add a directory as a new catalog.");
+		parser.addPositionalArgument("path", "Directory to scan.");
+		parser.addOption(name_option);
+		parser.addOption(no_thumbs_option);
+		parser.addOption(threads_option);
+		parser.addOption(hash_option);
+		parser.addOption(metrics_option);
+	} else if (command == "rescan") {
+		parser.addPositionalArgument("rescan", "Update a catalog, resuming an interrupted scan.");
+		parser.addPositionalArgument("catalog", "Catalog id or name.");
+		parser.addOption(no_thumbs_option);
+		parser.addOption(threads_option);
+		parser.addOption(full_option);
+		parser.addOption(hash_option);
+		parser.addOption(metrics_option);
+	} else if (command == "search") {
+		parser.addPositionalArgument("search", "Print matching entries: id, catalog, size, path.");
+		parser.addPositionalArgument("terms", "Search terms.", "terms...");
+		parser.addOption(catalog_option);
+		parser.addOption(any_option);
+	} else if (command == "duplicates") {
+		parser.addPositionalArgument("duplicates", "Print files with identical contents: group, size, hash, catalog, path.");
+		parser.addPositionalArgument("catalog", "Only groups with a copy in this catalog (default: all).", "[catalog]");
+	} else if (command == "prune") {
+		parser.addPositionalArgument("prune", "Remove entries that vanished from disk.");
+		parser.addPositionalArgument("catalog", "Catalog id or name (default: all).", "[catalog]");
+		parser.addOption(vacuum_option);
+	} else if (command == "stats") {
+		parser.addPositionalArgument("stats", "Print totals per catalog.");
+		parser.addPositionalArgument("catalog", "Catalog id or name (default: all).", "[catalog]");
+	}
+	parser.process(app);
+
+	verbose = parser.isSet(verbose_option);
+	QString format = parser.value(format_option);
+	if (format != "tsv" && format != "json") {
+		err() << "Unknown format " << format << "\n";
+		return ExitUsage;
+	}
+	Output output{format == "json"};
+	args = parser.positionalArguments();
+	if (command.isEmpty()) {
+		parser.showHelp(ExitUsage);
+	}
+	// Checked before the database is opened, which would create the file.
+	if (!QStringList({"scan", "rescan", "search", "duplicates", "prune", "stats"}).contains(command)) {
+		err() << "Unknown command " << command << "\n";
+		err().flush();
+		parser.showHelp(ExitUsage);
+	}
+	args.removeFirst();
+
+	QString db_path = parser.value(db_option);
+	DBManager db(db_path, "cli");
+	int status = ExitOk;
+
+	if (command == "scan") {
+		if (args.size() != 1) {
+			parser.showHelp(ExitUsage);
+		}
+		QString path = QDir::cleanPath(QDir(args.first()).absolutePath());
+		QString name = parser.isSet(name_option) ? parser.value(name_option) : QDir(path).dirName();
+		status = runScan(db_path, path, -1, name, false, !parser.isSet(no_thumbs_option), parser.isSet(hash_option),
+				 parser.value(threads_option).toInt(), parser.value(metrics_option));
+		if (status == ExitOk) {
+			printStats(db, output, resolveCatalog(db, name), name);
+		}
+	} else if (command == "rescan") {
+		if (args.size() != 1) {
+			parser.showHelp(ExitUsage);
+		}
+		int catalog_id = resolveCatalog(db, args.first());
+		if (catalog_id == -1) {
+			err() << "No catalog " << args.first() << "\n";
+			return ExitFailure;
+		}
+		status = runScan(db_path, catalogPath(db, catalog_id), catalog_id, QString(), !parser.isSet(full_option),
+				 !parser.isSet(no_thumbs_option), parser.isSet(hash_option), parser.value(threads_option).toInt(),
+				 parser.value(metrics_option));
+		if (status == ExitOk) {
+			printStats(db, output, catalog_id, catalogNames(db).value(catalog_id));
+		}
+	} else if (command == "search") {
+		if (args.isEmpty()) {
+			parser.showHelp(ExitUsage);
+		}
+		int catalog_id = -1;
+		if (parser.isSet(catalog_option)) {
+			catalog_id = resolveCatalog(db, parser.value(catalog_option));
+			if (catalog_id == -1) {
+				err() << "No catalog " << parser.value(catalog_option) << "\n";
+				return ExitFailure;
+			}
+		}
+		QHash<int, QString> names = catalogNames(db);
+		QSqlQuery results = db.searchFiles(args.join(' '), !parser.isSet(any_option), catalog_id);
+		while (results.next()) {
+			int entry_catalog = results.value("catalog_id").toInt();
+			output.record({"id", "catalog", "size", "path", "catalog_id", "is_directory"},
+				      {results.value("ids").toInt(), names.value(entry_catalog), results.value("filesize").toLongLong(),
+				       results.value("full_path").toString(), entry_catalog,
+				       results.value("is_directory").toInt() == 1});
+		}
+	} else if (command == "duplicates") {
+		int catalog_id = -1;
+		if (!args.isEmpty()) {
+			catalog_id = resolveCatalog(db, args.first());
+			if (catalog_id == -1) {
+				err() << "No catalog " << args.first() << "\n";
+				return ExitFailure;
+			}
+		}
+		QHash<int, QString> names = catalogNames(db);
+		QSqlQuery results = db.findDuplicates(catalog_id);
+		int group = 0;
+		qint64 group_size = -1;
+		qint64 group_hash = 0;
+		while (results.next()) {
+			qint64 size = results.value("filesize").toLongLong();
+			qint64 hash = results.value("content_hash").toLongLong();
+			if (group == 0 || size != group_size || hash != group_hash) {
+				group++;
+				group_size = size;
+				group_hash = hash;
+			}
+			int entry_catalog = results.value("catalog_id").toInt();
+			output.record({"group", "size", "hash", "catalog", "path", "id", "catalog_id"},
+				      {group, size, QString::number(quint64(hash), 16).rightJustified(16, '0'), names.value(entry_catalog),
+				       results.value("full_path").toString(), results.value("ids").toInt(), entry_catalog});
+		}
+	} else if (command == "prune" || command == "stats") {
+		QHash<int, QString> names = catalogNames(db);
+		QList<int> catalog_ids = names.keys();
+		if (!args.isEmpty()) {
+			int catalog_id = resolveCatalog(db, args.first());
+			if (catalog_id == -1) {
+				err() << "No catalog " << args.first() << "\n";
+				return ExitFailure;
+			}
+			catalog_ids = {catalog_id};
+		}
+		std::sort(catalog_ids.begin(), catalog_ids.end());
+		for (int catalog_id : catalog_ids) {
+			if (command == "stats") {
+				printStats(db, output, catalog_id, names.value(catalog_id));
+				continue;
+			}
+			int purged = db.purgeTombstones(catalog_id);
+			if (purged < 0) {
+				status = ExitFailure;
+			}
+			output.record({"catalog_id", "catalog", "purged"}, {catalog_id, names.value(catalog_id), qMax(0, purged)});
+		}
+		if (command == "prune" && parser.isSet(vacuum_option) && !db.vacuum()) {
+			status = ExitFailure;
+		}
+	}
+	out().flush();
+	return status;
+}
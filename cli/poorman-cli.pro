@@ -0,0 +1,16 @@
+QT       += core gui sql
+QT       -= widgets
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = poorman-cli
+
+include(../core.pri)
+
+SOURCES += \
+    main.cpp
+
+# Default rules for deployment.
+unix:!android: target.path = /opt/PoorMansCatalog/bin
+!isEmpty(target.path): INSTALLS += target
@@ -0,0 +1,180 @@
+#include "contenthasher.h"
+#include "xxhash64.h"
+#include <QByteArray>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QThreadPool>
+#include <algorithm>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#endif
+
+namespace {
+// Bytes hashed at each end of a file in the first pass.
+const qint64 partial_block = 64 * 1024;
+const int read_block = 1024 * 1024;
+const int page_size = 256;
+// How often progress is reported, and cancellation checked, while a page
+// is being hashed.
+const int poll_ms = 100;
+
+bool readFully(QFile &in, char *data, qint64 size) {
+	while (size > 0) {
+		qint64 read = in.read(data, size);
+		if (read <= 0) {
+			return false;
+		}
+		data += read;
+		size -= read;
+	}
+	return true;
+}
+} // namespace
+
+HashWorker::HashWorker(HashJob *job) : job(job) { setAutoDelete(true); }
+
+void HashWorker::run() {
+	for (;;) {
+		int index = job->next.fetchAndAddRelaxed(1);
+		if (index >= job->files.size() || job->cancelled.loadRelaxed()) {
+			return;
+		}
+		quint64 hash = 0;
+		if (ContentHasher::hashFile(job->files[index], job->content, job->cancelled, hash)) {
+			job->hashes[index] = qint64(hash);
+			job->hashed[index] = 1;
+		}
+		job->done.fetchAndAddRelease(1);
+	}
+}
+
+ContentHasher::ContentHasher(DBManager *db, int thread_count) : db(db), thread_count(qMax(1, thread_count)), hashed(0) {}
+
+/**
+ * @brief Hash every file that may have a duplicate.
+ * @param progress called with the number of files read so far; returning
+ * false stops hashing
+ * @return false if stopped
+ */
+bool ContentHasher::run(const std::function<bool(qint64)> &progress) {
+	hashed = 0;
+	return hashPass(false, progress) && hashPass(true, progress);
+}
+
+bool ContentHasher::hashPass(bool content, const std::function<bool(qint64)> &progress) {
+	QThreadPool pool;
+	pool.setMaxThreadCount(thread_count);
+	int after = 0;
+	for (;;) {
+		HashJob job;
+		job.files = db->hashCandidates(content, after, page_size);
+		if (job.files.isEmpty()) {
+			return true;
+		}
+		after = job.files.last().id;
+		// Inode order follows the on-disk layout on most file systems.
+		std::sort(job.files.begin(), job.files.end(),
+			  [](const HashCandidate &a, const HashCandidate &b) { return a.inode < b.inode; });
+		job.content = content;
+		job.hashes.fill(0, job.files.size());
+		job.hashed.fill(0, job.files.size());
+		for (int i = 0; i < qMin(thread_count, job.files.size()); i++) {
+			pool.start(new HashWorker(&job));
+		}
+		bool stopped = false;
+		while (!pool.waitForDone(poll_ms)) {
+			if (!stopped && !progress(hashed + job.done.loadAcquire())) {
+				stopped = true;
+				job.cancelled.storeRelaxed(1);
+			}
+		}
+
+		QVector<QPair<int, qint64>> partial_hashes;
+		QVector<QPair<int, qint64>> content_hashes;
+		for (int i = 0; i < job.files.size(); i++) {
+			if (!job.hashed[i]) {
+				continue;
+			}
+			const HashCandidate &file = job.files[i];
+			if (content || file.filesize <= 2 * partial_block) {
+				content_hashes.append(qMakePair(file.id, job.hashes[i]));
+			}
+			if (!content) {
+				partial_hashes.append(qMakePair(file.id, job.hashes[i]));
+			}
+		}
+		db->storeHashes(partial_hashes, false);
+		db->storeHashes(content_hashes, true);
+		hashed += job.done.loadAcquire();
+		if (stopped || !progress(hashed)) {
+			return false;
+		}
+	}
+}
+
+/**
+ * @brief Partial or full XXH64 of a catalog file.
+ * @return false if the file cannot be read or no longer matches its row
+ */
+bool ContentHasher::hashFile(const HashCandidate &file, bool full, const QAtomicInt &cancelled, quint64 &hash) {
+	QFile in(file.full_path);
+	if (!in.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+		return false;
+	}
+	// The path may now hold another file, e.g. a different backup drive
+	// mounted at the same place.
+	if (in.size() != file.filesize ||
+	    (file.mtime != 0 && QFileInfo(file.full_path).lastModified().toMSecsSinceEpoch() != file.mtime)) {
+		return false;
+	}
+	bool whole = full || file.filesize <= 2 * partial_block;
+#ifdef Q_OS_LINUX
+	// Sequential readahead for whole files; for the two partial blocks,
+	// readahead would only fetch data that is never hashed.
+	posix_fadvise(in.handle(), 0, 0, whole ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_RANDOM);
+#endif
+	Xxh64 state;
+	bool ok = true;
+	if (whole) {
+		QByteArray buffer(int(qMin<qint64>(read_block, qMax<qint64>(file.filesize, 1))), Qt::Uninitialized);
+		qint64 total = 0;
+		for (;;) {
+			if (cancelled.loadRelaxed()) {
+				ok = false;
+				break;
+			}
+			qint64 read = in.read(buffer.data(), buffer.size());
+			if (read < 0) {
+				ok = false;
+				break;
+			}
+			if (read == 0) {
+				break;
+			}
+			state.update(buffer.constData(), size_t(read));
+			total += read;
+		}
+		ok = ok && total == file.filesize;
+	} else {
+		QByteArray buffer(int(partial_block), Qt::Uninitialized);
+		ok = readFully(in, buffer.data(), partial_block);
+		if (ok) {
+			state.update(buffer.constData(), size_t(partial_block));
+			ok = in.seek(file.filesize - partial_block) && readFully(in, buffer.data(), partial_block);
+		}
+		if (ok) {
+			state.update(buffer.constData(), size_t(partial_block));
+		}
+	}
+#ifdef Q_OS_LINUX
+	// Hashing reads whole backups once; keep them from pushing everything
+	// else out of the page cache.
+	posix_fadvise(in.handle(), 0, 0, POSIX_FADV_DONTNEED);
+#endif
+	if (ok) {
+		hash = state.digest();
+	}
+	return ok;
+}
@@ -0,0 +1,55 @@
+#ifndef CONTENTHASHER_H
+#define CONTENTHASHER_H
+
+#include "dbmanager.h"
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QVector>
+#include <functional>
+
+// One page of files shared by the hash workers.
+struct HashJob {
+	QVector<HashCandidate> files;
+	bool content;
+	QVector<qint64> hashes;
+	QVector<char> hashed;
+	QAtomicInt next;
+	QAtomicInt done;
+	QAtomicInt cancelled;
+};
+
+class HashWorker : public QRunnable {
+      public:
+	explicit HashWorker(HashJob *job);
+	void run() override;
+
+      private:
+	HashJob *job;
+};
+
+/**
+ * Computes the content hashes duplicate detection runs on.
+ *
+ * A file is only read when another live file, in any catalog, has the same
+ * size. The first pass hashes its first and last 64 KiB; only files whose
+ * size and partial hash both collide are read completely. Files up to
+ * 128 KiB are read completely in the first pass and get both hashes.
+ *
+ * Reads run on a small pool in inode order, the results are written from
+ * the calling thread.
+ */
+class ContentHasher {
+      public:
+	ContentHasher(DBManager *db, int thread_count);
+	bool run(const std::function<bool(qint64)> &progress);
+	static bool hashFile(const HashCandidate &file, bool full, const QAtomicInt &cancelled, quint64 &hash);
+
+      private:
+	bool hashPass(bool content, const std::function<bool(qint64)> &progress);
+
+	DBManager *db;
+	int thread_count;
+	qint64 hashed;
+};
+
+#endif // CONTENTHASHER_H
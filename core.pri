@@ -0,0 +1,59 @@
+# Catalog core shared by the GUI and poorman-cli: database, scanner and
+# thumbnail pipeline. Nothing in here may depend on QtWidgets.
+
+QT += core gui sql
+
+CONFIG += c++11
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+    $$PWD/contenthasher.cpp \
+    $$PWD/dbmanager.cpp \
+    $$PWD/direnumerator.cpp \
+    $$PWD/mimeclassifier.cpp \
+    $$PWD/parallelwalker.cpp \
+    $$PWD/scanmetrics.cpp \
+    $$PWD/scanner.cpp \
+    $$PWD/thumbnailbackends.cpp \
+    $$PWD/thumbnailcompactor.cpp \
+    $$PWD/thumbnailmanager.cpp \
+    $$PWD/thumbnailqueue.cpp \
+    $$PWD/xxhash64.cpp
+
+HEADERS += \
+    $$PWD/contenthasher.h \
+    $$PWD/dbmanager.h \
+    $$PWD/direnumerator.h \
+    $$PWD/mimeclassifier.h \
+    $$PWD/parallelwalker.h \
+    $$PWD/scanmetrics.h \
+    $$PWD/scanner.h \
+    $$PWD/thumbnailbackends.h \
+    $$PWD/thumbnailcompactor.h \
+    $$PWD/thumbnailmanager.h \
+    $$PWD/thumbnailqueue.h \
+    $$PWD/xxhash64.h
+
+LIBS += -lstdc++fs
+
+unix:!macx {
+    CONFIG += link_pkgconfig
+    # Searches are cancelled with sqlite3_interrupt on the Qt connection. This
+    # needs the same libsqlite3 the Qt SQLite driver uses, which is the case for
+    # distribution Qt packages. Without it a superseded search stops at its next row.
+    packagesExist(sqlite3) {
+        DEFINES += POORMAN_SQLITE_INTERRUPT
+        PKGCONFIG += sqlite3
+    }
+    # Optional in-process thumbnailers for videos and PDFs. Without them these
+    # files go through the external thumbnailers in /usr/share/thumbnailers.
+    packagesExist(libavformat libavcodec libswscale libavutil) {
+        DEFINES += POORMAN_WITH_LIBAV
+        PKGCONFIG += libavformat libavcodec libswscale libavutil
+    }
+    packagesExist(poppler-qt5) {
+        DEFINES += POORMAN_WITH_POPPLER
+        PKGCONFIG += poppler-qt5
+    }
+}
@@ -1,9 +1,20 @@
 #include "dbmanager.h"
+#include "scanmetrics.h"
+#include <QDateTime>
 #include <QDebug>
+#include <QDir>
 #include <QSqlDriver>
 #include <QSqlError>
 #include <QSqlField>
 #include <QSqlQuery>
+#include <algorithm>
+
+#ifdef POORMAN_SQLITE_INTERRUPT
+#include <sqlite3.h>
+#endif
+
+// Keep direntry_fts in sync with direntry, see createSearchIndex().
+static const QStringList fts_triggers = {"direntry_fts_insert", "direntry_fts_delete", "direntry_fts_update"};
 
 /**
  * @brief DBManager::DBManager
@@ -14,14 +25,17 @@
  * to initiate a new connection using connect()
  */
 DBManager::DBManager(QString &dbpath) {
+	initBatchState();
 	this->db_path = dbpath;
 	this->connect();
 }
 
 DBManager::DBManager(QString &dbpath, QString connection_name) {
+	initBatchState();
 	this->db_path = dbpath;
 	if (QSqlDatabase::contains(connection_name)) {
 		m_db = QSqlDatabase::database(connection_name);
+		fts_enabled = hasSearchIndex();
 	} else {
 		m_db = QSqlDatabase::addDatabase("QSQLITE", connection_name);
 		m_db.setDatabaseName(db_path);
@@ -36,58 +50,321 @@ DBManager::DBManager(QString &dbpath, QString connection_name) {
 	}
 }
 
+QString DBManager::formatSQL(QString keyword) {
+	QSqlField f(QLatin1String(""), QVariant::String);
+	f.setValue(keyword);
+	return m_db.driver()->formatValue(f);
+}
+
+namespace {
 /**
- * @brief Find the parent directory id.
- * @param catalog_id
- * @param full_path
- * @return
+ * @brief "1.5G", "200k" or "4096" in bytes, -1 if malformed. Units are binary.
  */
-int DBManager::findParent(int catalog_id, QString full_path) {
-	QSqlQuery query(m_db);
-	query.prepare("SELECT ids FROM direntry WHERE full_path = (:full_path) AND catalog_id = (:catalog_id)");
-	query.bindValue(":full_path", full_path);
-	query.bindValue(":catalog_id", catalog_id);
-	query.exec();
-	if (query.next()) {
-		return query.value("ids").toInt();
+qint64 parseSize(QString text) {
+	text = text.toUpper();
+	if (text.endsWith('B')) {
+		text.chop(1);
 	}
-	return -1;
+	qint64 unit = 1;
+	const QString units = "KMGT";
+	if (!text.isEmpty() && units.contains(text.at(text.size() - 1))) {
+		unit = qint64(1) << (10 * (units.indexOf(text.at(text.size() - 1)) + 1));
+		text.chop(1);
+	}
+	bool ok = false;
+	double value = text.toDouble(&ok);
+	return ok && value >= 0 ? qint64(value * unit) : -1;
 }
 
-QString DBManager::formatSQL(QString keyword) {
-	QSqlField f(QLatin1String(""), QVariant::String);
-	f.setValue(keyword);
-	return m_db.driver()->formatValue(f);
+/**
+ * @brief Local time span of "2019", "2019-03" or "2019-03-05", end exclusive.
+ */
+bool parseDateSpan(const QString &text, qint64 &start, qint64 &end) {
+	QStringList parts = text.split('-');
+	if (parts.size() > 3) {
+		return false;
+	}
+	int values[3] = {0, 1, 1};
+	for (int i = 0; i < parts.size(); i++) {
+		bool ok = false;
+		values[i] = parts[i].toInt(&ok);
+		if (!ok) {
+			return false;
+		}
+	}
+	QDate first(values[0], values[1], values[2]);
+	if (!first.isValid()) {
+		return false;
+	}
+	QDate next = parts.size() == 1 ? first.addYears(1) : parts.size() == 2 ? first.addMonths(1) : first.addDays(1);
+	start = QDateTime(first, QTime(0, 0)).toMSecsSinceEpoch();
+	end = QDateTime(next, QTime(0, 0)).toMSecsSinceEpoch();
+	return true;
+}
+
+// The two sides of "a..b", ">a", ">=a", "<a", "<=a" or "a".
+struct RangeText {
+	QString low;
+	QString high;
+	bool low_exclusive;
+	bool high_exclusive;
+};
+
+RangeText splitRange(const QString &text) {
+	RangeText range{QString(), QString(), false, false};
+	if (text.startsWith(">=")) {
+		range.low = text.mid(2);
+	} else if (text.startsWith('>')) {
+		range.low = text.mid(1);
+		range.low_exclusive = true;
+	} else if (text.startsWith("<=")) {
+		range.high = text.mid(2);
+	} else if (text.startsWith('<')) {
+		range.high = text.mid(1);
+		range.high_exclusive = true;
+	} else if (text.contains("..")) {
+		int separator = text.indexOf("..");
+		range.low = text.left(separator);
+		range.high = text.mid(separator + 2);
+	} else {
+		range.low = text;
+		range.high = text;
+	}
+	return range;
+}
+
+bool parseSizeRange(const QString &text, qint64 &min_size, qint64 &max_size) {
+	RangeText range = splitRange(text);
+	qint64 low = range.low.isEmpty() ? -1 : parseSize(range.low);
+	qint64 high = range.high.isEmpty() ? -1 : parseSize(range.high);
+	if ((!range.low.isEmpty() && low < 0) || (!range.high.isEmpty() && high < 0) || (low < 0 && high < 0)) {
+		return false;
+	}
+	if (low >= 0) {
+		min_size = range.low_exclusive ? low + 1 : low;
+	}
+	if (high >= 0) {
+		max_size = range.high_exclusive ? high - 1 : high;
+	}
+	return true;
 }
 
+bool parseDateRange(const QString &text, qint64 &after, qint64 &before) {
+	RangeText range = splitRange(text);
+	qint64 low_start = -1, low_end = -1, high_start = -1, high_end = -1;
+	if ((!range.low.isEmpty() && !parseDateSpan(range.low, low_start, low_end)) ||
+	    (!range.high.isEmpty() && !parseDateSpan(range.high, high_start, high_end)) || (range.low.isEmpty() && range.high.isEmpty())) {
+		return false;
+	}
+	if (!range.low.isEmpty()) {
+		after = range.low_exclusive ? low_end : low_start;
+	}
+	if (!range.high.isEmpty()) {
+		before = range.high_exclusive ? high_start : high_end;
+	}
+	return true;
+}
+
+typedef QVector<QPair<QString, QVariant>> BoundValues;
+
+/**
+ * @brief WHERE terms for the facets of filter. Each one can be answered
+ * from a partial facet index, see DBManager::createIndexes().
+ */
+void facetConditions(const FileFilter &filter, QStringList &conditions, BoundValues &values) {
+	if (filter.isEmpty()) {
+		return;
+	}
+	conditions.append("is_directory = 0");
+	if (filter.min_size != -1) {
+		conditions.append("filesize >= (:min_size)");
+		values.append(qMakePair(QString(":min_size"), QVariant((long long)filter.min_size)));
+	}
+	if (filter.max_size != -1) {
+		conditions.append("filesize <= (:max_size)");
+		values.append(qMakePair(QString(":max_size"), QVariant((long long)filter.max_size)));
+	}
+	QStringList types;
+	for (int i = 0; i < filter.mime_types.size(); i++) {
+		const QString &type = filter.mime_types[i];
+		QString name = QString(":type_%1").arg(i);
+		if (type.endsWith('/')) {
+			// A family is the range of types between "video/" and "video0".
+			QString upper = type;
+			upper[upper.size() - 1] = QChar('/' + 1);
+			types.append(QString("(mime_type >= (%1_from) AND mime_type < (%1_to))").arg(name));
+			values.append(qMakePair(name + "_from", QVariant(type)));
+			values.append(qMakePair(name + "_to", QVariant(upper)));
+		} else {
+			types.append(QString("mime_type = (%1)").arg(name));
+			values.append(qMakePair(name, QVariant(type)));
+		}
+	}
+	if (!types.isEmpty()) {
+		conditions.append("(" + types.join(" OR ") + ")");
+	}
+	QStringList extensions;
+	for (int i = 0; i < filter.extensions.size(); i++) {
+		QString name = QString(":extension_%1").arg(i);
+		extensions.append(name);
+		values.append(qMakePair(name, QVariant(filter.extensions[i])));
+	}
+	if (!extensions.isEmpty()) {
+		conditions.append("extension IN (" + extensions.join(", ") + ")");
+	}
+	const struct {
+		const char *condition;
+		const char *name;
+		qint64 value;
+	} bounds[] = {{"mtime >= (:modified_after)", ":modified_after", filter.modified_after},
+		      {"mtime < (:modified_before)", ":modified_before", filter.modified_before},
+		      {"ctime >= (:changed_after)", ":changed_after", filter.changed_after},
+		      {"ctime < (:changed_before)", ":changed_before", filter.changed_before}};
+	for (const auto &bound : bounds) {
+		if (bound.value != -1) {
+			conditions.append(bound.condition);
+			values.append(qMakePair(QString(bound.name), QVariant((long long)bound.value)));
+		}
+	}
+}
+} // namespace
+
+FileFilter::FileFilter()
+    : catalog_id(-1), min_size(-1), max_size(-1), modified_after(-1), modified_before(-1), changed_after(-1), changed_before(-1) {}
+
+bool FileFilter::isEmpty() const {
+	return min_size == -1 && max_size == -1 && mime_types.isEmpty() && extensions.isEmpty() && modified_after == -1 &&
+	       modified_before == -1 && changed_after == -1 && changed_before == -1;
+}
+
+/**
+ * @brief Remove the filter words from a search text and return them as a filter.
+ *
+ * Understands type:video, type:image/png, type:pdf, ext:jpg,png,
+ * size:>1G, size:10M..100M, modified:2019, modified:2019-03..2020 and
+ * changed: with the same dates. Words that do not parse stay in text as
+ * keywords.
+ */
+FileFilter FileFilter::take(QString &text) {
+	FileFilter filter;
+	QStringList keywords;
+	for (const QString &word : text.split(' ', Qt::SkipEmptyParts)) {
+		int colon = word.indexOf(':');
+		QString key = word.left(colon).toLower();
+		QString value = word.mid(colon + 1);
+		bool taken = colon > 0 && !value.isEmpty();
+		if (taken && key == "type") {
+			for (QString type : value.toLower().split(',', Qt::SkipEmptyParts)) {
+				if (type == "pdf") {
+					type = "application/pdf";
+				} else if (!type.contains('/')) {
+					type += '/';
+				}
+				filter.mime_types.append(type);
+			}
+		} else if (taken && key == "ext") {
+			for (QString extension : value.toLower().split(',', Qt::SkipEmptyParts)) {
+				if (extension.startsWith('.')) {
+					extension.remove(0, 1);
+				}
+				filter.extensions.append(extension);
+			}
+		} else if (taken && key == "size") {
+			taken = parseSizeRange(value, filter.min_size, filter.max_size);
+		} else if (taken && key == "modified") {
+			taken = parseDateRange(value, filter.modified_after, filter.modified_before);
+		} else if (taken && key == "changed") {
+			taken = parseDateRange(value, filter.changed_after, filter.changed_before);
+		} else {
+			taken = false;
+		}
+		if (!taken) {
+			keywords.append(word);
+		}
+	}
+	text = keywords.join(' ');
+	return filter;
+}
+
+/**
+ * @brief Search with the filter words of keyword applied, see FileFilter::take().
+ */
 QSqlQuery DBManager::searchFiles(QString keyword, bool and_join, int cat_id) {
+	FileFilter filter = FileFilter::take(keyword);
+	filter.catalog_id = cat_id;
+	return searchFiles(keyword, and_join, filter);
+}
+
+/**
+ * @brief Search paths for all or any of the space separated keywords.
+ *
+ * Keywords of three or more characters go through the trigram index, which
+ * keeps the substring semantics of LIKE. Shorter ones cannot be matched by
+ * trigrams and are checked with LIKE on the rows the index returned; for
+ * "any" searches that would need a full scan anyway, so the whole query
+ * falls back to LIKE. The facets of filter always apply.
+ */
+QSqlQuery DBManager::searchFiles(QString keyword, bool and_join, const FileFilter &filter) {
 	QSqlQuery query(m_db);
 	QString temp = "full_path LIKE '%%1%'";
+	QStringList keywords = keyword.split(" ", Qt::SkipEmptyParts);
+	bool use_fts = fts_enabled;
+	for (const QString &k : keywords) {
+		if (!and_join && k.length() < 3) {
+			use_fts = false;
+		}
+	}
+
 	QStringList where;
-	QStringList keywords = keyword.split(" ");
+	QStringList match_terms;
 	for (QString k : keywords) {
+		if (use_fts && k.length() >= 3) {
+			match_terms.append("\"" + QString(k).replace("\"", "\"\"") + "\"");
+			continue;
+		}
 		QString ck = formatSQL(k).replace("'", "");
 		where.append(temp.arg(ck));
 	}
 	QString joiner = and_join ? " AND " : " OR ";
-	if (cat_id == -1) {
-		query.prepare("SELECT ids, directory, full_path, name, filesize, is_directory, catalog_id, parent_id, "
-			      "thumbnail64 IS NOT NULL AS has_thumbnail FROM direntry WHERE (" +
-			      where.join(joiner) + ")");
-	} else {
-		query.prepare("SELECT ids, directory, full_path, name, filesize, is_directory, catalog_id, parent_id, "
-			      "thumbnail64 IS NOT NULL AS has_thumbnail FROM direntry WHERE catalog_id = (:catalog_id) AND (" +
-			      where.join(joiner) + ")");
-		query.bindValue(":catalog_id", cat_id);
+	if (!match_terms.isEmpty()) {
+		where.prepend("ids IN (SELECT rowid FROM direntry_fts WHERE direntry_fts MATCH (:match))");
+	}
+	if (where.isEmpty()) {
+		where.append("1");
+	}
+
+	QStringList conditions;
+	BoundValues values;
+	if (filter.catalog_id != -1) {
+		conditions.append("catalog_id = (:catalog_id)");
+		values.append(qMakePair(QString(":catalog_id"), QVariant(filter.catalog_id)));
+	}
+	conditions.append("is_deleted = 0");
+	facetConditions(filter, conditions, values);
+	conditions.append("(" + where.join(joiner) + ")");
+	query.prepare("SELECT ids, directory, full_path, name, filesize, is_directory, catalog_id, parent_id, "
+		      "has_thumbnail FROM direntry WHERE " +
+		      conditions.join(" AND "));
+	for (const QPair<QString, QVariant> &value : values) {
+		query.bindValue(value.first, value.second);
+	}
+	if (!match_terms.isEmpty()) {
+		query.bindValue(":match", match_terms.join(joiner));
 	}
 	query.exec();
 	return query;
 }
 
+/**
+ * @brief Every live file matching filter.
+ */
+QSqlQuery DBManager::filterFiles(const FileFilter &filter) { return searchFiles(QString(), true, filter); }
+
 int DBManager::getRootId(int cat_id) {
 	QSqlQuery query(m_db);
 	query.prepare(
-	    "SELECT ids FROM direntry WHERE catalog_id = (:catalog_id) AND parent_id = -1 AND name = (:name) AND is_directory = 1");
+	    "SELECT ids FROM direntry WHERE catalog_id = (:catalog_id) AND parent_id = -1 AND name = (:name) AND is_directory = 1 AND "
+	    "is_deleted = 0");
 	query.bindValue(":catalog_id", cat_id);
 	query.bindValue(":name", "");
 	query.exec();
@@ -99,7 +376,7 @@ int DBManager::getRootId(int cat_id) {
 
 QSqlQuery DBManager::allFiles(int cat_id) {
 	QSqlQuery query(m_db);
-	query.prepare("SELECT ids, full_path FROM direntry WHERE catalog_id = (:catalog_id)");
+	query.prepare("SELECT ids, full_path FROM direntry WHERE catalog_id = (:catalog_id) AND is_deleted = 0");
 	query.bindValue(":catalog_id", cat_id);
 	query.exec();
 	return query;
@@ -112,11 +389,30 @@ QSqlQuery DBManager::fetchCatalogs() {
 	return query;
 }
 
+/**
+ * @brief Catalogs whose scanned directory is currently there, e.g. whose
+ * drive is plugged in.
+ */
+QVector<int> DBManager::reachableCatalogs() {
+	QVector<int> ids;
+	QSqlQuery query(m_db);
+	if (!query.exec("SELECT ids, original_path FROM catalog ORDER BY ids")) {
+		qDebug() << "Unable to read catalogs" << query.lastError();
+		return ids;
+	}
+	while (query.next()) {
+		if (QDir(query.value(1).toString()).exists()) {
+			ids.append(query.value(0).toInt());
+		}
+	}
+	return ids;
+}
+
 QSqlQuery DBManager::fetchFiles(int parent_id) {
 	QSqlQuery query(m_db);
 	query.prepare("SELECT ids, directory, full_path, name, filesize, is_directory, catalog_id, parent_id, "
-		      "thumbnail64 IS NOT NULL AS has_thumbnail FROM direntry WHERE parent_id = (:parent_id) AND "
-		      "is_directory = 0 ORDER BY name");
+		      "has_thumbnail FROM direntry WHERE parent_id = (:parent_id) AND "
+		      "is_directory = 0 AND is_deleted = 0 ORDER BY name");
 	query.bindValue(":parent_id", parent_id);
 	query.exec();
 	return query;
@@ -125,23 +421,47 @@ QSqlQuery DBManager::fetchFiles(int parent_id) {
 QSqlQuery DBManager::fetchFiles(int parent_id, int catalog_id) {
 	QSqlQuery query(m_db);
 	query.prepare("SELECT ids, directory, full_path, name, filesize, is_directory, catalog_id, parent_id, "
-		      "thumbnail64 IS NOT NULL AS has_thumbnail FROM direntry WHERE parent_id = (:parent_id) AND "
-		      "catalog_id = (:catalog_id) AND is_directory = 0 ORDER BY name");
+		      "has_thumbnail FROM direntry WHERE parent_id = (:parent_id) AND "
+		      "catalog_id = (:catalog_id) AND is_directory = 0 AND is_deleted = 0 ORDER BY name");
+	query.setForwardOnly(true);
 	query.bindValue(":parent_id", parent_id);
 	query.bindValue(":catalog_id", catalog_id);
 	query.exec();
 	return query;
 }
 
-QSqlQuery DBManager::fetchDirectoryTree(int cat_id, int parent_id) {
-	QSqlQuery query(m_db);
-	query.prepare(
-	    "SELECT ids, name FROM direntry WHERE catalog_id = (:catalog_id) AND is_directory = 1 AND "
-	    "parent_id = (:parent_id) ORDER BY ids;");
-	query.bindValue(":catalog_id", cat_id);
-	query.bindValue(":parent_id", parent_id);
-	query.exec();
-	return query;
+/**
+ * @brief Live subdirectories of several directories at once, grouped by parent.
+ */
+QVector<DirectoryRow> DBManager::fetchDirectoryChildren(int cat_id, const QVector<int> &parent_ids) {
+	const int chunk_size = 500;
+	QVector<DirectoryRow> rows;
+	for (int start = 0; start < parent_ids.size(); start += chunk_size) {
+		QVector<int> chunk = parent_ids.mid(start, chunk_size);
+		QStringList placeholders;
+		for (int i = 0; i < chunk.size(); i++) {
+			placeholders.append("?");
+		}
+		QSqlQuery query(m_db);
+		query.setForwardOnly(true);
+		query.prepare(QString("SELECT ids, parent_id, name, total_size, file_count, dir_count FROM direntry "
+				      "WHERE catalog_id = ? AND is_directory = 1 AND is_deleted = 0 AND parent_id IN (%1) "
+				      "ORDER BY parent_id, ids")
+				  .arg(placeholders.join(", ")));
+		query.addBindValue(cat_id);
+		for (int id : chunk) {
+			query.addBindValue(id);
+		}
+		if (!query.exec()) {
+			qDebug() << "Unable to read directories" << query.lastError();
+			continue;
+		}
+		while (query.next()) {
+			rows.append(DirectoryRow{query.value(0).toInt(), query.value(1).toInt(), query.value(2).toString(),
+						 query.value(3).toLongLong(), query.value(4).toLongLong(), query.value(5).toLongLong()});
+		}
+	}
+	return rows;
 }
 
 /**
@@ -165,24 +485,43 @@ void DBManager::connect() {
  * @brief DBManager::~DBManager
  */
 DBManager::~DBManager() {
+	endBatch();
 	if (m_db.isOpen())
 		m_db.close();
 }
 
 /**
- * @brief Check if the directory entry exists.
- * @param full_path
- * @return
+ * @brief Load every row of a catalog with what is needed to detect changes.
+ * @param catalog_id
+ * @return full_path -> row state, tombstoned rows included
+ *
+ * Used by the scanner to resolve parents and compare against the disk
+ * without a query per file.
  */
-bool DBManager::dirEntryExists(QString full_path) {
+QHash<QString, IndexedEntry> DBManager::fetchIndex(int catalog_id) {
+	QHash<QString, IndexedEntry> result;
 	QSqlQuery query(m_db);
-	query.prepare("SELECT ids FROM direntry WHERE full_path = (:full_path)");
-	query.bindValue(":full_path", full_path);
-	query.exec();
-	if (query.next()) {
-		return true;
+	query.setForwardOnly(true);
+	query.prepare("SELECT ids, full_path, filesize, mtime, inode, device, is_directory, is_deleted, "
+		      "mime_type <> '' AND ctime <> 0 FROM direntry WHERE catalog_id = (:catalog_id)");
+	query.bindValue(":catalog_id", catalog_id);
+	if (!query.exec()) {
+		qDebug() << "Unable to load catalog index" << query.lastError();
+		return result;
 	}
-	return false;
+	while (query.next()) {
+		IndexedEntry entry;
+		entry.id = query.value(0).toInt();
+		entry.filesize = query.value(2).toLongLong();
+		entry.mtime = query.value(3).toLongLong();
+		entry.inode = query.value(4).toLongLong();
+		entry.device = query.value(5).toLongLong();
+		entry.is_directory = query.value(6).toInt() == 1;
+		entry.is_deleted = query.value(7).toInt() == 1;
+		entry.has_facets = query.value(8).toInt() == 1;
+		result.insert(query.value(1).toString(), entry);
+	}
+	return result;
 }
 
 int DBManager::createCatalog(Catalog &catalog) { return createCatalog(catalog.name, catalog.original_path, catalog.tags); }
@@ -209,17 +548,15 @@ int DBManager::createDirEntry(QString name, QString directory, QString full_path
 	QSqlQuery query(m_db);
 	query.prepare("INSERT INTO direntry ("
 		      "directory, full_path, name, "
-		      "filesize, thumbnail64, "
-		      "is_directory, catalog_id, parent_id"
+		      "filesize, is_directory, catalog_id, parent_id"
 		      ") VALUES ("
 		      ":directory, :full_path, :name, :filesize, "
-		      ":thumbnail64, :is_directory, :catalog_id, :parent_id)");
+		      ":is_directory, :catalog_id, :parent_id)");
 	QVariant qfilesize((long long)filesize);
 	query.bindValue(":directory", directory);
 	query.bindValue(":full_path", full_path);
 	query.bindValue(":name", name);
 	query.bindValue(":filesize", qfilesize);
-	query.bindValue(":thumbnail64", thumbnail);
 	query.bindValue(":is_directory", (is_directory ? 1 : 0));
 	query.bindValue(":catalog_id", catalog_id);
 	query.bindValue(":parent_id", parent_id);
@@ -228,12 +565,17 @@ int DBManager::createDirEntry(QString name, QString directory, QString full_path
 		return -1;
 	}
 
-	return query.lastInsertId().toInt();
+	int id = query.lastInsertId().toInt();
+	if (!thumbnail.isEmpty()) {
+		updateThumbnail(id, thumbnail);
+	}
+	return id;
 }
 
 DirEntry DBManager::getDirentry(int id) {
 	QSqlQuery query(m_db);
-	query.prepare("SELECT * FROM direntry WHERE ids = (:ids)");
+	query.prepare("SELECT direntry.*, thumbnail.data AS thumbnail_data FROM direntry "
+		      "LEFT JOIN thumbnail ON thumbnail.entry_id = direntry.ids WHERE direntry.ids = (:ids)");
 	query.bindValue(":ids", id);
 	if (query.exec() && query.next()) {
 		return DirEntry{
@@ -242,10 +584,17 @@ DirEntry DBManager::getDirentry(int id) {
 		    query.value("full_path").toString(),
 		    query.value("name").toString(),
 		    query.value("filesize").toInt(),
-		    query.value("thumbnail64").toByteArray(),
+		    query.value("thumbnail_data").toByteArray(),
 		    query.value("is_directory").toInt() == 1,
 		    query.value("catalog_id").toInt(),
 		    query.value("parent_id").toInt(),
+		    query.value("mtime").toLongLong(),
+		    query.value("inode").toLongLong(),
+		    query.value("device").toLongLong(),
+		    query.value("has_thumbnail").toInt(),
+		    query.value("mime_type").toString(),
+		    query.value("extension").toString(),
+		    query.value("ctime").toLongLong(),
 		};
 	}
 	return DirEntry{};
@@ -279,24 +628,805 @@ bool DBManager::deleteFiles(int cat_id, QVector<int> files) {
 	return true;
 }
 
+/**
+ * @brief Mark rows as deleted without removing them.
+ * @param cat_id
+ * @param files
+ *
+ * Rescans tombstone entries that vanished from disk; purgeTombstones()
+ * removes them for good.
+ */
+bool DBManager::tombstoneFiles(int cat_id, QVector<int> files) {
+	const int chunk_size = 500;
+	bool ok = true;
+	for (int start = 0; start < files.size(); start += chunk_size) {
+		QVector<int> chunk = files.mid(start, chunk_size);
+		QStringList placeholders;
+		for (int i = 0; i < chunk.size(); i++) {
+			placeholders.append("?");
+		}
+		QSqlQuery query(m_db);
+		query.prepare(
+		    QString("UPDATE direntry SET is_deleted = 1 WHERE catalog_id = ? AND ids IN (%1)").arg(placeholders.join(", ")));
+		query.addBindValue(cat_id);
+		for (int id : chunk) {
+			query.addBindValue(id);
+		}
+		if (!query.exec()) {
+			qDebug() << "Unable to tombstone entries" << query.lastError();
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+/**
+ * @brief Row and thumbnail counts of a catalog, as shown by the stats command.
+ */
+CatalogStats DBManager::catalogStats(int cat_id) {
+	CatalogStats stats = {0, 0, 0, 0, 0, 0, 0};
+	QSqlQuery query(m_db);
+	query.prepare("SELECT SUM(is_deleted = 0 AND is_directory = 0), SUM(is_deleted = 0 AND is_directory = 1), "
+		      "SUM(CASE WHEN is_deleted = 0 AND is_directory = 0 THEN filesize ELSE 0 END), SUM(is_deleted), "
+		      "SUM(is_deleted = 0 AND has_thumbnail = 1), SUM(is_deleted = 0 AND has_thumbnail = 2), "
+		      "SUM(is_deleted = 0 AND has_thumbnail = 3) FROM direntry WHERE catalog_id = (:catalog_id)");
+	query.bindValue(":catalog_id", cat_id);
+	if (!query.exec() || !query.next()) {
+		qDebug() << "Unable to read catalog statistics" << query.lastError();
+		return stats;
+	}
+	stats.files = query.value(0).toLongLong();
+	stats.directories = query.value(1).toLongLong();
+	stats.total_size = query.value(2).toLongLong();
+	stats.deleted = query.value(3).toLongLong();
+	stats.thumbnails_ready = query.value(4).toLongLong();
+	stats.thumbnails_pending = query.value(5).toLongLong();
+	stats.thumbnails_failed = query.value(6).toLongLong();
+	return stats;
+}
+
+/**
+ * @brief Subtrees an interrupted scan of the catalog already finished.
+ */
+QSet<QString> DBManager::fetchCheckpoints(int catalog_id) {
+	QSet<QString> paths;
+	QSqlQuery query(m_db);
+	query.setForwardOnly(true);
+	query.prepare("SELECT path FROM scan_checkpoint WHERE catalog_id = (:catalog_id)");
+	query.bindValue(":catalog_id", catalog_id);
+	if (!query.exec()) {
+		qDebug() << "Unable to read scan checkpoints" << query.lastError();
+		return paths;
+	}
+	while (query.next()) {
+		paths.insert(query.value(0).toString());
+	}
+	return paths;
+}
+
+/**
+ * @brief Catalogs whose last scan was interrupted.
+ */
+QVector<int> DBManager::checkpointedCatalogs() {
+	QVector<int> ids;
+	QSqlQuery query(m_db);
+	if (!query.exec("SELECT DISTINCT catalog_id FROM scan_checkpoint ORDER BY catalog_id")) {
+		qDebug() << "Unable to read scan checkpoints" << query.lastError();
+		return ids;
+	}
+	while (query.next()) {
+		ids.append(query.value(0).toInt());
+	}
+	return ids;
+}
+
+/**
+ * @brief Forget the checkpoints of a catalog once its scan completed.
+ */
+bool DBManager::clearCheckpoints(int catalog_id) {
+	QSqlQuery query(m_db);
+	query.prepare("DELETE FROM scan_checkpoint WHERE catalog_id = (:catalog_id)");
+	query.bindValue(":catalog_id", catalog_id);
+	if (!query.exec()) {
+		qDebug() << "Unable to clear scan checkpoints" << query.lastError();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Remove tombstoned rows of a catalog.
+ * @param cat_id
+ * @return number of removed rows, -1 on failure
+ */
+int DBManager::purgeTombstones(int cat_id) {
+	QSqlQuery query(m_db);
+	query.prepare("DELETE FROM direntry WHERE catalog_id = (:catalog_id) AND is_deleted = 1");
+	query.bindValue(":catalog_id", cat_id);
+	if (!query.exec()) {
+		qDebug() << "Unable to purge deleted entries" << query.lastError();
+		return -1;
+	}
+	return query.numRowsAffected();
+}
+
+/**
+ * @brief Raw sqlite3 handle of this connection for interrupt(), or nullptr.
+ *
+ * Only handed out when the SQLite linked into the application is the same
+ * version the Qt driver runs on, otherwise interrupting would write into a
+ * foreign struct. Call from the connection's own thread.
+ */
+void *DBManager::interruptHandle() {
+#ifdef POORMAN_SQLITE_INTERRUPT
+	QVariant handle = m_db.driver()->handle();
+	if (!handle.isValid() || qstrcmp(handle.typeName(), "sqlite3*") != 0) {
+		return nullptr;
+	}
+	QSqlQuery query(m_db);
+	if (!query.exec("SELECT sqlite_version()") || !query.next() ||
+	    query.value(0).toString() != QString::fromLatin1(sqlite3_libversion())) {
+		qDebug() << "Qt and the application use different SQLite builds, searches cannot be interrupted";
+		return nullptr;
+	}
+	return *static_cast<sqlite3 **>(handle.data());
+#else
+	return nullptr;
+#endif
+}
+
+/**
+ * @brief Abort whatever statement is running on a connection. Thread safe.
+ * @param handle from interruptHandle(), may be nullptr
+ */
+void DBManager::interrupt(void *handle) {
+#ifdef POORMAN_SQLITE_INTERRUPT
+	if (handle != nullptr) {
+		sqlite3_interrupt(static_cast<sqlite3 *>(handle));
+	}
+#else
+	Q_UNUSED(handle);
+#endif
+}
+
+/**
+ * @brief Store the thumbnail of an entry and flag the entry.
+ *
+ * Entries removed in the meantime are skipped, so no orphaned blobs are
+ * left behind.
+ */
 bool DBManager::updateThumbnail(int entry_id, QByteArray thumbnail) {
+	QSqlQuery flag(m_db);
+	flag.prepare("UPDATE direntry SET has_thumbnail = 1 WHERE ids = :id");
+	QSqlQuery store(m_db);
+	store.prepare("INSERT OR REPLACE INTO thumbnail (entry_id, data) VALUES (:id, :data)");
+	return storeThumbnail(flag, store, entry_id, thumbnail);
+}
+
+bool DBManager::storeThumbnail(QSqlQuery &flag, QSqlQuery &store, int entry_id, const QByteArray &thumbnail) {
+	flag.bindValue(":id", entry_id);
+	if (!flag.exec()) {
+		qDebug() << "Failed to update thumbnail for id" << entry_id << flag.lastError();
+		return false;
+	}
+	if (flag.numRowsAffected() == 0) {
+		return true;
+	}
+	store.bindValue(":id", entry_id);
+	store.bindValue(":data", thumbnail);
+	if (!store.exec()) {
+		qDebug() << "Failed to store thumbnail for id" << entry_id << store.lastError();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Store many thumbnails in a single transaction.
+ * @param thumbnails entry id and encoded image pairs; an empty image marks
+ * a pending entry as failed so it is not retried
+ * @return false if the transaction could not be committed
+ */
+bool DBManager::updateThumbnails(const QVector<QPair<int, QByteArray>> &thumbnails) {
+	if (thumbnails.isEmpty()) {
+		return true;
+	}
+	if (!m_db.transaction()) {
+		qDebug() << "Failed to start thumbnail transaction" << m_db.lastError();
+		return false;
+	}
+	QSqlQuery flag(m_db);
+	flag.prepare("UPDATE direntry SET has_thumbnail = 1 WHERE ids = :id");
+	QSqlQuery store(m_db);
+	store.prepare("INSERT OR REPLACE INTO thumbnail (entry_id, data) VALUES (:id, :data)");
+	QSqlQuery failed(m_db);
+	failed.prepare("UPDATE direntry SET has_thumbnail = 3 WHERE ids = :id AND has_thumbnail = 2");
+	for (const QPair<int, QByteArray> &thumbnail : thumbnails) {
+		if (!thumbnail.second.isEmpty()) {
+			storeThumbnail(flag, store, thumbnail.first, thumbnail.second);
+			continue;
+		}
+		failed.bindValue(":id", thumbnail.first);
+		if (!failed.exec()) {
+			qDebug() << "Failed to mark thumbnail of" << thumbnail.first << "as failed" << failed.lastError();
+		}
+	}
+	if (!m_db.commit()) {
+		qDebug() << "Failed to commit thumbnails" << m_db.lastError();
+		m_db.rollback();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Entries still waiting for a thumbnail, in id order.
+ * @param catalog_ids only entries of these catalogs, see reachableCatalogs()
+ * @return entry id and full path pairs
+ *
+ * The scanner marks entries as pending before they are queued, so this is
+ * how work left over from an earlier session is picked up again.
+ */
+QVector<QPair<int, QString>> DBManager::pendingThumbnails(int after_id, int limit, const QVector<int> &catalog_ids) {
+	QVector<QPair<int, QString>> pending;
+	if (catalog_ids.isEmpty()) {
+		return pending;
+	}
+	QStringList catalogs;
+	for (int id : catalog_ids) {
+		catalogs << QString::number(id);
+	}
+	QSqlQuery query(m_db);
+	query.setForwardOnly(true);
+	query.prepare(QString("SELECT ids, full_path FROM direntry WHERE has_thumbnail = 2 AND ids > (:after_id) AND is_deleted = 0 "
+			      "AND catalog_id IN (%1) ORDER BY ids LIMIT (:limit)")
+			  .arg(catalogs.join(',')));
+	query.bindValue(":after_id", after_id);
+	query.bindValue(":limit", limit);
+	if (!query.exec()) {
+		qDebug() << "Unable to read pending thumbnails" << query.lastError();
+		return pending;
+	}
+	while (query.next()) {
+		pending.append(qMakePair(query.value(0).toInt(), query.value(1).toString()));
+	}
+	return pending;
+}
+
+/**
+ * @brief Next chunk of files whose hash could reveal a duplicate, in id order.
+ * @param content false for files without a partial hash that share their
+ * size with another file, true for files without a content hash that share
+ * size and partial hash with another one
+ *
+ * Files of every catalog qualify, duplicates are found across catalogs.
+ */
+QVector<HashCandidate> DBManager::hashCandidates(bool content, int after_id, int limit) {
+	QVector<HashCandidate> candidates;
 	QSqlQuery query(m_db);
-	query.prepare("UPDATE direntry SET thumbnail64 = :thumbnail WHERE ids = :id");
-	query.bindValue(":thumbnail", thumbnail);
-	query.bindValue(":id", entry_id);
+	query.setForwardOnly(true);
+	if (content) {
+		query.prepare("SELECT ids, full_path, filesize, mtime, inode FROM direntry AS d "
+			      "WHERE d.ids > (:after_id) AND d.is_deleted = 0 AND d.is_directory = 0 AND d.content_hash IS NULL "
+			      "AND d.partial_hash IS NOT NULL AND EXISTS (SELECT 1 FROM direntry AS o WHERE o.filesize = d.filesize "
+			      "AND o.partial_hash = d.partial_hash AND o.is_deleted = 0 AND o.is_directory = 0 AND o.ids <> d.ids) "
+			      "ORDER BY d.ids LIMIT (:limit)");
+	} else {
+		query.prepare("SELECT ids, full_path, filesize, mtime, inode FROM direntry AS d "
+			      "WHERE d.ids > (:after_id) AND d.is_deleted = 0 AND d.is_directory = 0 AND d.partial_hash IS NULL "
+			      "AND d.filesize > 0 AND EXISTS (SELECT 1 FROM direntry AS o WHERE o.filesize = d.filesize "
+			      "AND o.is_deleted = 0 AND o.is_directory = 0 AND o.ids <> d.ids) "
+			      "ORDER BY d.ids LIMIT (:limit)");
+	}
+	query.bindValue(":after_id", after_id);
+	query.bindValue(":limit", limit);
 	if (!query.exec()) {
-		qDebug() << "Failed to update thumbnail for id" << entry_id << query.lastError();
+		qDebug() << "Unable to read hash candidates" << query.lastError();
+		return candidates;
+	}
+	while (query.next()) {
+		candidates.append(HashCandidate{query.value(0).toInt(), query.value(1).toString(), query.value(2).toLongLong(),
+						query.value(3).toLongLong(), query.value(4).toLongLong()});
+	}
+	return candidates;
+}
+
+/**
+ * @brief Store partial or content hashes in one transaction.
+ */
+bool DBManager::storeHashes(const QVector<QPair<int, qint64>> &hashes, bool content) {
+	if (hashes.isEmpty()) {
+		return true;
+	}
+	if (!m_db.transaction()) {
+		qDebug() << "Failed to start hash transaction" << m_db.lastError();
+		return false;
+	}
+	QSqlQuery query(m_db);
+	query.prepare(content ? "UPDATE direntry SET content_hash = :hash WHERE ids = :id"
+			      : "UPDATE direntry SET partial_hash = :hash WHERE ids = :id");
+	for (const QPair<int, qint64> &hash : hashes) {
+		query.bindValue(":hash", QVariant((long long)hash.second));
+		query.bindValue(":id", hash.first);
+		if (!query.exec()) {
+			qDebug() << "Failed to store hash for id" << hash.first << query.lastError();
+		}
+	}
+	if (!m_db.commit()) {
+		qDebug() << "Failed to commit hashes" << m_db.lastError();
+		m_db.rollback();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Live files with the same size and content hash as another file,
+ * grouped by hash and largest first.
+ * @param cat_id only groups with a copy in this catalog, -1 for all
+ */
+QSqlQuery DBManager::findDuplicates(int cat_id) {
+	QSqlQuery query(m_db);
+	query.setForwardOnly(true);
+	query.prepare("SELECT d.ids, d.catalog_id, d.full_path, d.filesize, d.content_hash FROM direntry AS d "
+		      "JOIN (SELECT filesize, content_hash FROM direntry "
+		      "WHERE is_deleted = 0 AND is_directory = 0 AND content_hash IS NOT NULL "
+		      "GROUP BY filesize, content_hash HAVING COUNT(*) > 1 AND ((:catalog_id) = -1 OR SUM(catalog_id = (:catalog_id2)) > 0)) "
+		      "AS g ON d.filesize = g.filesize AND d.content_hash = g.content_hash "
+		      "WHERE d.is_deleted = 0 AND d.is_directory = 0 "
+		      "ORDER BY d.filesize DESC, d.content_hash, d.catalog_id, d.full_path");
+	query.bindValue(":catalog_id", cat_id);
+	query.bindValue(":catalog_id2", cat_id);
+	if (!query.exec()) {
+		qDebug() << "Unable to find duplicates" << query.lastError();
+	}
+	return query;
+}
+
+/**
+ * @brief Recompute the totals of every directory in a catalog from scratch.
+ * @param cat_id catalog, -1 for all of them
+ */
+bool DBManager::rollUpDirectoryTotals(int cat_id) {
+	if (!m_db.transaction()) {
+		qDebug() << "Unable to start directory totals transaction" << m_db.lastError();
+		return false;
+	}
+	if (!computeDirectoryTotals(cat_id)) {
+		m_db.rollback();
+		return false;
+	}
+	if (!m_db.commit()) {
+		qDebug() << "Unable to commit directory totals" << m_db.lastError();
+		m_db.rollback();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Add what a rescan changed to the totals of the given directories.
+ * @param deltas change per directory id, already summed up along the tree
+ */
+bool DBManager::addDirectoryTotals(const QHash<int, DirTotals> &deltas) {
+	if (deltas.isEmpty()) {
+		return true;
+	}
+	if (!m_db.transaction()) {
+		qDebug() << "Unable to start directory totals transaction" << m_db.lastError();
+		return false;
+	}
+	QSqlQuery query(m_db);
+	query.prepare("UPDATE direntry SET total_size = total_size + :size, file_count = file_count + :files, "
+		      "dir_count = dir_count + :dirs WHERE ids = :id AND is_directory = 1");
+	for (auto it = deltas.constBegin(); it != deltas.constEnd(); ++it) {
+		query.bindValue(":size", it.value().size);
+		query.bindValue(":files", it.value().files);
+		query.bindValue(":dirs", it.value().dirs);
+		query.bindValue(":id", it.key());
+		if (!query.exec()) {
+			qDebug() << "Unable to update directory totals" << it.key() << query.lastError();
+			m_db.rollback();
+			return false;
+		}
+	}
+	if (!m_db.commit()) {
+		qDebug() << "Unable to commit directory totals" << m_db.lastError();
+		m_db.rollback();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Sum up the live rows below every directory in one bottom-up pass.
+ *
+ * Each row is read once and counted in its parent; directories then hand
+ * their totals to their own parent, deepest first. Only directories whose
+ * totals changed are written. Runs inside the caller's transaction.
+ */
+bool DBManager::computeDirectoryTotals(int cat_id) {
+	QSqlQuery query(m_db);
+	query.setForwardOnly(true);
+	query.prepare("SELECT ids, parent_id, is_directory, filesize, total_size, file_count, dir_count FROM direntry "
+		      "WHERE is_deleted = 0 AND ((:catalog_id) = -1 OR catalog_id = (:catalog_id2))");
+	query.bindValue(":catalog_id", cat_id);
+	query.bindValue(":catalog_id2", cat_id);
+	if (!query.exec()) {
+		qDebug() << "Unable to read directory tree" << query.lastError();
+		return false;
+	}
+	QHash<int, int> parents;
+	QHash<int, DirTotals> stored;
+	QHash<int, DirTotals> totals;
+	while (query.next()) {
+		int id = query.value(0).toInt();
+		int parent = query.value(1).toInt();
+		if (query.value(2).toInt() == 1) {
+			parents.insert(id, parent);
+			stored.insert(id, DirTotals{query.value(4).toLongLong(), query.value(5).toLongLong(), query.value(6).toLongLong()});
+			totals[parent].dirs++;
+		} else {
+			DirTotals &parent_totals = totals[parent];
+			parent_totals.size += query.value(3).toLongLong();
+			parent_totals.files++;
+		}
+	}
+	query.finish();
+
+	// Depth below the nearest ancestor that is not a live directory. The
+	// chain length is bounded in case parent ids ever form a cycle.
+	QHash<int, int> depths;
+	for (auto it = parents.constBegin(); it != parents.constEnd(); ++it) {
+		QVector<int> chain;
+		int node = it.key();
+		while (parents.contains(node) && !depths.contains(node) && chain.size() <= parents.size()) {
+			chain.append(node);
+			node = parents.value(node);
+		}
+		int depth = depths.value(node, -1);
+		for (int i = chain.size() - 1; i >= 0; i--) {
+			depths.insert(chain[i], ++depth);
+		}
+	}
+	QVector<QPair<int, int>> order;
+	order.reserve(depths.size());
+	for (auto it = depths.constBegin(); it != depths.constEnd(); ++it) {
+		order.append(qMakePair(it.value(), it.key()));
+	}
+	std::sort(order.begin(), order.end(), [](const QPair<int, int> &a, const QPair<int, int> &b) { return a.first > b.first; });
+	for (const QPair<int, int> &dir : order) {
+		int parent = parents.value(dir.second);
+		if (parents.contains(parent) && parent != dir.second) {
+			totals[parent] += totals.value(dir.second);
+		}
+	}
+
+	QSqlQuery update(m_db);
+	update.prepare("UPDATE direntry SET total_size = :size, file_count = :files, dir_count = :dirs WHERE ids = :id");
+	for (auto it = stored.constBegin(); it != stored.constEnd(); ++it) {
+		DirTotals dir_totals = totals.value(it.key());
+		if (dir_totals.size == it.value().size && dir_totals.files == it.value().files && dir_totals.dirs == it.value().dirs) {
+			continue;
+		}
+		update.bindValue(":size", dir_totals.size);
+		update.bindValue(":files", dir_totals.files);
+		update.bindValue(":dirs", dir_totals.dirs);
+		update.bindValue(":id", it.key());
+		if (!update.exec()) {
+			qDebug() << "Unable to store directory totals" << it.key() << update.lastError();
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Next chunk of stored thumbnails, in entry id order.
+ */
+QVector<QPair<int, QByteArray>> DBManager::fetchThumbnails(int after_id, int limit) {
+	QVector<QPair<int, QByteArray>> thumbnails;
+	QSqlQuery query(m_db);
+	query.setForwardOnly(true);
+	query.prepare("SELECT entry_id, data FROM thumbnail WHERE entry_id > (:after_id) ORDER BY entry_id LIMIT (:limit)");
+	query.bindValue(":after_id", after_id);
+	query.bindValue(":limit", limit);
+	if (!query.exec()) {
+		qDebug() << "Unable to read thumbnails" << query.lastError();
+		return thumbnails;
+	}
+	while (query.next()) {
+		thumbnails.append(qMakePair(query.value(0).toInt(), query.value(1).toByteArray()));
+	}
+	return thumbnails;
+}
+
+/**
+ * @brief Overwrite stored thumbnails in one transaction.
+ */
+bool DBManager::replaceThumbnails(const QVector<QPair<int, QByteArray>> &thumbnails) {
+	if (thumbnails.isEmpty()) {
+		return true;
+	}
+	if (!m_db.transaction()) {
+		qDebug() << "Failed to start thumbnail transaction" << m_db.lastError();
+		return false;
+	}
+	QSqlQuery query(m_db);
+	query.prepare("UPDATE thumbnail SET data = :data WHERE entry_id = :id");
+	for (const QPair<int, QByteArray> &thumbnail : thumbnails) {
+		query.bindValue(":data", thumbnail.second);
+		query.bindValue(":id", thumbnail.first);
+		if (!query.exec()) {
+			qDebug() << "Failed to replace thumbnail for id" << thumbnail.first << query.lastError();
+		}
+	}
+	if (!m_db.commit()) {
+		qDebug() << "Failed to commit thumbnails" << m_db.lastError();
+		m_db.rollback();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Give free pages back to the file system.
+ */
+bool DBManager::vacuum() {
+	QSqlQuery query(m_db);
+	if (!query.exec("VACUUM")) {
+		qDebug() << "Unable to vacuum database" << query.lastError();
+		return false;
+	}
+	query.exec("PRAGMA wal_checkpoint(TRUNCATE)");
+	return true;
+}
+
+void DBManager::initBatchState() {
+	batch_insert = nullptr;
+	batch_update = nullptr;
+	batch_mtime = nullptr;
+	batch_checkpoint = nullptr;
+	batch_checkpoint_prune = nullptr;
+	batch_size = 1;
+	batch_interval = 0;
+	batch_rows = 0;
+	in_batch = false;
+	fts_enabled = false;
+}
+
+/**
+ * @brief Start a batched write session.
+ * @param batch_size rows per transaction
+ * @param flush_interval_ms maximum age of an open transaction, 0 to disable
+ *
+ * Rows added with batchDirEntry() share one transaction and one prepared
+ * statement. The caller checks batchDue() and calls commitBatch() once the
+ * chunk is full or old enough; ids returned before that commit are only
+ * durable after it.
+ */
+void DBManager::beginBatch(int batch_size, int flush_interval_ms) {
+	endBatch();
+	this->batch_size = batch_size > 0 ? batch_size : 1;
+	this->batch_interval = flush_interval_ms;
+	batch_insert = new QSqlQuery(m_db);
+	batch_insert->prepare("INSERT INTO direntry ("
+			      "directory, full_path, name, "
+			      "filesize, is_directory, catalog_id, parent_id, "
+			      "mtime, inode, device, has_thumbnail, mime_type, extension, ctime"
+			      ") VALUES ("
+			      ":directory, :full_path, :name, :filesize, "
+			      ":is_directory, :catalog_id, :parent_id, "
+			      ":mtime, :inode, :device, :has_thumbnail, :mime_type, :extension, :ctime)");
+	batch_update = new QSqlQuery(m_db);
+	batch_update->prepare("UPDATE direntry SET filesize = :filesize, is_directory = :is_directory, "
+			      "mtime = :mtime, inode = :inode, device = :device, mime_type = :mime_type, extension = :extension, "
+			      "ctime = :ctime, is_deleted = 0, "
+			      "has_thumbnail = CASE WHEN :clear_thumbnail = 1 THEN :thumbnail_state ELSE has_thumbnail END "
+			      "WHERE ids = :id");
+	batch_mtime = new QSqlQuery(m_db);
+	batch_mtime->prepare("UPDATE direntry SET mtime = :mtime WHERE ids = :id");
+	batch_checkpoint = new QSqlQuery(m_db);
+	batch_checkpoint->prepare("INSERT OR REPLACE INTO scan_checkpoint (catalog_id, path, parent) "
+				  "VALUES (:catalog_id, :path, :parent)");
+	batch_checkpoint_prune = new QSqlQuery(m_db);
+	batch_checkpoint_prune->prepare("DELETE FROM scan_checkpoint WHERE catalog_id = :catalog_id AND parent = :path");
+	in_batch = m_db.transaction();
+	if (!in_batch) {
+		qDebug() << "Unable to start batch transaction" << m_db.lastError();
+	}
+	batch_rows = 0;
+	batch_timer.start();
+}
+
+int DBManager::batchDirEntry(DirEntry &dir_entry) {
+	if (batch_insert == nullptr) {
+		return createDirEntry(dir_entry);
+	}
+	batch_insert->bindValue(":directory", dir_entry.directory);
+	batch_insert->bindValue(":full_path", dir_entry.full_path);
+	batch_insert->bindValue(":name", dir_entry.name);
+	batch_insert->bindValue(":filesize", QVariant((long long)dir_entry.filesize));
+	batch_insert->bindValue(":is_directory", (dir_entry.is_directory ? 1 : 0));
+	batch_insert->bindValue(":catalog_id", dir_entry.catalog_id);
+	batch_insert->bindValue(":parent_id", dir_entry.parent_id);
+	batch_insert->bindValue(":mtime", QVariant((long long)dir_entry.mtime));
+	batch_insert->bindValue(":inode", QVariant((long long)dir_entry.inode));
+	batch_insert->bindValue(":device", QVariant((long long)dir_entry.device));
+	batch_insert->bindValue(":has_thumbnail", dir_entry.thumbnail.isEmpty() ? dir_entry.thumbnail_state : 0);
+	batch_insert->bindValue(":mime_type", dir_entry.mime_type);
+	batch_insert->bindValue(":extension", dir_entry.extension);
+	batch_insert->bindValue(":ctime", QVariant((long long)dir_entry.ctime));
+	if (!batch_insert->exec()) {
+		qDebug() << "Unable to create direntry " << batch_insert->lastError();
+		return -1;
+	}
+	batch_rows++;
+	int id = batch_insert->lastInsertId().toInt();
+	if (!dir_entry.thumbnail.isEmpty()) {
+		updateThumbnail(id, dir_entry.thumbnail);
+	}
+	return id;
+}
+
+/**
+ * @brief Refresh an existing row from a rescan and clear its tombstone.
+ * @param dir_entry row state as found on disk, id must be set
+ * @param content_changed drop the stored thumbnail and set the thumbnail
+ * state from dir_entry
+ */
+bool DBManager::batchUpdateDirEntry(DirEntry &dir_entry, bool content_changed) {
+	if (batch_update == nullptr) {
+		return false;
+	}
+	batch_update->bindValue(":filesize", QVariant((long long)dir_entry.filesize));
+	batch_update->bindValue(":is_directory", (dir_entry.is_directory ? 1 : 0));
+	batch_update->bindValue(":mtime", QVariant((long long)dir_entry.mtime));
+	batch_update->bindValue(":inode", QVariant((long long)dir_entry.inode));
+	batch_update->bindValue(":device", QVariant((long long)dir_entry.device));
+	batch_update->bindValue(":mime_type", dir_entry.mime_type);
+	batch_update->bindValue(":extension", dir_entry.extension);
+	batch_update->bindValue(":ctime", QVariant((long long)dir_entry.ctime));
+	batch_update->bindValue(":clear_thumbnail", content_changed ? 1 : 0);
+	batch_update->bindValue(":thumbnail_state", content_changed ? dir_entry.thumbnail_state : 0);
+	batch_update->bindValue(":id", dir_entry.id);
+	if (!batch_update->exec()) {
+		qDebug() << "Unable to update direntry" << dir_entry.id << batch_update->lastError();
+		return false;
+	}
+	batch_rows++;
+	return true;
+}
+
+/**
+ * @brief Record the mtime of a directory once its listing has been written.
+ *
+ * Incremental rescans trust this value to skip the directory, so it must
+ * never be stored before the children it vouches for.
+ */
+bool DBManager::batchDirectoryMtime(int entry_id, qint64 mtime) {
+	if (batch_mtime == nullptr) {
+		return false;
+	}
+	batch_mtime->bindValue(":mtime", QVariant((long long)mtime));
+	batch_mtime->bindValue(":id", entry_id);
+	if (!batch_mtime->exec()) {
+		qDebug() << "Unable to update directory mtime" << entry_id << batch_mtime->lastError();
 		return false;
 	}
+	batch_rows++;
 	return true;
 }
 
+/**
+ * @brief Record that a directory and everything below it has been written.
+ *
+ * Goes into the running batch, so the checkpoint commits together with the
+ * rows it covers. Checkpoints of the subdirectories are dropped: only the
+ * outermost finished subtrees are kept.
+ */
+bool DBManager::batchCheckpoint(int catalog_id, const QString &path, const QString &parent) {
+	if (batch_checkpoint == nullptr) {
+		return false;
+	}
+	batch_checkpoint_prune->bindValue(":catalog_id", catalog_id);
+	batch_checkpoint_prune->bindValue(":path", path);
+	if (!batch_checkpoint_prune->exec()) {
+		qDebug() << "Unable to prune scan checkpoints below" << path << batch_checkpoint_prune->lastError();
+		return false;
+	}
+	batch_checkpoint->bindValue(":catalog_id", catalog_id);
+	batch_checkpoint->bindValue(":path", path);
+	batch_checkpoint->bindValue(":parent", parent);
+	if (!batch_checkpoint->exec()) {
+		qDebug() << "Unable to store scan checkpoint" << path << batch_checkpoint->lastError();
+		return false;
+	}
+	batch_rows++;
+	return true;
+}
+
+bool DBManager::batchDue() {
+	if (batch_rows == 0) {
+		return false;
+	}
+	return batch_rows >= batch_size || (batch_interval > 0 && batch_timer.elapsed() >= batch_interval);
+}
+
+/**
+ * @brief Commit the rows collected so far and open the next chunk.
+ * @return false if the commit failed
+ */
+bool DBManager::commitBatch() {
+	bool ok = true;
+	finishBatchQueries();
+	if (in_batch) {
+		ok = commitChunk();
+	}
+	batch_rows = 0;
+	batch_timer.restart();
+	in_batch = batch_insert != nullptr && m_db.transaction();
+	return ok;
+}
+
+/**
+ * @brief Commit the last chunk and release the prepared statement.
+ */
+bool DBManager::endBatch() {
+	bool ok = true;
+	finishBatchQueries();
+	if (in_batch) {
+		ok = commitChunk();
+		in_batch = false;
+	}
+	delete batch_insert;
+	delete batch_update;
+	delete batch_mtime;
+	delete batch_checkpoint;
+	delete batch_checkpoint_prune;
+	batch_insert = nullptr;
+	batch_update = nullptr;
+	batch_mtime = nullptr;
+	batch_checkpoint = nullptr;
+	batch_checkpoint_prune = nullptr;
+	batch_rows = 0;
+	return ok;
+}
+
+/**
+ * @brief Commit the open batch transaction and record how long it took.
+ */
+bool DBManager::commitChunk() {
+	QElapsedTimer timer;
+	timer.start();
+	bool ok = m_db.commit();
+	ScanMetrics::instance()->recordCommit(timer.nsecsElapsed());
+	if (!ok) {
+		qDebug() << "Unable to commit batch" << m_db.lastError();
+		m_db.rollback();
+	}
+	return ok;
+}
+
+void DBManager::finishBatchQueries() {
+	if (batch_insert != nullptr)
+		batch_insert->finish();
+	if (batch_update != nullptr)
+		batch_update->finish();
+	if (batch_mtime != nullptr)
+		batch_mtime->finish();
+	if (batch_checkpoint != nullptr)
+		batch_checkpoint->finish();
+	if (batch_checkpoint_prune != nullptr)
+		batch_checkpoint_prune->finish();
+}
+
 void DBManager::createTables() {
 	QSqlQuery query(m_db);
 	query.prepare("CREATE TABLE IF NOT EXISTS direntry ("
 		      "ids integer primary key, directory "
 		      "text, full_path text, name text, filesize integer, "
-		      "thumbnail64 blob, is_directory integer, catalog_id integer, "
+		      "is_directory integer, catalog_id integer, "
 		      "parent_id integer);");
 	if (query.exec()) {
 		qDebug() << "Created direntry table";
@@ -316,7 +1446,218 @@ void DBManager::createTables() {
 	} else {
 		qDebug() << "Failed to create the catalog table";
 	}
+	query.prepare("CREATE TABLE IF NOT EXISTS thumbnail(entry_id integer primary key, data blob);");
+	if (!query.exec()) {
+		qDebug() << "Failed to create the thumbnail table" << query.lastError();
+	}
+	// Finished subtrees of a scan that has not completed yet, see
+	// batchCheckpoint().
+	query.prepare("CREATE TABLE IF NOT EXISTS scan_checkpoint(catalog_id integer, path text, parent text, "
+		      "PRIMARY KEY (catalog_id, path));");
+	if (!query.exec()) {
+		qDebug() << "Failed to create the scan checkpoint table" << query.lastError();
+	}
+	upgradeSchema();
 	createIndexes();
+	createSearchIndex();
+}
+
+bool DBManager::hasColumn(const QString &table, const QString &column) {
+	QSqlQuery query(m_db);
+	query.exec("PRAGMA table_info(" + table + ")");
+	while (query.next()) {
+		if (query.value("name").toString() == column) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void DBManager::addColumn(const QString &table, const QString &column, const QString &definition) {
+	if (hasColumn(table, column)) {
+		return;
+	}
+	QSqlQuery query(m_db);
+	if (!query.exec("ALTER TABLE " + table + " ADD COLUMN " + column + " " + definition)) {
+		qDebug() << "Failed to add column" << table << column << query.lastError();
+	}
+}
+
+/**
+ * @brief Bring databases created by older versions up to date.
+ *
+ * Columns are only ever added, so this is safe to run on every connect.
+ */
+void DBManager::upgradeSchema() {
+	// Change detection for rescans. Directory mtimes stay 0 until the
+	// directory has been listed once, see batchDirectoryMtime().
+	addColumn("direntry", "mtime", "integer NOT NULL DEFAULT 0");
+	addColumn("direntry", "inode", "integer NOT NULL DEFAULT 0");
+	addColumn("direntry", "device", "integer NOT NULL DEFAULT 0");
+	addColumn("direntry", "is_deleted", "integer NOT NULL DEFAULT 0");
+	// Facets for FileFilter. The type is detected once by the scanner,
+	// see MimeClassifier.
+	addColumn("direntry", "mime_type", "text NOT NULL DEFAULT ''");
+	addColumn("direntry", "extension", "text NOT NULL DEFAULT ''");
+	addColumn("direntry", "ctime", "integer NOT NULL DEFAULT 0");
+	// Duplicate detection, NULL until hashed; see ContentHasher.
+	addColumn("direntry", "partial_hash", "integer");
+	addColumn("direntry", "content_hash", "integer");
+	if (!hasColumn("direntry", "has_thumbnail")) {
+		moveThumbnails();
+	}
+	if (!hasColumn("direntry", "total_size")) {
+		createDirectoryTotals();
+	}
+
+	// Blobs follow their entry: removed with it, and dropped whenever the
+	// state leaves "ready", e.g. when a rescan finds the file changed.
+	QSqlQuery query(m_db);
+	query.exec("CREATE TRIGGER IF NOT EXISTS thumbnail_delete AFTER DELETE ON direntry BEGIN "
+		   "DELETE FROM thumbnail WHERE entry_id = old.ids; END");
+	query.exec("DROP TRIGGER IF EXISTS thumbnail_clear");
+	query.exec("CREATE TRIGGER IF NOT EXISTS thumbnail_reset AFTER UPDATE OF has_thumbnail ON direntry "
+		   "WHEN new.has_thumbnail <> 1 BEGIN DELETE FROM thumbnail WHERE entry_id = new.ids; END");
+	// Hashes are only valid for the content they were computed from.
+	query.exec("CREATE TRIGGER IF NOT EXISTS hash_reset AFTER UPDATE OF filesize, mtime, inode, device ON direntry "
+		   "WHEN new.filesize <> old.filesize OR new.mtime <> old.mtime OR new.inode <> old.inode OR new.device <> old.device "
+		   "BEGIN UPDATE direntry SET partial_hash = NULL, content_hash = NULL WHERE ids = new.ids; END");
+	// A path that turns from a file into a directory starts out empty.
+	query.exec("CREATE TRIGGER IF NOT EXISTS directory_totals_reset AFTER UPDATE OF is_directory ON direntry "
+		   "WHEN new.is_directory <> old.is_directory "
+		   "BEGIN UPDATE direntry SET total_size = 0, file_count = 0, dir_count = 0 WHERE ids = new.ids; END");
+}
+
+/**
+ * @brief Move inline thumbnail64 blobs into the thumbnail table.
+ *
+ * Browse and search queries only read the has_thumbnail flag, so they no
+ * longer page through image data. The flag column is added in the same
+ * transaction as the move, which makes its presence mean "migrated".
+ * The emptied thumbnail64 column is left in place for older SQLite
+ * versions that cannot drop columns.
+ */
+void DBManager::moveThumbnails() {
+	if (!m_db.transaction()) {
+		qDebug() << "Unable to start thumbnail migration" << m_db.lastError();
+		return;
+	}
+	QSqlQuery query(m_db);
+	bool ok = query.exec("ALTER TABLE direntry ADD COLUMN has_thumbnail integer NOT NULL DEFAULT 0");
+	if (ok && hasColumn("direntry", "thumbnail64")) {
+		qDebug() << "Moving thumbnails out of direntry";
+		ok = query.exec("INSERT OR REPLACE INTO thumbnail (entry_id, data) "
+				"SELECT ids, thumbnail64 FROM direntry WHERE thumbnail64 IS NOT NULL") &&
+		     query.exec("UPDATE direntry SET has_thumbnail = 1, thumbnail64 = NULL WHERE thumbnail64 IS NOT NULL");
+	}
+	if (!ok) {
+		qDebug() << "Thumbnail migration failed" << query.lastError();
+		m_db.rollback();
+		return;
+	}
+	if (!m_db.commit()) {
+		qDebug() << "Unable to commit thumbnail migration" << m_db.lastError();
+		m_db.rollback();
+	}
+}
+
+/**
+ * @brief Add the directory total columns and fill them in.
+ *
+ * As with moveThumbnails(), the columns are added in the same transaction
+ * as their values, so their presence means every directory has totals.
+ * Scans keep them current from then on.
+ */
+void DBManager::createDirectoryTotals() {
+	if (!m_db.transaction()) {
+		qDebug() << "Unable to start directory totals migration" << m_db.lastError();
+		return;
+	}
+	qDebug() << "Computing directory totals";
+	QSqlQuery query(m_db);
+	bool ok = query.exec("ALTER TABLE direntry ADD COLUMN total_size integer NOT NULL DEFAULT 0") &&
+		  query.exec("ALTER TABLE direntry ADD COLUMN file_count integer NOT NULL DEFAULT 0") &&
+		  query.exec("ALTER TABLE direntry ADD COLUMN dir_count integer NOT NULL DEFAULT 0");
+	if (!ok) {
+		qDebug() << "Directory totals migration failed" << query.lastError();
+	}
+	if (!ok || !computeDirectoryTotals(-1)) {
+		m_db.rollback();
+		return;
+	}
+	if (!m_db.commit()) {
+		qDebug() << "Unable to commit directory totals migration" << m_db.lastError();
+		m_db.rollback();
+	}
+}
+
+int DBManager::countSchemaObjects(const QString &type, const QStringList &names) {
+	QStringList placeholders;
+	for (int i = 0; i < names.size(); i++) {
+		placeholders.append("?");
+	}
+	QSqlQuery query(m_db);
+	query.prepare(QString("SELECT COUNT(*) FROM sqlite_master WHERE type = ? AND name IN (%1)").arg(placeholders.join(", ")));
+	query.addBindValue(type);
+	for (const QString &name : names) {
+		query.addBindValue(name);
+	}
+	if (query.exec() && query.next()) {
+		return query.value(0).toInt();
+	}
+	return 0;
+}
+
+bool DBManager::hasSearchIndex() {
+	return countSchemaObjects("table", QStringList() << "direntry_fts") == 1 &&
+	       countSchemaObjects("trigger", fts_triggers) == fts_triggers.size();
+}
+
+/**
+ * @brief Trigram full text index over full_path, kept in sync by triggers.
+ *
+ * Needs an SQLite with FTS5 and the trigram tokenizer (3.34+). Without it
+ * searches keep using LIKE. The index is rebuilt from direntry whenever it
+ * or one of its triggers had to be created, which covers databases from
+ * older versions and files that were written by an SQLite without FTS5.
+ */
+void DBManager::createSearchIndex() {
+	fts_enabled = false;
+	bool rebuild = countSchemaObjects("trigger", fts_triggers) != fts_triggers.size();
+	QSqlQuery query(m_db);
+	if (countSchemaObjects("table", QStringList() << "direntry_fts") == 0) {
+		if (!query.exec("CREATE VIRTUAL TABLE direntry_fts USING fts5("
+				"full_path, content='direntry', content_rowid='ids', tokenize='trigram')")) {
+			qDebug() << "Full text search is not available, searching with LIKE" << query.lastError();
+			return;
+		}
+		rebuild = true;
+	} else if (!query.exec("SELECT rowid FROM direntry_fts LIMIT 0")) {
+		// Created elsewhere but unusable here: drop the triggers so writes
+		// keep working. They are recreated, and the index rebuilt, by the
+		// next SQLite that can use it.
+		qDebug() << "Full text index is not usable, searching with LIKE" << query.lastError();
+		for (const QString &trigger : fts_triggers) {
+			query.exec("DROP TRIGGER IF EXISTS " + trigger);
+		}
+		return;
+	}
+
+	query.exec("CREATE TRIGGER IF NOT EXISTS direntry_fts_insert AFTER INSERT ON direntry BEGIN "
+		   "INSERT INTO direntry_fts (rowid, full_path) VALUES (new.ids, new.full_path); END");
+	query.exec("CREATE TRIGGER IF NOT EXISTS direntry_fts_delete AFTER DELETE ON direntry BEGIN "
+		   "INSERT INTO direntry_fts (direntry_fts, rowid, full_path) VALUES ('delete', old.ids, old.full_path); END");
+	query.exec("CREATE TRIGGER IF NOT EXISTS direntry_fts_update AFTER UPDATE OF full_path ON direntry BEGIN "
+		   "INSERT INTO direntry_fts (direntry_fts, rowid, full_path) VALUES ('delete', old.ids, old.full_path); "
+		   "INSERT INTO direntry_fts (rowid, full_path) VALUES (new.ids, new.full_path); END");
+	if (rebuild) {
+		qDebug() << "Building full text index";
+		if (!query.exec("INSERT INTO direntry_fts (direntry_fts) VALUES ('rebuild')")) {
+			qDebug() << "Failed to build full text index" << query.lastError();
+			return;
+		}
+	}
+	fts_enabled = hasSearchIndex();
 }
 
 void DBManager::createIndexes() {
@@ -332,4 +1673,43 @@ void DBManager::createIndexes() {
 	if (!query.exec()) {
 		qDebug() << "Failed to create browse ids index" << query.lastError();
 	}
+
+	query.prepare("CREATE INDEX IF NOT EXISTS scan_checkpoint_parent ON scan_checkpoint (catalog_id, parent)");
+	if (!query.exec()) {
+		qDebug() << "Failed to create scan checkpoint index" << query.lastError();
+	}
+
+	// Facet indexes for FileFilter, limited to live files like its queries.
+	// Type and extension lead their composites so "videos over 1 GB" is a
+	// single range scan.
+	const char *const facet_indexes[][2] = {{"direntry_facet_type", "mime_type, filesize"},
+						{"direntry_facet_extension", "extension, filesize"},
+						{"direntry_facet_size", "filesize"},
+						{"direntry_facet_mtime", "mtime"},
+						{"direntry_facet_ctime", "ctime"}};
+	for (const auto &index : facet_indexes) {
+		query.prepare(QString("CREATE INDEX IF NOT EXISTS %1 ON direntry (%2) WHERE is_deleted = 0 AND is_directory = 0")
+				  .arg(index[0], index[1]));
+		if (!query.exec()) {
+			qDebug() << "Failed to create facet index" << index[0] << query.lastError();
+		}
+	}
+
+	// Size groups for hashCandidates() and findDuplicates().
+	query.prepare("CREATE INDEX IF NOT EXISTS direntry_partial_hash ON direntry (filesize, partial_hash) "
+		      "WHERE is_deleted = 0 AND is_directory = 0 AND partial_hash IS NOT NULL");
+	if (!query.exec()) {
+		qDebug() << "Failed to create partial hash index" << query.lastError();
+	}
+	query.prepare("CREATE INDEX IF NOT EXISTS direntry_content_hash ON direntry (filesize, content_hash) "
+		      "WHERE is_deleted = 0 AND is_directory = 0 AND content_hash IS NOT NULL");
+	if (!query.exec()) {
+		qDebug() << "Failed to create content hash index" << query.lastError();
+	}
+
+	// Only holds entries waiting for a thumbnail, see pendingThumbnails().
+	query.prepare("CREATE INDEX IF NOT EXISTS direntry_thumbnail_pending ON direntry (ids) WHERE has_thumbnail = 2");
+	if (!query.exec()) {
+		qDebug() << "Failed to create pending thumbnail index" << query.lastError();
+	}
 }
@@ -5,7 +5,16 @@
 #ifndef DBMANAGER_H
 #define DBMANAGER_H
 
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMetaType>
+#include <QPair>
+#include <QSet>
 #include <QSqlDatabase>
+#include <QStringList>
+#include <QVector>
+
+class QSqlQuery;
 
 struct Catalog {
     int id;
@@ -14,6 +23,9 @@ struct Catalog {
     QString tags;
 };
 
+// Values of direntry.has_thumbnail.
+enum ThumbnailState { ThumbnailNone = 0, ThumbnailReady = 1, ThumbnailPending = 2, ThumbnailFailed = 3 };
+
 struct DirEntry {
     int id;
     QString directory;
@@ -24,6 +36,111 @@ struct DirEntry {
     bool is_directory;
     int catalog_id;
     int parent_id;
+    qint64 mtime;
+    qint64 inode;
+    qint64 device;
+    int thumbnail_state;
+    // Empty for directories and rows written before types were stored.
+    QString mime_type;
+    // Lowercase suffix without the dot.
+    QString extension;
+    qint64 ctime;
+};
+
+// One row of a file listing, as handed from the search worker to the view.
+struct FileRow {
+	int id;
+	int catalog_id;
+	QString full_path;
+	qint64 filesize;
+	int thumbnail_state;
+};
+
+// One directory of the folder tree with its stored totals.
+struct DirectoryRow {
+	int id;
+	int parent_id;
+	QString name;
+	qint64 total_size;
+	qint64 file_count;
+	qint64 dir_count;
+};
+
+// What the scanner needs to know about an existing row to detect changes.
+struct IndexedEntry {
+	int id;
+	qint64 filesize;
+	qint64 mtime;
+	qint64 inode;
+	qint64 device;
+	bool is_directory;
+	bool is_deleted;
+	// Type, extension and ctime were stored; rows from older versions
+	// get them on their next rescan.
+	bool has_facets;
+};
+
+// Live files and subdirectories below a directory, at any depth. Also
+// used for the change a rescan makes to them.
+struct DirTotals {
+	qint64 size;
+	qint64 files;
+	qint64 dirs;
+
+	DirTotals &operator+=(const DirTotals &other) {
+		size += other.size;
+		files += other.files;
+		dirs += other.dirs;
+		return *this;
+	}
+	bool isZero() const { return size == 0 && files == 0 && dirs == 0; }
+};
+
+// A file the content hasher should read.
+struct HashCandidate {
+	int id;
+	QString full_path;
+	qint64 filesize;
+	qint64 mtime;
+	qint64 inode;
+};
+
+/**
+ * Facets a search is narrowed by, each answered from its own index.
+ *
+ * Bounds left at -1 and empty lists do not restrict. Times are
+ * milliseconds since the epoch, lower bounds inclusive and upper bounds
+ * exclusive; sizes are inclusive on both ends. A filter that restricts
+ * anything only matches files, never directories.
+ */
+struct FileFilter {
+	int catalog_id;
+	qint64 min_size;
+	qint64 max_size;
+	// Full types like "image/png" or families like "video/".
+	QStringList mime_types;
+	// Lowercase, without the dot.
+	QStringList extensions;
+	qint64 modified_after;
+	qint64 modified_before;
+	qint64 changed_after;
+	qint64 changed_before;
+
+	FileFilter();
+	bool isEmpty() const;
+	static FileFilter take(QString &text);
+};
+
+// Totals of one catalog; deleted counts tombstoned rows, everything else
+// only live ones.
+struct CatalogStats {
+	qint64 files;
+	qint64 directories;
+	qint64 total_size;
+	qint64 deleted;
+	qint64 thumbnails_ready;
+	qint64 thumbnails_pending;
+	qint64 thumbnails_failed;
 };
 
 class DBManager {
@@ -38,26 +155,85 @@ class DBManager {
     int createCatalog(QString name, QString original_path, QString tags);
     int createCatalog(Catalog &catalog);
     // Find stuff
-    int findParent(int catalog_id, QString full_path);
-    bool dirEntryExists(QString full_path);
+    QHash<QString, IndexedEntry> fetchIndex(int catalog_id);
     void connect();
     QSqlQuery fetchCatalogs();
-    QSqlQuery fetchDirectoryTree(int cat_id, int parent_id);
+	QVector<int> reachableCatalogs();
+	QVector<DirectoryRow> fetchDirectoryChildren(int cat_id, const QVector<int> &parent_ids);
     QSqlQuery fetchFiles(int parent_id);
     QSqlQuery fetchFiles(int parent_id, int catalog_id);
     QSqlQuery allFiles(int cat_id);
     QSqlQuery searchFiles(QString keyword, bool and_join, int cat_id);
+	QSqlQuery searchFiles(QString keyword, bool and_join, const FileFilter &filter);
+	QSqlQuery filterFiles(const FileFilter &filter);
     bool deleteFiles(int cat_id, QVector<int> files);
+    bool tombstoneFiles(int cat_id, QVector<int> files);
+    int purgeTombstones(int cat_id);
+	CatalogStats catalogStats(int cat_id);
 	QString formatSQL(QString keyword);
 	DirEntry getDirentry(int id);
 	int getRootId(int cat_id);
 	bool updateThumbnail(int entry_id, QByteArray thumbnail);
+	bool updateThumbnails(const QVector<QPair<int, QByteArray>> &thumbnails);
+	QVector<QPair<int, QString>> pendingThumbnails(int after_id, int limit, const QVector<int> &catalog_ids);
+	QVector<QPair<int, QByteArray>> fetchThumbnails(int after_id, int limit);
+	// Content hashes
+	QVector<HashCandidate> hashCandidates(bool content, int after_id, int limit);
+	bool storeHashes(const QVector<QPair<int, qint64>> &hashes, bool content);
+	QSqlQuery findDuplicates(int cat_id);
+	// Directory totals
+	bool rollUpDirectoryTotals(int cat_id);
+	bool addDirectoryTotals(const QHash<int, DirTotals> &deltas);
+	bool replaceThumbnails(const QVector<QPair<int, QByteArray>> &thumbnails);
+	bool vacuum();
+	// Scan checkpoints
+	QSet<QString> fetchCheckpoints(int catalog_id);
+	QVector<int> checkpointedCatalogs();
+	bool clearCheckpoints(int catalog_id);
+	void *interruptHandle();
+	static void interrupt(void *handle);
+	// Batched writes
+	void beginBatch(int batch_size, int flush_interval_ms);
+	int batchDirEntry(DirEntry &dir_entry);
+	bool batchUpdateDirEntry(DirEntry &dir_entry, bool content_changed);
+	bool batchDirectoryMtime(int entry_id, qint64 mtime);
+	bool batchCheckpoint(int catalog_id, const QString &path, const QString &parent);
+	bool batchDue();
+	bool commitBatch();
+	bool endBatch();
 
       private:
 	QSqlDatabase m_db;
 	QString db_path;
+	QSqlQuery *batch_insert;
+	QSqlQuery *batch_update;
+	QSqlQuery *batch_mtime;
+	QSqlQuery *batch_checkpoint;
+	QSqlQuery *batch_checkpoint_prune;
+	QElapsedTimer batch_timer;
+	int batch_size;
+	int batch_interval;
+	int batch_rows;
+	bool in_batch;
+	bool fts_enabled;
+	void initBatchState();
+	bool commitChunk();
+	void finishBatchQueries();
 	void createTables();
 	void createIndexes();
+	void upgradeSchema();
+	void moveThumbnails();
+	void createDirectoryTotals();
+	bool computeDirectoryTotals(int cat_id);
+	bool storeThumbnail(QSqlQuery &flag, QSqlQuery &store, int entry_id, const QByteArray &thumbnail);
+	void createSearchIndex();
+	bool hasSearchIndex();
+	int countSchemaObjects(const QString &type, const QStringList &names);
+	bool hasColumn(const QString &table, const QString &column);
+	void addColumn(const QString &table, const QString &column, const QString &definition);
 };
 
+Q_DECLARE_METATYPE(FileRow)
+Q_DECLARE_METATYPE(DirectoryRow)
+
 #endif // DBMANAGER_H
@@ -0,0 +1,386 @@
+#include "directorytreemodel.h"
+#include "filelistmodel.h"
+#include <QAtomicInt>
+#include <QFileIconProvider>
+#include <QSqlDatabase>
+#include <QThread>
+#include <algorithm>
+
+namespace {
+QAtomicInt loader_counter;
+} // namespace
+
+DirectoryLoader::DirectoryLoader(QString db_path) : db_path(db_path), db(nullptr) {
+	qRegisterMetaType<QVector<int>>("QVector<int>");
+	qRegisterMetaType<QVector<DirectoryRow>>("QVector<DirectoryRow>");
+	connection_name = QString("directory_loader_%1").arg(loader_counter.fetchAndAddOrdered(1));
+}
+
+DirectoryLoader::~DirectoryLoader() { closeDatabase(); }
+
+void DirectoryLoader::load(int generation, int catalog_id, QVector<int> parent_ids) {
+	if (db == nullptr) {
+		db = new DBManager(db_path, connection_name);
+	}
+	emit loaded(generation, parent_ids, db->fetchDirectoryChildren(catalog_id, parent_ids));
+}
+
+void DirectoryLoader::setDatabase(QString db_path) {
+	closeDatabase();
+	this->db_path = db_path;
+}
+
+void DirectoryLoader::closeDatabase() {
+	if (db == nullptr) {
+		return;
+	}
+	delete db;
+	db = nullptr;
+	QSqlDatabase::removeDatabase(connection_name);
+}
+
+DirectoryTreeModel::DirectoryTreeModel(QString db_path, QObject *parent)
+    : QAbstractItemModel(parent), catalog_id(-1), generation(0), sort_column(NameColumn), sort_order(Qt::AscendingOrder) {
+	QFileIconProvider icon_provider;
+	folder_icon = icon_provider.icon(QFileIconProvider::Folder);
+	drive_icon = icon_provider.icon(QFileIconProvider::Drive);
+	loader = new DirectoryLoader(db_path);
+	loader_thread = new QThread(this);
+	loader->moveToThread(loader_thread);
+	connect(loader_thread, &QThread::finished, loader, &QObject::deleteLater);
+	connect(this, &DirectoryTreeModel::requestLoad, loader, &DirectoryLoader::load);
+	connect(loader, &DirectoryLoader::loaded, this, &DirectoryTreeModel::childrenLoaded);
+	loader_thread->start();
+}
+
+DirectoryTreeModel::~DirectoryTreeModel() {
+	loader_thread->quit();
+	loader_thread->wait();
+}
+
+QModelIndex DirectoryTreeModel::index(int row, int column, const QModelIndex &parent) const {
+	if (row < 0 || column < 0 || column >= ColumnCount) {
+		return QModelIndex();
+	}
+	if (!parent.isValid()) {
+		return row == 0 && !ids.isEmpty() ? createIndex(0, column, quintptr(0)) : QModelIndex();
+	}
+	int slot = slotOf(parent);
+	if (row >= child_counts[slot]) {
+		return QModelIndex();
+	}
+	return createIndex(row, column, quintptr(children[first_children[slot] + row]));
+}
+
+QModelIndex DirectoryTreeModel::parent(const QModelIndex &child) const {
+	if (!child.isValid()) {
+		return QModelIndex();
+	}
+	int parent_slot = parents[slotOf(child)];
+	if (parent_slot < 0) {
+		return QModelIndex();
+	}
+	return createIndex(positions[parent_slot], 0, quintptr(parent_slot));
+}
+
+int DirectoryTreeModel::rowCount(const QModelIndex &parent) const {
+	if (parent.column() > 0) {
+		return 0;
+	}
+	if (!parent.isValid()) {
+		return ids.isEmpty() ? 0 : 1;
+	}
+	return child_counts[slotOf(parent)];
+}
+
+int DirectoryTreeModel::columnCount(const QModelIndex &parent) const {
+	Q_UNUSED(parent);
+	return ColumnCount;
+}
+
+/**
+ * @brief Answered from the stored totals until the children are loaded, so
+ * expand arrows are right without reading a level ahead.
+ */
+bool DirectoryTreeModel::hasChildren(const QModelIndex &parent) const {
+	if (!parent.isValid()) {
+		return !ids.isEmpty();
+	}
+	if (parent.column() > 0) {
+		return false;
+	}
+	int slot = slotOf(parent);
+	return states[slot] == Loaded ? child_counts[slot] > 0 : mayHaveChildren(slot);
+}
+
+bool DirectoryTreeModel::canFetchMore(const QModelIndex &parent) const {
+	if (!parent.isValid()) {
+		return false;
+	}
+	int slot = slotOf(parent);
+	return states[slot] != Loaded && states[slot] != Fetching && mayHaveChildren(slot);
+}
+
+void DirectoryTreeModel::fetchMore(const QModelIndex &parent) {
+	if (!canFetchMore(parent)) {
+		return;
+	}
+	int slot = slotOf(parent);
+	// Already on its way; the next level is fetched once it arrives.
+	if (states[slot] == Prefetching) {
+		states[slot] = Fetching;
+		return;
+	}
+	request(QVector<int>() << slot, Fetching);
+}
+
+/**
+ * @brief Read the children of every subdirectory of parent in one request.
+ */
+void DirectoryTreeModel::prefetch(const QModelIndex &parent) {
+	int slot = slotOf(parent);
+	if (slot < 0 || states[slot] != Loaded) {
+		return;
+	}
+	QVector<int> targets;
+	for (int i = 0; i < child_counts[slot]; i++) {
+		int child = children[first_children[slot] + i];
+		if (states[child] == NotLoaded && mayHaveChildren(child)) {
+			targets.append(child);
+		}
+	}
+	request(targets, Prefetching);
+}
+
+QVariant DirectoryTreeModel::data(const QModelIndex &index, int role) const {
+	if (!index.isValid()) {
+		return QVariant();
+	}
+	int slot = slotOf(index);
+
+	switch (role) {
+	case Qt::DisplayRole:
+		if (index.column() == NameColumn) {
+			return nameAt(slot).toString();
+		} else if (index.column() == SizeColumn && dir_counts[slot] >= 0) {
+			return humanSize(sizes[slot]);
+		}
+		break;
+	case Qt::DecorationRole:
+		if (index.column() == NameColumn) {
+			return parents[slot] < 0 ? drive_icon : folder_icon;
+		}
+		break;
+	case Qt::TextAlignmentRole:
+		if (index.column() == SizeColumn) {
+			return int(Qt::AlignRight | Qt::AlignVCenter);
+		}
+		break;
+	case Qt::ToolTipRole:
+		if (index.column() == SizeColumn && dir_counts[slot] >= 0) {
+			return tr("%1 files in %2 folders").arg(file_counts[slot]).arg(dir_counts[slot]);
+		}
+		break;
+	case Qt::UserRole:
+		return ids[slot];
+	}
+	return QVariant();
+}
+
+QVariant DirectoryTreeModel::headerData(int section, Qt::Orientation orientation, int role) const {
+	if (orientation != Qt::Horizontal || role != Qt::DisplayRole) {
+		return QAbstractItemModel::headerData(section, orientation, role);
+	}
+	switch (section) {
+	case NameColumn:
+		return tr("Folder");
+	case SizeColumn:
+		return tr("Size");
+	}
+	return QVariant();
+}
+
+/**
+ * @brief Sort every loaded level; children loaded later are sorted the same
+ * way as they come in.
+ */
+void DirectoryTreeModel::sort(int column, Qt::SortOrder order) {
+	sort_column = column;
+	sort_order = order;
+	if (ids.isEmpty()) {
+		return;
+	}
+	emit layoutAboutToBeChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+	const QModelIndexList persistent = persistentIndexList();
+	for (int slot = 0; slot < ids.size(); slot++) {
+		if (child_counts[slot] > 1) {
+			sortChildren(slot);
+		}
+	}
+	QModelIndexList moved;
+	moved.reserve(persistent.size());
+	for (const QModelIndex &index : persistent) {
+		int slot = slotOf(index);
+		moved.append(createIndex(positions[slot], index.column(), quintptr(slot)));
+	}
+	changePersistentIndexList(persistent, moved);
+	emit layoutChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+}
+
+/**
+ * @brief Show the directories of a catalog, starting with its top level only.
+ * @param root_id parent id of the top level directories
+ */
+void DirectoryTreeModel::setCatalog(int catalog_id, const QString &name, int root_id) {
+	beginResetModel();
+	clearNodes();
+	this->catalog_id = catalog_id;
+	addNode(root_id, -1, name, 0, 0, -1);
+	endResetModel();
+}
+
+void DirectoryTreeModel::clear() {
+	beginResetModel();
+	clearNodes();
+	endResetModel();
+}
+
+void DirectoryTreeModel::setDatabase(const QString &db_path) {
+	clear();
+	QMetaObject::invokeMethod(loader, "setDatabase", Qt::QueuedConnection, Q_ARG(QString, db_path));
+}
+
+/**
+ * @brief Directory id of a valid index; the catalog itself has the parent id
+ * of the top level.
+ */
+int DirectoryTreeModel::directoryId(const QModelIndex &index) const { return index.isValid() ? ids[slotOf(index)] : -1; }
+
+void DirectoryTreeModel::childrenLoaded(int generation, QVector<int> parent_ids, QVector<DirectoryRow> rows) {
+	// Loaded for a catalog that is no longer shown.
+	if (generation != this->generation) {
+		return;
+	}
+	// Rows arrive grouped by parent.
+	QHash<int, int> first_rows;
+	QHash<int, int> row_counts;
+	for (int i = 0; i < rows.size(); i++) {
+		if (!first_rows.contains(rows[i].parent_id)) {
+			first_rows.insert(rows[i].parent_id, i);
+		}
+		row_counts[rows[i].parent_id]++;
+	}
+	for (int parent_id : parent_ids) {
+		auto waiting = pending.find(parent_id);
+		if (waiting == pending.end()) {
+			continue;
+		}
+		int slot = waiting.value();
+		pending.erase(waiting);
+		bool expanding = states[slot] == Fetching;
+		QModelIndex parent_index = createIndex(positions[slot], 0, quintptr(slot));
+		int count = row_counts.value(parent_id);
+		if (count == 0) {
+			// The stored totals promised children that are gone by now.
+			states[slot] = Loaded;
+			emit dataChanged(parent_index, parent_index);
+			continue;
+		}
+		beginInsertRows(parent_index, 0, count - 1);
+		int first = first_rows.value(parent_id);
+		QVector<int> added;
+		added.reserve(count);
+		for (int i = first; i < first + count; i++) {
+			const DirectoryRow &row = rows[i];
+			added.append(addNode(row.id, slot, row.name, row.total_size, row.file_count, row.dir_count));
+		}
+		first_children[slot] = children.size();
+		child_counts[slot] = count;
+		children += added;
+		states[slot] = Loaded;
+		sortChildren(slot);
+		endInsertRows();
+		if (expanding) {
+			prefetch(parent_index);
+		}
+	}
+}
+
+void DirectoryTreeModel::clearNodes() {
+	ids.clear();
+	parents.clear();
+	positions.clear();
+	first_children.clear();
+	child_counts.clear();
+	sizes.clear();
+	file_counts.clear();
+	dir_counts.clear();
+	name_ends.clear();
+	states.clear();
+	names.clear();
+	children.clear();
+	pending.clear();
+	catalog_id = -1;
+	generation++;
+}
+
+int DirectoryTreeModel::addNode(int id, int parent, const QString &name, qint64 size, qint64 files, qint64 dirs) {
+	int slot = ids.size();
+	ids.append(id);
+	parents.append(parent);
+	positions.append(0);
+	first_children.append(0);
+	child_counts.append(0);
+	sizes.append(size);
+	file_counts.append(files);
+	dir_counts.append(dirs);
+	names.append(name);
+	name_ends.append(names.size());
+	states.append(NotLoaded);
+	return slot;
+}
+
+QStringRef DirectoryTreeModel::nameAt(int slot) const {
+	int start = slot > 0 ? name_ends[slot - 1] : 0;
+	return names.midRef(start, name_ends[slot] - start);
+}
+
+int DirectoryTreeModel::slotOf(const QModelIndex &index) const { return index.isValid() ? int(index.internalId()) : -1; }
+
+bool DirectoryTreeModel::mayHaveChildren(int slot) const { return dir_counts[slot] != 0; }
+
+void DirectoryTreeModel::request(const QVector<int> &targets, LoadState state) {
+	QVector<int> parent_ids;
+	parent_ids.reserve(targets.size());
+	for (int slot : targets) {
+		states[slot] = state;
+		pending.insert(ids[slot], slot);
+		parent_ids.append(ids[slot]);
+	}
+	if (!parent_ids.isEmpty()) {
+		emit requestLoad(generation, catalog_id, parent_ids);
+	}
+}
+
+void DirectoryTreeModel::sortChildren(int slot) {
+	auto begin = children.begin() + first_children[slot];
+	auto end = begin + child_counts[slot];
+	auto by_name = [this](int a, int b) {
+		int cmp = nameAt(a).compare(nameAt(b), Qt::CaseInsensitive);
+		return cmp != 0 ? cmp < 0 : ids[a] < ids[b];
+	};
+	auto less = [&](int a, int b) {
+		if (sort_column == SizeColumn && sizes[a] != sizes[b]) {
+			return sizes[a] < sizes[b];
+		}
+		return by_name(a, b);
+	};
+	if (sort_order == Qt::AscendingOrder) {
+		std::sort(begin, end, less);
+	} else {
+		std::sort(begin, end, [&](int a, int b) { return less(b, a); });
+	}
+	for (int i = 0; i < child_counts[slot]; i++) {
+		positions[children[first_children[slot] + i]] = i;
+	}
+}
@@ -0,0 +1,122 @@
+#ifndef DIRECTORYTREEMODEL_H
+#define DIRECTORYTREEMODEL_H
+
+#include "dbmanager.h"
+#include <QAbstractItemModel>
+#include <QHash>
+#include <QIcon>
+#include <QObject>
+#include <QVector>
+
+class QThread;
+
+/**
+ * Reads directory listings for DirectoryTreeModel on its own thread and
+ * connection. One request covers the children of many directories.
+ */
+class DirectoryLoader : public QObject {
+	Q_OBJECT
+      public:
+	DirectoryLoader(QString db_path);
+	~DirectoryLoader();
+
+      public slots:
+	void load(int generation, int catalog_id, QVector<int> parent_ids);
+	void setDatabase(QString db_path);
+
+      signals:
+	void loaded(int generation, QVector<int> parent_ids, QVector<DirectoryRow> rows);
+
+      private:
+	QString db_path;
+	QString connection_name;
+	DBManager *db;
+	void closeDatabase();
+};
+
+/**
+ * Tree model for the directories of one catalog.
+ *
+ * Nodes live in an arena of flat columns indexed by slot, the slot is the
+ * internal id of a model index, and all names share one string buffer.
+ * Children of a node are a contiguous range of the children vector, so
+ * sorting only reorders slots within that range.
+ *
+ * Children are read on demand by the loader, whether a directory has any
+ * is known from its stored totals before it is loaded. When a directory is
+ * expanded, the children of all its subdirectories are read in one request
+ * so the next level opens without waiting.
+ */
+class DirectoryTreeModel : public QAbstractItemModel {
+	Q_OBJECT
+      public:
+	enum Column { NameColumn = 0, SizeColumn, ColumnCount };
+
+	DirectoryTreeModel(QString db_path, QObject *parent = nullptr);
+	~DirectoryTreeModel();
+
+	QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
+	QModelIndex parent(const QModelIndex &child) const override;
+	int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+	int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+	bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
+	bool canFetchMore(const QModelIndex &parent) const override;
+	void fetchMore(const QModelIndex &parent) override;
+	QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+	QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+	void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+
+	void setCatalog(int catalog_id, const QString &name, int root_id);
+	void clear();
+	void setDatabase(const QString &db_path);
+	int directoryId(const QModelIndex &index) const;
+
+      public slots:
+	void prefetch(const QModelIndex &parent);
+
+      signals:
+	void requestLoad(int generation, int catalog_id, QVector<int> parent_ids);
+
+      private slots:
+	void childrenLoaded(int generation, QVector<int> parent_ids, QVector<DirectoryRow> rows);
+
+      private:
+	enum LoadState : quint8 { NotLoaded = 0, Prefetching, Fetching, Loaded };
+
+	// One slot per node; slot 0 is the catalog itself.
+	QVector<int> ids;
+	QVector<int> parents;
+	// Row of each node among its siblings.
+	QVector<int> positions;
+	QVector<int> first_children;
+	QVector<int> child_counts;
+	QVector<qint64> sizes;
+	QVector<qint64> file_counts;
+	// -1 while unknown, which only happens for the catalog.
+	QVector<qint64> dir_counts;
+	QVector<int> name_ends;
+	QVector<quint8> states;
+	QString names;
+	QVector<int> children;
+	// Directory id -> slot of nodes whose children were requested.
+	QHash<int, int> pending;
+
+	int catalog_id;
+	int generation;
+	int sort_column;
+	Qt::SortOrder sort_order;
+	QIcon folder_icon;
+	QIcon drive_icon;
+	QThread *loader_thread;
+	DirectoryLoader *loader;
+
+	void clearNodes();
+	int addNode(int id, int parent, const QString &name, qint64 size, qint64 files, qint64 dirs);
+	QStringRef nameAt(int slot) const;
+	int slotOf(const QModelIndex &index) const;
+	bool mayHaveChildren(int slot) const;
+	void request(const QVector<int> &targets, LoadState state);
+	void sortChildren(int slot);
+};
+
+#endif // DIRECTORYTREEMODEL_H
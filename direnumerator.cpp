@@ -0,0 +1,232 @@
+#include "direnumerator.h"
+#include <QAtomicInt>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#endif
+
+namespace {
+QAtomicInt selected_backend(DirEnumerator::Auto);
+
+#ifdef Q_OS_LINUX
+struct LinuxDirent64 {
+	quint64 d_ino;
+	qint64 d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[1];
+};
+
+// Only what the catalog stores; anything beyond the basic stats can be
+// expensive on network filesystems.
+#ifdef STATX_BASIC_STATS
+const unsigned int statx_mask = STATX_TYPE | STATX_SIZE | STATX_MTIME | STATX_CTIME | STATX_INO;
+QAtomicInt statx_missing(0);
+#endif
+
+struct NativeStat {
+	mode_t mode;
+	qint64 size;
+	qint64 mtime;
+	qint64 ctime;
+	qint64 inode;
+	qint64 device;
+};
+
+bool nativeStat(int dir_fd, const char *name, bool follow, NativeStat &out) {
+	int flags = follow ? 0 : AT_SYMLINK_NOFOLLOW;
+#ifdef STATX_BASIC_STATS
+	if (!statx_missing.loadAcquire()) {
+		struct statx stx;
+		if (statx(dir_fd, name, flags, statx_mask, &stx) == 0) {
+			out.mode = stx.stx_mode;
+			out.size = (qint64)stx.stx_size;
+			out.mtime = (qint64)stx.stx_mtime.tv_sec * 1000 + stx.stx_mtime.tv_nsec / 1000000;
+			out.ctime = (qint64)stx.stx_ctime.tv_sec * 1000 + stx.stx_ctime.tv_nsec / 1000000;
+			out.inode = (qint64)stx.stx_ino;
+			out.device = (qint64)makedev(stx.stx_dev_major, stx.stx_dev_minor);
+			return true;
+		}
+		if (errno != ENOSYS) {
+			return false;
+		}
+		statx_missing.storeRelease(1);
+	}
+#endif
+	struct stat st;
+	if (fstatat(dir_fd, name, &st, flags) != 0) {
+		return false;
+	}
+	out.mode = st.st_mode;
+	out.size = (qint64)st.st_size;
+	out.mtime = (qint64)st.st_mtim.tv_sec * 1000 + st.st_mtim.tv_nsec / 1000000;
+	out.ctime = (qint64)st.st_ctim.tv_sec * 1000 + st.st_ctim.tv_nsec / 1000000;
+	out.inode = (qint64)st.st_ino;
+	out.device = (qint64)st.st_dev;
+	return true;
+}
+#endif
+} // namespace
+
+void DirEnumerator::setBackend(Backend backend) { selected_backend.storeRelease(backend); }
+
+DirEnumerator::Backend DirEnumerator::backend() { return (Backend)selected_backend.loadAcquire(); }
+
+bool DirEnumerator::list(const QString &directory, QVector<ScanEntry> &entries) {
+#ifdef Q_OS_LINUX
+	if (backend() != Generic) {
+		return listNative(directory, entries);
+	}
+#endif
+	return listGeneric(directory, entries);
+}
+
+bool DirEnumerator::listGeneric(const QString &directory, QVector<ScanEntry> &entries) {
+	QDirIterator it(directory, QDir::AllEntries | QDir::NoDotAndDotDot);
+	if (!it.hasNext() && !QFileInfo(directory).isDir()) {
+		return false;
+	}
+	while (it.hasNext()) {
+		it.next();
+		QFileInfo info = it.fileInfo();
+		ScanEntry entry;
+		entry.name = info.fileName();
+		entry.full_path = info.absoluteFilePath();
+		entry.size = info.size();
+		entry.mtime = info.lastModified().toMSecsSinceEpoch();
+		entry.ctime = info.metadataChangeTime().toMSecsSinceEpoch();
+		entry.inode = 0;
+		entry.device = 0;
+#ifdef Q_OS_UNIX
+		// QFileInfo has no inode, so rename detection costs one more stat here.
+		struct stat st;
+		if (::stat(QFile::encodeName(entry.full_path).constData(), &st) == 0) {
+			entry.inode = (qint64)st.st_ino;
+			entry.device = (qint64)st.st_dev;
+		}
+#endif
+		entry.is_dir = info.isDir();
+		entry.is_symlink = info.isSymLink();
+		entries.append(entry);
+	}
+	return true;
+}
+
+#ifdef Q_OS_LINUX
+/**
+ * @brief getdents64 + statx listing.
+ *
+ * One statx per entry, issued relative to the directory fd so no byte
+ * path is built per file; only the stored QString path is allocated.
+ * Symlinks are followed for their attributes like QFileInfo does, and
+ * anything QDir would count as a system file is dropped.
+ */
+bool DirEnumerator::listNative(const QString &directory, QVector<ScanEntry> &entries) {
+	int dir_fd = open(QFile::encodeName(directory).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dir_fd < 0) {
+		return false;
+	}
+
+	QString prefix = directory;
+	if (!prefix.endsWith('/')) {
+		prefix.append('/');
+	}
+
+	// Large enough to fetch a few hundred entries per syscall.
+	alignas(8) char buffer[32768];
+	bool ok = true;
+	for (;;) {
+		long bytes = syscall(SYS_getdents64, dir_fd, buffer, sizeof(buffer));
+		if (bytes < 0) {
+			ok = false;
+			break;
+		}
+		if (bytes == 0) {
+			break;
+		}
+		for (long offset = 0; offset < bytes;) {
+			const LinuxDirent64 *dirent = reinterpret_cast<const LinuxDirent64 *>(buffer + offset);
+			offset += dirent->d_reclen;
+			const char *name = dirent->d_name;
+			// Hidden entries, "." and ".." included.
+			if (name[0] == '.') {
+				continue;
+			}
+
+			bool is_symlink = dirent->d_type == DT_LNK;
+			bool follow = is_symlink || dirent->d_type == DT_UNKNOWN;
+			NativeStat st;
+			if (!nativeStat(dir_fd, name, follow, st)) {
+				// Dangling symlinks are system entries for QDir.
+				continue;
+			}
+			if (dirent->d_type == DT_UNKNOWN) {
+				NativeStat link_st;
+				is_symlink = nativeStat(dir_fd, name, false, link_st) && S_ISLNK(link_st.mode);
+			}
+			if (!S_ISREG(st.mode) && !S_ISDIR(st.mode)) {
+				continue;
+			}
+
+			ScanEntry entry;
+			entry.name = QFile::decodeName(name);
+			entry.full_path = prefix + entry.name;
+			entry.size = st.size;
+			entry.mtime = st.mtime;
+			entry.ctime = st.ctime;
+			entry.inode = st.inode;
+			entry.device = st.device;
+			entry.is_dir = S_ISDIR(st.mode);
+			entry.is_symlink = is_symlink;
+			entries.append(entry);
+		}
+	}
+	close(dir_fd);
+	return ok;
+}
+#endif
+
+/**
+ * @brief Current mtime of a directory, -1 if it cannot be read.
+ */
+qint64 DirEnumerator::directoryMtime(const QString &directory) {
+#ifdef Q_OS_LINUX
+	if (backend() != Generic) {
+		NativeStat st;
+		if (!nativeStat(AT_FDCWD, QFile::encodeName(directory).constData(), true, st)) {
+			return -1;
+		}
+		return st.mtime;
+	}
+#endif
+	QFileInfo info(directory);
+	if (!info.exists()) {
+		return -1;
+	}
+	return info.lastModified().toMSecsSinceEpoch();
+}
+
+/**
+ * @brief Same as QFileInfo::completeBaseName() without touching the disk.
+ */
+QString DirEnumerator::completeBaseName(const QString &file_name) {
+	int dot = file_name.lastIndexOf('.');
+	if (dot < 0) {
+		return file_name;
+	}
+	return file_name.left(dot);
+}
@@ -0,0 +1,63 @@
+#ifndef DIRENUMERATOR_H
+#define DIRENUMERATOR_H
+
+#include <QString>
+#include <QVector>
+
+struct ScanEntry {
+	QString name;
+	QString full_path;
+	qint64 size;
+	qint64 mtime;
+	// Last status change, the closest to a creation time POSIX offers.
+	qint64 ctime;
+	qint64 inode;
+	qint64 device;
+	bool is_dir;
+	bool is_symlink;
+};
+
+struct ScanBatch {
+	QString directory;
+	qint64 mtime;
+	// Set when the directory mtime matched the catalog and it was not listed.
+	bool unchanged;
+	// Set when an interrupted scan already finished this subtree; neither
+	// the directory nor anything below it is visited.
+	bool resumed;
+	// Subdirectories the walker is going to visit below this one.
+	int subdir_count;
+	QVector<ScanEntry> entries;
+};
+
+/**
+ * Lists the entries of a single directory.
+ *
+ * Filtering matches the recursive QDirIterator the scanner used to run:
+ * hidden and system entries are skipped, symlinked directories are
+ * reported but never descended into.
+ *
+ * Times are milliseconds since the epoch.
+ *
+ * On Linux the directory is read with getdents64 and every entry is
+ * stat'ed with statx relative to the directory fd. Other platforms, and
+ * Linux when the native path is disabled, go through QDirIterator.
+ */
+class DirEnumerator {
+      public:
+	enum Backend { Auto, Generic, Native };
+
+	static bool list(const QString &directory, QVector<ScanEntry> &entries);
+	static qint64 directoryMtime(const QString &directory);
+	static QString completeBaseName(const QString &file_name);
+	static void setBackend(Backend backend);
+	static Backend backend();
+
+      private:
+	static bool listGeneric(const QString &directory, QVector<ScanEntry> &entries);
+#ifdef Q_OS_LINUX
+	static bool listNative(const QString &directory, QVector<ScanEntry> &entries);
+#endif
+};
+
+#endif // DIRENUMERATOR_H
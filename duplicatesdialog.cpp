@@ -0,0 +1,65 @@
+#include "duplicatesdialog.h"
+#include "filelistmodel.h"
+#include <QDialogButtonBox>
+#include <QHeaderView>
+#include <QLabel>
+#include <QSqlQuery>
+#include <QTreeWidget>
+#include <QVBoxLayout>
+
+DuplicatesDialog::DuplicatesDialog(DBManager *db, const QHash<int, QString> &catalog_names, QWidget *parent) : QDialog(parent) {
+	setWindowTitle(tr("Duplicate files"));
+	resize(900, 600);
+	summary = new QLabel(this);
+	tree = new QTreeWidget(this);
+	tree->setColumnCount(2);
+	tree->setHeaderLabels(QStringList() << tr("File") << tr("Catalog"));
+	tree->header()->setSectionResizeMode(0, QHeaderView::Stretch);
+	tree->header()->setSectionResizeMode(1, QHeaderView::ResizeToContents);
+	tree->header()->setStretchLastSection(false);
+	QDialogButtonBox *buttons = new QDialogButtonBox(QDialogButtonBox::Close, this);
+	connect(buttons, &QDialogButtonBox::rejected, this, &QDialog::reject);
+	QVBoxLayout *layout = new QVBoxLayout(this);
+	layout->addWidget(summary);
+	layout->addWidget(tree);
+	layout->addWidget(buttons);
+	populate(db, catalog_names);
+}
+
+void DuplicatesDialog::populate(DBManager *db, const QHash<int, QString> &catalog_names) {
+	QSqlQuery query = db->findDuplicates(-1);
+	QTreeWidgetItem *group = nullptr;
+	qint64 group_size = -1;
+	qint64 group_hash = 0;
+	int copies = 0;
+	int groups = 0;
+	qint64 reclaimable = 0;
+	auto closeGroup = [&]() {
+		if (group != nullptr) {
+			group->setText(0, tr("%1 copies of %2").arg(copies).arg(humanSize(group_size)));
+			group->setText(1, tr("%1 redundant").arg(humanSize(group_size * (copies - 1))));
+			reclaimable += group_size * (copies - 1);
+		}
+	};
+	while (query.next()) {
+		qint64 size = query.value("filesize").toLongLong();
+		qint64 hash = query.value("content_hash").toLongLong();
+		if (group == nullptr || size != group_size || hash != group_hash) {
+			closeGroup();
+			group = new QTreeWidgetItem(tree);
+			group_size = size;
+			group_hash = hash;
+			copies = 0;
+			groups++;
+		}
+		QTreeWidgetItem *item = new QTreeWidgetItem(group);
+		item->setText(0, query.value("full_path").toString());
+		item->setText(1, catalog_names.value(query.value("catalog_id").toInt()));
+		copies++;
+	}
+	closeGroup();
+	summary->setText(groups == 0 ? tr("No duplicates found. Enable \"Hash files to find duplicates\" and rescan to look for them.")
+				     : tr("%1 groups of identical files, %2 held more than once")
+					   .arg(groups)
+					   .arg(humanSize(reclaimable)));
+}
@@ -0,0 +1,28 @@
+#ifndef DUPLICATESDIALOG_H
+#define DUPLICATESDIALOG_H
+
+#include "dbmanager.h"
+#include <QDialog>
+#include <QHash>
+
+class QLabel;
+class QTreeWidget;
+
+/**
+ * Files with identical content across all catalogs, one group per content
+ * hash, largest files first. Only files hashed during a scan with
+ * "Hash files to find duplicates" enabled are listed.
+ */
+class DuplicatesDialog : public QDialog {
+	Q_OBJECT
+      public:
+	DuplicatesDialog(DBManager *db, const QHash<int, QString> &catalog_names, QWidget *parent = nullptr);
+
+      private:
+	void populate(DBManager *db, const QHash<int, QString> &catalog_names);
+
+	QTreeWidget *tree;
+	QLabel *summary;
+};
+
+#endif // DUPLICATESDIALOG_H
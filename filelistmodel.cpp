@@ -0,0 +1,322 @@
+#include "filelistmodel.h"
+#include <QColor>
+#include <QDir>
+#include <QFileInfo>
+#include <QSet>
+#include <algorithm>
+
+namespace {
+// A path never straddles two buffers, and no buffer comes near the QString size limit.
+const int path_chunk_chars = 1 << 26;
+} // namespace
+
+QString humanSize(uint64_t bytes) {
+	QString suffix[] = {"B", "KB", "MB", "GB", "TB"};
+	char length = sizeof(suffix) / sizeof(suffix[0]);
+
+	int i = 0;
+	double dblBytes = bytes;
+
+	if (bytes > 1024) {
+		for (i = 0; (bytes / 1024) > 0 && i < length - 1; i++, bytes /= 1024)
+			dblBytes = bytes / 1024.0;
+	}
+
+	QString res = "%1 %2";
+	return res.arg(QString::number(dblBytes), suffix[i]);
+}
+
+FileListModel::FileListModel(QObject *parent) : QAbstractTableModel(parent), fullname(false) {}
+
+int FileListModel::rowCount(const QModelIndex &parent) const {
+	if (parent.isValid()) {
+		return 0;
+	}
+	return order.size();
+}
+
+int FileListModel::columnCount(const QModelIndex &parent) const {
+	if (parent.isValid()) {
+		return 0;
+	}
+	return ColumnCount;
+}
+
+QVariant FileListModel::data(const QModelIndex &index, int role) const {
+	if (!index.isValid() || index.row() >= order.size()) {
+		return QVariant();
+	}
+	int slot = order[index.row()];
+	int thumbnail_state = thumbnail_states[slot];
+
+	switch (role) {
+	case Qt::DisplayRole:
+		if (index.column() == NameColumn) {
+			return nameAt(slot).toString();
+		} else if (index.column() == SizeColumn) {
+			return humanSize(sizes[slot]);
+		} else if (index.column() == PreviewColumn) {
+			switch (thumbnail_state) {
+			case ThumbnailReady:
+				return tr("Ready");
+			case ThumbnailPending:
+				return tr("Pending");
+			case ThumbnailFailed:
+				return tr("Failed");
+			}
+			return tr("None");
+		}
+		break;
+	case Qt::DecorationRole:
+		if (index.column() == NameColumn) {
+			return iconFor(slot);
+		}
+		break;
+	case Qt::ToolTipRole:
+		if (index.column() == NameColumn) {
+			return QDir::toNativeSeparators(pathAt(slot).toString());
+		}
+		break;
+	case Qt::TextAlignmentRole:
+		if (index.column() == SizeColumn) {
+			return int(Qt::AlignRight | Qt::AlignVCenter);
+		} else if (index.column() == PreviewColumn) {
+			return int(Qt::AlignCenter);
+		}
+		break;
+	case Qt::ForegroundRole:
+		if (index.column() == PreviewColumn) {
+			switch (thumbnail_state) {
+			case ThumbnailReady:
+				return QColor("#86EFAC");
+			case ThumbnailPending:
+				return QColor("#FCD34D");
+			case ThumbnailFailed:
+				return QColor("#FCA5A5");
+			}
+			return QColor("#64748B");
+		}
+		break;
+	case CatalogIdRole:
+		return catalog_ids[slot];
+	case SecondaryTextRole:
+		if (index.column() == NameColumn) {
+			return secondaryText(slot);
+		}
+		break;
+	case EntryIdRole:
+		return ids[slot];
+	}
+	return QVariant();
+}
+
+QVariant FileListModel::headerData(int section, Qt::Orientation orientation, int role) const {
+	if (orientation != Qt::Horizontal || role != Qt::DisplayRole) {
+		return QAbstractTableModel::headerData(section, orientation, role);
+	}
+	switch (section) {
+	case NameColumn:
+		return tr("File");
+	case SizeColumn:
+		return tr("Size");
+	case PreviewColumn:
+		return tr("Preview");
+	}
+	return QVariant();
+}
+
+/**
+ * @brief Sort by reordering the row index; the stored columns never move.
+ */
+void FileListModel::sort(int column, Qt::SortOrder sort_order) {
+	if (order.size() < 2) {
+		return;
+	}
+	emit layoutAboutToBeChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+	const QModelIndexList persistent = persistentIndexList();
+	QVector<int> persistent_slots;
+	persistent_slots.reserve(persistent.size());
+	for (const QModelIndex &index : persistent) {
+		persistent_slots.append(order[index.row()]);
+	}
+
+	auto by_name = [this](int a, int b) {
+		int cmp = nameAt(a).compare(nameAt(b), Qt::CaseInsensitive);
+		if (cmp == 0) {
+			cmp = pathAt(a).compare(pathAt(b));
+		}
+		return cmp < 0;
+	};
+	auto less = [&](int a, int b) {
+		if (column == SizeColumn && sizes[a] != sizes[b]) {
+			return sizes[a] < sizes[b];
+		}
+		if (column == PreviewColumn && thumbnail_states[a] != thumbnail_states[b]) {
+			return thumbnail_states[a] < thumbnail_states[b];
+		}
+		return by_name(a, b);
+	};
+	if (sort_order == Qt::AscendingOrder) {
+		std::stable_sort(order.begin(), order.end(), less);
+	} else {
+		std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return less(b, a); });
+	}
+
+	QVector<int> rows(ids.size());
+	for (int row = 0; row < order.size(); row++) {
+		rows[order[row]] = row;
+	}
+	QModelIndexList moved;
+	moved.reserve(persistent.size());
+	for (int i = 0; i < persistent.size(); i++) {
+		moved.append(index(rows[persistent_slots[i]], persistent[i].column()));
+	}
+	changePersistentIndexList(persistent, moved);
+	emit layoutChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+}
+
+/**
+ * @brief Drop all rows. fullname selects how the second line of each row reads.
+ */
+void FileListModel::clear(bool fullname) {
+	beginResetModel();
+	ids.clear();
+	catalog_ids.clear();
+	sizes.clear();
+	path_offsets.clear();
+	path_lengths.clear();
+	name_offsets.clear();
+	thumbnail_states.clear();
+	paths.clear();
+	order.clear();
+	this->fullname = fullname;
+	endResetModel();
+}
+
+void FileListModel::appendRows(const QVector<FileRow> &rows) {
+	if (rows.isEmpty()) {
+		return;
+	}
+	int first = order.size();
+	beginInsertRows(QModelIndex(), first, first + rows.size() - 1);
+	for (const FileRow &row : rows) {
+		int slot = ids.size();
+		ids.append(row.id);
+		catalog_ids.append(row.catalog_id);
+		sizes.append(row.filesize);
+		name_offsets.append(row.full_path.lastIndexOf('/') + 1);
+		thumbnail_states.append(quint8(row.thumbnail_state));
+		if (paths.isEmpty() || paths.last().size() + row.full_path.size() > path_chunk_chars) {
+			paths.append(QString());
+		}
+		QString &chunk = paths.last();
+		path_offsets.append(qint64(paths.size() - 1) * path_chunk_chars + chunk.size());
+		path_lengths.append(row.full_path.size());
+		chunk.append(row.full_path);
+		order.append(slot);
+	}
+	endInsertRows();
+}
+
+void FileListModel::setCatalogNames(const QHash<int, QString> &names) {
+	catalog_names = names;
+	if (!order.isEmpty()) {
+		emit dataChanged(index(0, NameColumn), index(order.size() - 1, NameColumn), {SecondaryTextRole});
+	}
+}
+
+int FileListModel::entryId(int row) const {
+	if (row < 0 || row >= order.size()) {
+		return -1;
+	}
+	return ids[order[row]];
+}
+
+int FileListModel::catalogId(int row) const {
+	if (row < 0 || row >= order.size()) {
+		return -1;
+	}
+	return catalog_ids[order[row]];
+}
+
+QString FileListModel::fullPath(int row) const {
+	if (row < 0 || row >= order.size()) {
+		return QString();
+	}
+	return pathAt(order[row]).toString();
+}
+
+/**
+ * @brief Thumbnail state as loaded with the row, see ThumbnailState.
+ */
+int FileListModel::thumbnailState(int row) const {
+	if (row < 0 || row >= order.size()) {
+		return ThumbnailNone;
+	}
+	return thumbnail_states[order[row]];
+}
+
+/**
+ * @brief Record thumbnails stored since the rows were loaded, so the view
+ * and the priority lane do not work from a stale state.
+ */
+void FileListModel::setThumbnailStates(const QVector<int> &entry_ids, int state) {
+	if (entry_ids.isEmpty() || order.isEmpty()) {
+		return;
+	}
+	QSet<int> changed(entry_ids.begin(), entry_ids.end());
+	int first = order.size();
+	int last = -1;
+	for (int row = 0; row < order.size(); row++) {
+		int slot = order[row];
+		if (changed.contains(ids[slot])) {
+			thumbnail_states[slot] = quint8(state);
+			first = qMin(first, row);
+			last = row;
+		}
+	}
+	if (last >= 0) {
+		emit dataChanged(index(first, PreviewColumn), index(last, PreviewColumn), {Qt::DisplayRole, Qt::ForegroundRole});
+	}
+}
+
+QStringRef FileListModel::pathAt(int slot) const {
+	qint64 offset = path_offsets[slot];
+	return QStringRef(&paths[int(offset / path_chunk_chars)], int(offset % path_chunk_chars), path_lengths[slot]);
+}
+
+QStringRef FileListModel::nameAt(int slot) const { return pathAt(slot).mid(name_offsets[slot]); }
+
+/**
+ * @brief Icons are looked up once per suffix; most catalogs are offline media
+ * and the provider would otherwise touch every path.
+ */
+QIcon FileListModel::iconFor(int slot) const {
+	QStringRef name = nameAt(slot);
+	int dot = name.lastIndexOf('.');
+	QString suffix = dot > 0 ? name.mid(dot + 1).toString().toLower() : QString();
+	auto cached_icon = icon_cache.constFind(suffix);
+	if (cached_icon != icon_cache.constEnd()) {
+		return cached_icon.value();
+	}
+
+	QIcon icon = icon_provider.icon(QFileInfo(pathAt(slot).toString()));
+	icon_cache.insert(suffix, icon);
+	return icon;
+}
+
+QString FileListModel::secondaryText(int slot) const {
+	QStringRef path = pathAt(slot);
+	if (fullname) {
+		QString catalog_name = catalog_names.value(catalog_ids[slot]);
+		QString native_path = QDir::toNativeSeparators(path.toString());
+		return catalog_name.isEmpty() ? native_path : tr("%1  •  %2").arg(catalog_name, native_path);
+	}
+
+	QStringRef name = nameAt(slot);
+	int dot = name.lastIndexOf('.');
+	QString type_label = dot >= 0 && dot < name.size() - 1 ? name.mid(dot + 1).toString().toUpper() : tr("File");
+	int dir_length = qMax(0, name_offsets[slot] - 1);
+	QString directory = dir_length > 0 ? path.left(dir_length).toString() : QString("/");
+	return tr("%1  •  %2").arg(type_label, QDir::toNativeSeparators(directory));
+}
@@ -0,0 +1,70 @@
+#ifndef FILELISTMODEL_H
+#define FILELISTMODEL_H
+
+#include "dbmanager.h"
+#include <QAbstractTableModel>
+#include <QFileIconProvider>
+#include <QHash>
+#include <QIcon>
+#include <QVector>
+#include <cstdint>
+
+QString humanSize(uint64_t bytes);
+
+/**
+ * Table model for the file list.
+ *
+ * Rows are kept in flat columns: paths are packed into a few large string
+ * buffers and a row is only a handful of integers pointing into them. Text,
+ * icons and colours are produced in data() when the view paints a row, and
+ * sorting reorders a row index instead of the rows themselves.
+ */
+class FileListModel : public QAbstractTableModel {
+	Q_OBJECT
+      public:
+	enum Column { NameColumn = 0, SizeColumn, PreviewColumn, ColumnCount };
+	enum DataRole { CatalogIdRole = Qt::UserRole, SecondaryTextRole = Qt::UserRole + 1, EntryIdRole = Qt::UserRole + 2 };
+
+	FileListModel(QObject *parent = nullptr);
+
+	int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+	int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+	QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+	QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+	void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+
+	void clear(bool fullname);
+	void appendRows(const QVector<FileRow> &rows);
+	void setCatalogNames(const QHash<int, QString> &names);
+	int entryId(int row) const;
+	int catalogId(int row) const;
+	QString fullPath(int row) const;
+	int thumbnailState(int row) const;
+	void setThumbnailStates(const QVector<int> &entry_ids, int state);
+
+      private:
+	// One slot per stored row, indexed by the position in which it was appended.
+	QVector<int> ids;
+	QVector<int> catalog_ids;
+	QVector<qint64> sizes;
+	// Start of each path across all buffers, buffer * path_chunk_chars + position.
+	QVector<qint64> path_offsets;
+	QVector<int> path_lengths;
+	QVector<int> name_offsets;
+	QVector<quint8> thumbnail_states;
+	QVector<QString> paths;
+	// View row -> stored row.
+	QVector<int> order;
+
+	bool fullname;
+	QHash<int, QString> catalog_names;
+	QFileIconProvider icon_provider;
+	mutable QHash<QString, QIcon> icon_cache;
+
+	QStringRef pathAt(int slot) const;
+	QStringRef nameAt(int slot) const;
+	QIcon iconFor(int slot) const;
+	QString secondaryText(int slot) const;
+};
+
+#endif // FILELISTMODEL_H
@@ -4,6 +4,8 @@
 
 int main(int argc, char *argv[]) {
 	QApplication a(argc, argv);
+	QApplication::setOrganizationName("PoorMansCatalog");
+	QApplication::setApplicationName("PoorMansCatalog");
 	QApplication::setStyle("Fusion");
 	MainWindow w;
 	w.show();
@@ -1,11 +1,15 @@
 #include "mainwindow.h"
 #include "about.h"
+#include "duplicatesdialog.h"
+#include "filelistmodel.h"
 #include "scanner.h"
+#include "thumbnailmanager.h"
 #include "ui_mainwindow.h"
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
 #include <QInputDialog>
+#include <QSettings>
 #include <QSqlQuery>
 #include <QtWidgets>
 #include <cinttypes>
@@ -35,7 +39,7 @@ class FileListDelegate : public QStyledItemDelegate {
 		QStyleOptionViewItem opt(option);
 		initStyleOption(&opt, index);
 		const QString primary_text = opt.text;
-		const QString secondary_text = index.data(MainWindow::SecondaryTextRole).toString();
+		const QString secondary_text = index.data(FileListModel::SecondaryTextRole).toString();
 		const QIcon icon = qvariant_cast<QIcon>(index.data(Qt::DecorationRole));
 		const QWidget *widget = option.widget;
 		QStyle *style = widget ? widget->style() : QApplication::style();
@@ -76,46 +80,78 @@ class FileListDelegate : public QStyledItemDelegate {
 };
 } // namespace
 
-QString humanSize(uint64_t bytes) {
-	QString suffix[] = {"B", "KB", "MB", "GB", "TB"};
-	char length = sizeof(suffix) / sizeof(suffix[0]);
-
-	int i = 0;
-	double dblBytes = bytes;
-
-	if (bytes > 1024) {
-		for (i = 0; (bytes / 1024) > 0 && i < length - 1; i++, bytes /= 1024)
-			dblBytes = bytes / 1024.0;
-	}
-
-	QString res = "%1 %2";
-	return res.arg(QString::number(dblBytes), suffix[i]);
-}
-
 MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWindow) {
 	ui->setupUi(this);
+	// Created here so its publish timer lives on the GUI thread.
+	ScanMetrics *metrics = ScanMetrics::instance();
+	fileModel = new FileListModel(this);
+	ui->fileList->setModel(fileModel);
+	searchDebounce = new QTimer(this);
+	searchDebounce->setSingleShot(true);
+	searchDebounce->setInterval(150);
+	connect(searchDebounce, &QTimer::timeout, this, &MainWindow::searchInputChanged);
+	thumbPriorityTimer = new QTimer(this);
+	thumbPriorityTimer->setSingleShot(true);
+	thumbPriorityTimer->setInterval(100);
+	connect(thumbPriorityTimer, &QTimer::timeout, this, &MainWindow::prioritizeVisibleThumbnails);
+	connect(ui->fileList->verticalScrollBar(), &QScrollBar::valueChanged, thumbPriorityTimer,
+		QOverload<>::of(&QTimer::start));
 	applyModernUi();
 	connect(ui->actionAdd_path, &QAction::triggered, this, &MainWindow::AddPath);
 	connect(ui->addPathNoThumb, &QAction::triggered, this, &MainWindow::AddPathFast);
 	connect(ui->actionSave_catalog_file, &QAction::triggered, this, &MainWindow::SaveAs);
 	connect(ui->catalogList, QOverload<int>::of(&QComboBox::currentIndexChanged), this,
 		[this](int) { ShowSelectedCatalog(); });
-	connect(ui->directoryTree, &QTreeWidget::itemSelectionChanged, this, &MainWindow::ShowSelectedDirectory);
-	connect(ui->fileList, &QTableWidget::itemSelectionChanged, this, &MainWindow::ShowThumbnail);
+	connect(ui->fileList->selectionModel(), &QItemSelectionModel::selectionChanged, this, &MainWindow::ShowThumbnail);
 	connect(ui->actionOpen_catalog_file, &QAction::triggered, this, &MainWindow::OpenDB);
 	connect(ui->searchButton, &QPushButton::clicked, this, &MainWindow::SearchFile);
 	connect(ui->clearSearchButton, &QPushButton::clicked, this, &MainWindow::ClearSearch);
 	connect(ui->searchHelpButton, &QPushButton::clicked, this, &MainWindow::ShowSearchHelp);
 	connect(ui->actionQuit, &QAction::triggered, this, &MainWindow::Quit);
 	connect(ui->actionAbout, &QAction::triggered, this, &MainWindow::ShowAbout);
+	connect(ui->actionThumbnail_format, &QAction::triggered, this, &MainWindow::chooseThumbnailFormat);
+	connect(ui->actionCompact_thumbnails, &QAction::triggered, this, &MainWindow::compactThumbnails);
+	metricsPanel = new MetricsPanel(this);
+	addDockWidget(Qt::RightDockWidgetArea, metricsPanel);
+	metricsPanel->hide();
+	ui->menuView->insertAction(ui->actionLog_scan_metrics, metricsPanel->toggleViewAction());
+	connect(metrics, &ScanMetrics::scanFinished, this, &MainWindow::logScanMetrics);
+	QSettings settings;
+	ui->actionLog_scan_metrics->setChecked(settings.value("metrics/log_enabled", false).toBool());
+	connect(ui->actionLog_scan_metrics, &QAction::toggled, this, &MainWindow::toggleMetricsLog);
+	ui->actionHash_files->setChecked(settings.value("scan/hash_files", false).toBool());
+	connect(ui->actionHash_files, &QAction::toggled, this, [](bool enabled) { QSettings().setValue("scan/hash_files", enabled); });
+	connect(ui->actionFind_duplicates, &QAction::triggered, this, &MainWindow::showDuplicates);
+	ThumbnailManager::setFormat(ThumbnailFormat{settings.value("thumbnails/format", "JPEG").toString().toLatin1(),
+						    settings.value("thumbnails/quality", 80).toInt()});
+	compactor = nullptr;
 	this->db_file_path = QDir::home().absolutePath() + "/poorman.sqlite";
 	db = new DBManager(this->db_file_path);
-	thumbQueue = new ThumbnailQueue(this, db_file_path);
-	connect(thumbQueue, &ThumbnailQueue::queueSizeChanged, this, &MainWindow::updateThumbnailQueueStatus);
+	treeModel = new DirectoryTreeModel(db_file_path, this);
+	ui->directoryTree->setModel(treeModel);
+	ui->directoryTree->header()->setStretchLastSection(false);
+	ui->directoryTree->header()->setSectionResizeMode(DirectoryTreeModel::NameColumn, QHeaderView::Stretch);
+	ui->directoryTree->header()->setSectionResizeMode(DirectoryTreeModel::SizeColumn, QHeaderView::ResizeToContents);
+	ui->directoryTree->sortByColumn(DirectoryTreeModel::NameColumn, Qt::AscendingOrder);
+	// Only a different folder reloads the files, not a click on another column of the same one.
+	connect(ui->directoryTree->selectionModel(), &QItemSelectionModel::currentRowChanged, this, &MainWindow::ShowSelectedDirectory);
+	connect(ui->directoryTree, &QTreeView::expanded, treeModel, &DirectoryTreeModel::prefetch);
+	createThumbnailQueue();
 	this->scanner = new Scanner(this, db_file_path);
 	this->scanner->setThumbnailQueue(thumbQueue);
-	connect(this->scanner, SIGNAL(setProgressFilename(QString)), this, SLOT(createPathEntry(QString)));
-	folderIcon = iconProvider.icon(QFileIconProvider::Folder);
+	this->scanner->setThreadCount(QThread::idealThreadCount());
+	connect(this->scanner, &Scanner::progress, this, &MainWindow::showScanProgress);
+	connect(this->scanner, &Scanner::scanFailed, this, &MainWindow::showScanError);
+	connect(this->scanner, &QThread::finished, this, &MainWindow::restartThumbnailRefill);
+	search_generation = 0;
+	search_result_count = 0;
+	searchWorker = new SearchWorker(db_file_path);
+	searchThread = new QThread(this);
+	searchWorker->moveToThread(searchThread);
+	connect(searchThread, &QThread::finished, searchWorker, &QObject::deleteLater);
+	connect(searchWorker, &SearchWorker::resultsReady, this, &MainWindow::appendSearchResults);
+	connect(searchWorker, &SearchWorker::finished, this, &MainWindow::searchFinished);
+	searchThread->start();
 	driveIcon = iconProvider.icon(QFileIconProvider::Drive);
 	ui->catalogList->setContextMenuPolicy(Qt::CustomContextMenu);
 	connect(ui->catalogList, SIGNAL(customContextMenuRequested(QPoint)), this, SLOT(catalogContextMenuRequested(QPoint)));
@@ -124,6 +160,21 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWi
 	current_search_and_join = true;
 	hasPreviewPopupPosition = false;
 	refresh();
+	refillThumbnailQueue();
+	QTimer::singleShot(0, this, &MainWindow::offerScanResume);
+}
+
+/**
+ * @brief Start a thumbnail queue for the current database. Entries a previous
+ * session left pending are fed to it by refillThumbnailQueue().
+ */
+void MainWindow::createThumbnailQueue() {
+	thumbQueue = new ThumbnailQueue(this, db_file_path);
+	connect(thumbQueue, &ThumbnailQueue::queueSizeChanged, this, &MainWindow::updateThumbnailQueueStatus);
+	connect(thumbQueue, &ThumbnailQueue::needsWork, this, &MainWindow::refillThumbnailQueue);
+	connect(thumbQueue, &ThumbnailQueue::thumbnailsStored, this, &MainWindow::updateThumbnailStates);
+	thumb_refill_after = 0;
+	thumb_refill_exhausted = false;
 }
 
 void MainWindow::Quit() { QCoreApplication::quit(); }
@@ -155,6 +206,12 @@ void MainWindow::applyModernUi() {
 	previewToggle = new QCheckBox(tr("Enable preview"), ui->toolbarFrame);
 	previewToggle->setChecked(false);
 	ui->horizontalLayout_5->insertWidget(3, previewToggle);
+	searchInput = new QLineEdit(ui->toolbarFrame);
+	searchInput->setPlaceholderText(tr("Search files"));
+	searchInput->setClearButtonEnabled(true);
+	searchInput->setMinimumWidth(220);
+	ui->horizontalLayout_5->insertWidget(4, searchInput);
+	connect(searchInput, &QLineEdit::textEdited, this, [this](const QString &) { searchDebounce->start(); });
 	connect(previewToggle, &QCheckBox::toggled, this, [this](bool enabled) {
 		if (!enabled) {
 			closePreviewPopup();
@@ -173,6 +230,12 @@ void MainWindow::applyModernUi() {
 	ui->fileList->setIconSize(QSize(18, 18));
 	ui->fileList->verticalHeader()->setVisible(false);
 	ui->fileList->verticalHeader()->setDefaultSectionSize(58);
+	ui->fileList->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+	QHeaderView *headerView = ui->fileList->horizontalHeader();
+	headerView->setSectionResizeMode(FileListModel::NameColumn, QHeaderView::Stretch);
+	headerView->setSectionResizeMode(FileListModel::SizeColumn, QHeaderView::ResizeToContents);
+	headerView->setSectionResizeMode(FileListModel::PreviewColumn, QHeaderView::ResizeToContents);
+	headerView->setSortIndicatorShown(true);
 	ui->fileList->setItemDelegateForColumn(0, new FileListDelegate(ui->fileList));
 	ui->clearSearchButton->setEnabled(false);
 	ui->resultsSummaryLabel->setText(tr("Select a folder or run a search"));
@@ -260,8 +323,8 @@ QLabel#imageLabel {
 }
 
 QListWidget:focus,
-QTreeWidget:focus,
-QTableWidget:focus {
+QTreeView:focus,
+QTableView:focus {
 	border: 1px solid #3B82F6;
 }
 
@@ -302,6 +365,14 @@ QComboBox::drop-down {
 	width: 22px;
 }
 
+QLineEdit {
+	background-color: #0F172A;
+	border: 1px solid #1F2937;
+	border-radius: 8px;
+	padding: 2px 6px;
+	color: #E2E8F0;
+}
+
 QCheckBox {
 	color: #CBD5E1;
 	spacing: 5px;
@@ -314,8 +385,8 @@ QCheckBox::indicator {
 }
 
 QListWidget,
-QTreeWidget,
-QTableWidget {
+QTreeView,
+QTableView {
 	background-color: #0F172A;
 	alternate-background-color: #131C2E;
 	border: 1px solid #1F2937;
@@ -327,8 +398,8 @@ QTableWidget {
 }
 
 QListWidget::item,
-QTreeWidget::item,
-QTableWidget::item {
+QTreeView::item,
+QTableView::item {
 	border-radius: 6px;
 	padding: 2px 3px;
 }
@@ -387,7 +458,7 @@ void MainWindow::catalogContextMenuRequested(QPoint pos) {
 		return;
 	}
 	QMenu *menu = new QMenu(this);
-	QAction *rescanPath = new QAction(tr("Re-scan catalog for new files"), this);
+	QAction *rescanPath = new QAction(tr("Re-scan catalog for changes"), this);
 	QAction *deleteCatalog = new QAction(tr("Re-scan catalog for deleted files"), this);
 	connect(rescanPath, &QAction::triggered, this, &MainWindow::rescanCatalog);
 	connect(deleteCatalog, &QAction::triggered, this, &MainWindow::deleteCatalog);
@@ -406,29 +477,63 @@ void MainWindow::rescanCatalog() {
 		return;
 	}
 	QString selected = ui->catalogList->currentText();
-	QString path = "";
 
 	QSqlQuery catalogs = db->fetchCatalogs();
 	while (catalogs.next()) {
 		if (catalogs.value("name").toString() == selected) {
-			path = catalogs.value("original_path").toString();
-			QDir dir(path);
-			if (!dir.exists()) {
-				QMessageBox box;
-				box.setText(tr("Catalog path is not reachable") + "\n" + path);
-				box.setIcon(QMessageBox::Warning);
-				box.setStandardButtons(QMessageBox::Ok);
-				box.exec();
-				return;
-			}
-			ui->statusbar->showMessage(tr("Scanning: ") + path);
-			this->scanner->setPath(path);
-			this->scanner->setCatalogId(catalogs.value("ids").toInt());
-			this->scanner->start();
+			startRescan(catalogs.value("ids").toInt(), catalogs.value("original_path").toString());
 		}
 	}
 };
 
+/**
+ * @brief Rescan a catalog from its original path. Picks up where an
+ * interrupted scan of it stopped.
+ */
+void MainWindow::startRescan(int catalog_id, QString path) {
+	QDir dir(path);
+	if (!dir.exists()) {
+		QMessageBox box;
+		box.setText(tr("Catalog path is not reachable") + "\n" + path);
+		box.setIcon(QMessageBox::Warning);
+		box.setStandardButtons(QMessageBox::Ok);
+		box.exec();
+		return;
+	}
+	ui->statusbar->showMessage(tr("Scanning: ") + path);
+	this->scanner->setPath(path);
+	this->scanner->setCatalogId(catalog_id);
+	this->scanner->setIncremental(true);
+	this->scanner->setHashing(ui->actionHash_files->isChecked());
+	this->scanner->start();
+}
+
+/**
+ * @brief Offer to finish a scan the last session did not complete.
+ */
+void MainWindow::offerScanResume() {
+	QVector<int> interrupted = db->checkpointedCatalogs();
+	if (interrupted.isEmpty() || this->scanner->running()) {
+		return;
+	}
+	QSqlQuery catalogs = db->fetchCatalogs();
+	while (catalogs.next()) {
+		if (catalogs.value("ids").toInt() != interrupted.first()) {
+			continue;
+		}
+		QString name = catalogs.value("name").toString();
+		QMessageBox box;
+		box.setText(tr("The scan of \"%1\" did not finish.").arg(name));
+		box.setInformativeText(tr("Resume it now? Folders that were already scanned are skipped."));
+		box.setIcon(QMessageBox::Question);
+		box.setStandardButtons(QMessageBox::Yes | QMessageBox::No);
+		if (box.exec() == QMessageBox::Yes) {
+			startRescan(interrupted.first(), catalogs.value("original_path").toString());
+		}
+		return;
+	}
+}
+
 void MainWindow::deleteCatalog() {
 	QString selected = ui->catalogList->currentText();
 	QString path = "";
@@ -462,9 +567,13 @@ void MainWindow::deleteCatalog() {
 		}
 	}
 	if (catalog_id != -1) {
+		int purged = db->purgeTombstones(catalog_id);
 		if (ids.length() > 0) {
 			ui->statusbar->showMessage(tr("Deleting old entries:") + QString::number(ids.length()));
 			db->deleteFiles(catalog_id, ids);
+			db->rollUpDirectoryTotals(catalog_id);
+		}
+		if (ids.length() > 0 || purged > 0) {
 			refresh();
 		}
 	}
@@ -491,7 +600,15 @@ void MainWindow::ShowSearchHelp() {
 	       "• <code>vacation 2023</code> - finds files with both 'vacation' AND '2023'<br>"
 	       "• <code>jpg png</code> - with 'Search any' finds all .jpg OR .png files<br>"
 	       "• <code>report final</code> - finds files containing both words</p>"
+	       "<p><b>Filters:</b><br>"
+	       "• <code>type:video</code>, <code>type:image/png</code>, <code>type:pdf</code> - by file type<br>"
+	       "• <code>ext:jpg,png</code> - by extension<br>"
+	       "• <code>size:&gt;1G</code>, <code>size:10M..100M</code> - by size<br>"
+	       "• <code>modified:2019</code>, <code>modified:2019-03..2020</code> - by modification date<br>"
+	       "• <code>changed:&gt;2024-01-01</code> - by last status change<br>"
+	       "Filters always apply in addition to the keywords, e.g. <code>type:video size:&gt;1G holiday</code>.</p>"
 	       "<p><b>Tips:</b><br>"
+	       "• Typing in the search box searches as you type<br>"
 	       "• Search is case-insensitive<br>"
 	       "• Searches in full file path (directory + filename)<br>"
 	       "• Use specific keywords for better results</p>"));
@@ -501,18 +618,16 @@ void MainWindow::ShowSearchHelp() {
 }
 
 void MainWindow::ShowThumbnail() {
-	int row = ui->fileList->currentRow();
-	if (row < 0) {
+	int row = ui->fileList->currentIndex().row();
+	int id = fileModel->entryId(row);
+	if (id < 0) {
 		closePreviewPopup();
 		return;
 	}
-	QTableWidgetItem *fname_widget = ui->fileList->item(row, 0);
-	if (fname_widget == NULL) {
-		closePreviewPopup();
-		return;
+	int catalog_id = fileModel->catalogId(row);
+	if (fileModel->thumbnailState(row) == ThumbnailPending) {
+		thumbPriorityTimer->start();
 	}
-	int id = fname_widget->data(EntryIdRole).toInt();
-	int catalog_id = fname_widget->data(Qt::UserRole).toInt();
 
 	if (in_search_mode && catalog_id != selected_catalog)
 		SelectCatalogByID(catalog_id);
@@ -557,23 +672,6 @@ void MainWindow::ShowThumbnail() {
 	popup->show();
 }
 
-void MainWindow::buildTree(QTreeWidgetItem *parent, int catalog_id, int parent_id) {
-	if (parent->childCount() > 0) {
-		return;
-	}
-	QSqlQuery dir_tree = db->fetchDirectoryTree(catalog_id, parent_id);
-	while (dir_tree.next()) {
-		QString label = dir_tree.value("name").toString();
-		QTreeWidgetItem *item = new QTreeWidgetItem();
-		item->setData(0, Qt::UserRole, dir_tree.value("ids").toInt());
-		item->setText(0, label);
-		item->setIcon(0, folderIcon);
-		ui->statusbar->showMessage(label);
-		parent->addChild(item);
-	}
-	QApplication::processEvents();
-}
-
 void MainWindow::SearchFile() {
 	QDialog dialog(this);
 	dialog.setWindowTitle(tr("Search files"));
@@ -617,17 +715,24 @@ void MainWindow::SearchFile() {
 		return;
 	}
 
+	if (searchInput) {
+		searchInput->setText(search_input->text().trimmed());
+	}
 	executeSearch(search_input->text().trimmed(), condition_box->currentIndex() == 0);
 }
 
 void MainWindow::ClearSearch() {
+	cancelSearch();
 	closePreviewPopup();
+	if (searchInput) {
+		searchInput->clear();
+	}
 	current_search_text.clear();
 	current_search_and_join = true;
 	in_search_mode = false;
 	ui->clearSearchButton->setEnabled(false);
 	ui->toolbarHintLabel->setText(tr("Browse folders or run a search"));
-	if (ui->directoryTree->currentItem() != NULL) {
+	if (ui->directoryTree->currentIndex().isValid()) {
 		ShowSelectedDirectory();
 	} else {
 		ShowSelectedCatalog();
@@ -635,21 +740,28 @@ void MainWindow::ClearSearch() {
 }
 
 void MainWindow::ShowSelectedDirectory() {
-	if (ui->directoryTree->currentItem() == NULL) {
+	QModelIndex current = ui->directoryTree->currentIndex();
+	if (!current.isValid()) {
 		return;
 	}
-	int dir_id = ui->directoryTree->currentItem()->data(0, Qt::UserRole).toInt();
+	int dir_id = treeModel->directoryId(current);
 
-	buildTree(ui->directoryTree->currentItem(), selected_catalog, dir_id);
+	// Selecting a folder loads its subfolders, so opening it is instant.
+	treeModel->fetchMore(current);
+	cancelSearch();
 	closePreviewPopup();
-	QSqlQuery files = db->fetchFiles(dir_id, selected_catalog);
 	in_search_mode = false;
 	updateBrowseContext();
-	ShowFiles(files, false);
+	prepareFileList(false);
+	search_result_count = 0;
+	ui->resultsTitleLabel->setText(tr("Files"));
+	ui->resultsSummaryLabel->setText(tr("Loading %1...").arg(current.data().toString()));
+	QMetaObject::invokeMethod(searchWorker, "listFolder", Qt::QueuedConnection, Q_ARG(int, search_generation), Q_ARG(int, dir_id),
+				  Q_ARG(int, selected_catalog));
 }
 
 void MainWindow::SelectCatalogByID(int id) {
-	ui->directoryTree->clear();
+	treeModel->clear();
 	selected_catalog = id;
 	for (int i = 0; i < ui->catalogList->count(); i++) {
 		if (ui->catalogList->itemData(i, Qt::UserRole).toInt() == id) {
@@ -664,9 +776,9 @@ void MainWindow::ShowSelectedCatalog() {
 	if (ui->catalogList->currentIndex() >= 0) {
 		catalog_id = ui->catalogList->currentData(Qt::UserRole).toInt();
 	}
-	ui->directoryTree->clear();
-	ui->fileList->clearContents();
-	ui->fileList->setRowCount(0);
+	treeModel->clear();
+	fileModel->clear(false);
+	cancelSearch();
 	closePreviewPopup();
 	in_search_mode = false;
 	selected_catalog = catalog_id;
@@ -676,14 +788,11 @@ void MainWindow::ShowSelectedCatalog() {
 	if (catalog_id < 0) {
 		return;
 	}
-	QTreeWidgetItem *it = new QTreeWidgetItem();
-	it->setText(0, ui->catalogList->currentText().isEmpty() ? "Root" : ui->catalogList->currentText());
-	it->setIcon(0, driveIcon);
-	int root_id = db->getRootId(catalog_id);
-	it->setData(0, Qt::UserRole, root_id);
-	buildTree(it, catalog_id, root_id);
-	ui->directoryTree->addTopLevelItem(it);
-	it->setExpanded(true);
+	treeModel->setCatalog(catalog_id, ui->catalogList->currentText().isEmpty() ? "Root" : ui->catalogList->currentText(),
+			      db->getRootId(catalog_id));
+	QModelIndex root = treeModel->index(0, 0);
+	treeModel->fetchMore(root);
+	ui->directoryTree->expand(root);
 }
 
 void MainWindow::refresh() {
@@ -696,9 +805,9 @@ void MainWindow::refresh() {
 		ui->catalogList->addItem(driveIcon, catalog_name, catalog_id);
 		catalogNameCache.insert(catalog_id, catalog_name);
 	}
-	ui->directoryTree->clear();
-	ui->fileList->clear();
-	ui->fileList->setRowCount(0);
+	fileModel->setCatalogNames(catalogNameCache);
+	treeModel->clear();
+	fileModel->clear(false);
 	closePreviewPopup();
 	ui->resultsSummaryLabel->setText(ui->catalogList->count() > 0 ? tr("Pick a folder or search across a catalog")
 								   : tr("Add a catalog to start browsing"));
@@ -719,6 +828,9 @@ void MainWindow::SaveAs() {
 	QFile::copy(db_file_path, filename);
 	this->db_file_path = filename;
 	db = new DBManager(this->db_file_path);
+	cancelSearch();
+	QMetaObject::invokeMethod(searchWorker, "setDatabase", Qt::QueuedConnection, Q_ARG(QString, db_file_path));
+	treeModel->setDatabase(db_file_path);
 	this->refresh();
 }
 
@@ -727,97 +839,35 @@ void MainWindow::OpenDB() {
 	if (filename.isEmpty()) {
 		return;
 	}
+	this->scanner->stop();
+	thumbQueue->stop();
+	this->scanner->wait();
 	delete db;
 	this->db_file_path = filename;
 	db = new DBManager(this->db_file_path);
-	fileIconCache.clear();
 	delete thumbQueue;
-	thumbQueue = new ThumbnailQueue(this, db_file_path);
-	connect(thumbQueue, &ThumbnailQueue::queueSizeChanged, this, &MainWindow::updateThumbnailQueueStatus);
+	createThumbnailQueue();
 	delete this->scanner;
 	this->scanner = new Scanner(this, db_file_path);
 	this->scanner->setThumbnailQueue(thumbQueue);
-	connect(this->scanner, SIGNAL(setProgressFilename(QString)), this, SLOT(createPathEntry(QString)));
+	this->scanner->setThreadCount(QThread::idealThreadCount());
+	connect(this->scanner, &Scanner::progress, this, &MainWindow::showScanProgress);
+	connect(this->scanner, &Scanner::scanFailed, this, &MainWindow::showScanError);
+	connect(this->scanner, &QThread::finished, this, &MainWindow::restartThumbnailRefill);
+	cancelSearch();
+	QMetaObject::invokeMethod(searchWorker, "setDatabase", Qt::QueuedConnection, Q_ARG(QString, db_file_path));
+	treeModel->setDatabase(db_file_path);
 	this->refresh();
+	refillThumbnailQueue();
+	offerScanResume();
 }
 
-bool FileSizeColumn::operator<(const QTableWidgetItem &other) const {
-	if (text() == "")
-		return data(Qt::UserRole).toInt() > other.data(Qt::UserRole).toInt();
-	else
-		return data(Qt::UserRole).toInt() < other.data(Qt::UserRole).toInt();
-};
-
-void MainWindow::ShowFiles(QSqlQuery data, bool fullname) {
-	ui->fileList->clearContents();
-	ui->fileList->setColumnCount(3);
-	ui->fileList->setRowCount(0);
-
+/**
+ * @brief Empty the file list. Sorting stays off until the rows are in.
+ */
+void MainWindow::prepareFileList(bool fullname) {
 	ui->fileList->setSortingEnabled(false);
-	QHeaderView *headerView = ui->fileList->horizontalHeader();
-	headerView->setSectionResizeMode(0, QHeaderView::Stretch);
-	headerView->setSectionResizeMode(1, QHeaderView::ResizeToContents);
-	headerView->setSectionResizeMode(2, QHeaderView::ResizeToContents);
-	headerView->sortIndicatorOrder();
-	headerView->setSortIndicatorShown(true);
-
-	QTableWidgetItem *h_filename = new QTableWidgetItem();
-	h_filename->setText("File");
-	ui->fileList->setHorizontalHeaderItem(0, h_filename);
-
-	QTableWidgetItem *h_filesize = new FileSizeColumn();
-	h_filesize->setText("Size");
-	h_filesize->setData(Qt::UserRole, -1);
-	ui->fileList->setHorizontalHeaderItem(1, h_filesize);
-
-	QTableWidgetItem *h_thumbnail = new QTableWidgetItem();
-	h_thumbnail->setText("Preview");
-	ui->fileList->setHorizontalHeaderItem(2, h_thumbnail);
-
-	int row = 0;
-	while (data.next()) {
-		ui->fileList->setRowCount(row + 1);
-		QTableWidgetItem *fname = new QTableWidgetItem();
-		QString full_path = data.value("full_path").toString();
-		QFileInfo inf(full_path);
-		QString catalog_name = catalogNameCache.value(data.value("catalog_id").toInt());
-		QString secondary_text;
-
-		if (fullname) {
-			secondary_text = catalog_name.isEmpty()
-					     ? QDir::toNativeSeparators(full_path)
-					     : tr("%1  •  %2").arg(catalog_name, QDir::toNativeSeparators(full_path));
-		} else {
-			QString type_label = inf.suffix().isEmpty() ? tr("File") : inf.suffix().toUpper();
-			secondary_text = tr("%1  •  %2").arg(type_label, QDir::toNativeSeparators(inf.absolutePath()));
-		}
-
-		fname->setIcon(getCachedFileIcon(full_path));
-		fname->setData(Qt::UserRole, data.value("catalog_id"));
-		fname->setData(EntryIdRole, data.value("ids").toInt());
-		fname->setData(SecondaryTextRole, secondary_text);
-		fname->setText(inf.fileName());
-		fname->setToolTip(QDir::toNativeSeparators(full_path));
-
-		ui->fileList->setItem(row, 0, fname);
-
-		QTableWidgetItem *fsize = new FileSizeColumn();
-		fsize->setData(Qt::UserRole, data.value("filesize").toInt());
-		fsize->setText(humanSize(data.value("filesize").toInt()));
-		fsize->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
-		ui->fileList->setItem(row, 1, fsize);
-
-		QTableWidgetItem *fthumb = new QTableWidgetItem();
-		const bool has_thumbnail = data.value("has_thumbnail").toBool();
-		fthumb->setText(has_thumbnail ? tr("Ready") : tr("None"));
-		fthumb->setForeground(has_thumbnail ? QColor("#86EFAC") : QColor("#64748B"));
-		fthumb->setTextAlignment(Qt::AlignCenter);
-		ui->fileList->setItem(row, 2, fthumb);
-
-		row++;
-	}
-	ui->fileList->setSortingEnabled(true);
-	updateResultsSummary(row);
+	fileModel->clear(fullname);
 }
 
 void MainWindow::AddPath() {
@@ -846,6 +896,8 @@ void MainWindow::AddPath() {
 	if (ok && !catalog_name.isEmpty()) {
 		this->scanner->setCatalogId(-1);
 		this->scanner->setCatalogName(catalog_name);
+		this->scanner->setIncremental(false);
+		this->scanner->setHashing(ui->actionHash_files->isChecked());
 		this->scanner->withThumbs(true);
 		this->scanner->start();
 	} else {
@@ -879,6 +931,8 @@ void MainWindow::AddPathFast() {
 	if (ok && !catalog_name.isEmpty()) {
 		this->scanner->setCatalogId(-1);
 		this->scanner->setCatalogName(catalog_name);
+		this->scanner->setIncremental(false);
+		this->scanner->setHashing(ui->actionHash_files->isChecked());
 		this->scanner->withThumbs(false);
 		this->scanner->start();
 	} else {
@@ -888,22 +942,206 @@ void MainWindow::AddPathFast() {
 
 MainWindow::~MainWindow() {
 	closePreviewPopup();
+	cancelSearch();
+	searchThread->quit();
+	searchThread->wait();
+	if (compactor) {
+		compactor->stop();
+		compactor->wait();
+	}
+	// A scan waiting on a full thumbnail queue is released by stop().
+	scanner->stop();
+	thumbQueue->stop();
+	scanner->wait();
 	delete thumbQueue;
 	delete db;
 	delete ui;
 	delete scanner;
 }
 
-void MainWindow::createPathEntry(QString string) {
-	if (string.endsWith("/.") || string.endsWith("/..")) {
+void MainWindow::chooseThumbnailFormat() {
+	ThumbnailFormat current = ThumbnailManager::format();
+	QStringList formats = ThumbnailManager::availableFormats();
+	bool ok = false;
+	QString format = QInputDialog::getItem(this, tr("Thumbnail format"), tr("Store new thumbnails as:"), formats,
+					       qMax(0, formats.indexOf(QString::fromLatin1(current.format))), false, &ok);
+	if (!ok) {
 		return;
 	}
-	ui->statusbar->showMessage(string);
-	if (string == "finished") {
+	int quality = current.quality;
+	if (format != "PNG") {
+		quality = QInputDialog::getInt(this, tr("Thumbnail format"), tr("Quality (1-100):"), current.quality, 1, 100, 5, &ok);
+		if (!ok) {
+			return;
+		}
+	}
+	ThumbnailManager::setFormat(ThumbnailFormat{format.toLatin1(), quality});
+	QSettings settings;
+	settings.setValue("thumbnails/format", format);
+	settings.setValue("thumbnails/quality", quality);
+	ui->statusbar->showMessage(tr("New thumbnails are stored as %1. Use \"Compact thumbnails\" to convert existing ones.").arg(format));
+}
+
+void MainWindow::showDuplicates() {
+	DuplicatesDialog dialog(db, catalogNameCache, this);
+	dialog.exec();
+}
+
+/**
+ * @brief Turn the scan metrics log on, asking for its file the first time.
+ */
+void MainWindow::toggleMetricsLog(bool enabled) {
+	QSettings settings;
+	if (enabled && settings.value("metrics/log_file").toString().isEmpty()) {
+		QString path = QFileDialog::getSaveFileName(this, tr("Scan metrics log"),
+							    QDir::home().absolutePath() + "/poorman-metrics.jsonl",
+							    tr("JSON lines (*.jsonl);;All files (*)"));
+		if (path.isEmpty()) {
+			QSignalBlocker blocker(ui->actionLog_scan_metrics);
+			ui->actionLog_scan_metrics->setChecked(false);
+			return;
+		}
+		settings.setValue("metrics/log_file", path);
+	}
+	settings.setValue("metrics/log_enabled", enabled);
+}
+
+/**
+ * @brief Append the totals of a finished scan to the metrics log, if enabled.
+ */
+void MainWindow::logScanMetrics(ScanMetricsSnapshot snapshot) {
+	metricsPanel->showSnapshot(snapshot);
+	if (!ui->actionLog_scan_metrics->isChecked()) {
+		return;
+	}
+	QString path = QSettings().value("metrics/log_file").toString();
+	if (!ScanMetrics::appendToLog(path, snapshot)) {
+		ui->statusbar->showMessage(tr("Unable to write the scan metrics to %1").arg(path));
+	}
+}
+
+/**
+ * @brief Re-encode stored thumbnails with the current format in the background.
+ */
+void MainWindow::compactThumbnails() {
+	if (this->scanner->running() || (compactor && compactor->isRunning())) {
+		QMessageBox box;
+		box.setText(tr("Wait for the running scan or compaction to finish"));
+		box.setIcon(QMessageBox::Warning);
+		box.setStandardButtons(QMessageBox::Ok);
+		box.exec();
+		return;
+	}
+	delete compactor;
+	compactor = new ThumbnailCompactor(this, db_file_path);
+	connect(compactor, &ThumbnailCompactor::progress, this, [this](int checked, int converted) {
+		ui->statusbar->showMessage(tr("Compacting thumbnails: %1 checked, %2 re-encoded").arg(checked).arg(converted));
+	});
+	connect(compactor, &ThumbnailCompactor::compacted, this, [this](int converted, qint64 saved_bytes) {
+		ui->statusbar->showMessage(tr("Re-encoded %1 thumbnails, saved %2").arg(converted).arg(humanSize(saved_bytes)));
+	});
+	ui->statusbar->showMessage(tr("Compacting thumbnails..."));
+	compactor->start();
+}
+
+/**
+ * @brief Show a scan progress snapshot; the last one reloads the catalog.
+ */
+void MainWindow::showScanProgress(ScanProgress progress) {
+	if (progress.finished) {
+		ui->statusbar->showMessage(tr("Scan finished: %1 files, %2 directories, %3 in %4 s")
+					       .arg(progress.files)
+					       .arg(progress.dirs)
+					       .arg(humanSize(progress.bytes))
+					       .arg(progress.elapsed_ms / 1000.0, 0, 'f', 1));
 		delete db;
 		db = new DBManager(this->db_file_path);
 		refresh();
+		return;
+	}
+	if (progress.hashing) {
+		ui->statusbar->showMessage(tr("Hashing files to find duplicates: %1 files read").arg(progress.hashed));
+		return;
 	}
+	ui->statusbar->showMessage(tr("%1 files, %2 directories, %3, %4 files/s - %5")
+				       .arg(progress.files)
+				       .arg(progress.dirs)
+				       .arg(humanSize(progress.bytes))
+				       .arg(progress.files_per_sec, 0, 'f', 0)
+				       .arg(progress.directory));
+}
+
+/**
+ * @brief Top up the thumbnail queue with entries pending in the database.
+ *
+ * Pages through the pending entries once; a running scan feeds the queue
+ * itself and starts another pass when it is done. Catalogs on drives that
+ * are not plugged in are left for later.
+ */
+void MainWindow::refillThumbnailQueue() {
+	if (this->scanner->running() || thumb_refill_exhausted) {
+		return;
+	}
+	int spare = thumbQueue->spareCapacity();
+	QVector<ThumbnailRequest> requests;
+	QVector<QPair<int, QString>> pending_rows = db->pendingThumbnails(thumb_refill_after, qMax(0, spare), db->reachableCatalogs());
+	for (const QPair<int, QString> &pending : pending_rows) {
+		requests.append(ThumbnailRequest{pending.first, pending.second, 256});
+	}
+	int taken = thumbQueue->offer(requests);
+	if (taken > 0) {
+		thumb_refill_after = requests[taken - 1].entry_id;
+	}
+	thumb_refill_exhausted = taken == requests.size() && requests.size() < spare;
+}
+
+/**
+ * @brief Start another pass over the pending entries, e.g. once a scan
+ * stopped feeding the queue.
+ */
+void MainWindow::restartThumbnailRefill() {
+	thumb_refill_after = 0;
+	thumb_refill_exhausted = false;
+	refillThumbnailQueue();
+}
+
+/**
+ * @brief Move pending thumbnails of the rows on screen ahead of the
+ * backlog, the current row first.
+ */
+void MainWindow::prioritizeVisibleThumbnails() {
+	QVector<ThumbnailRequest> requests;
+	int current = ui->fileList->currentIndex().row();
+	if (fileModel->thumbnailState(current) == ThumbnailPending) {
+		requests.append(ThumbnailRequest{fileModel->entryId(current), fileModel->fullPath(current), 256});
+	}
+	int first = ui->fileList->rowAt(0);
+	if (first >= 0) {
+		int last = ui->fileList->rowAt(ui->fileList->viewport()->height() - 1);
+		if (last < 0) {
+			last = fileModel->rowCount() - 1;
+		}
+		for (int row = first; row <= last; row++) {
+			if (row != current && fileModel->thumbnailState(row) == ThumbnailPending) {
+				requests.append(ThumbnailRequest{fileModel->entryId(row), fileModel->fullPath(row), 256});
+			}
+		}
+	}
+	thumbQueue->prioritize(requests);
+}
+
+void MainWindow::updateThumbnailStates(QVector<int> ready, QVector<int> failed) {
+	fileModel->setThumbnailStates(ready, ThumbnailReady);
+	fileModel->setThumbnailStates(failed, ThumbnailFailed);
+}
+
+void MainWindow::showScanError(QString message) {
+	QMessageBox box;
+	box.setText(message);
+	box.setStandardButtons(QMessageBox::Ok);
+	box.setIcon(QMessageBox::Warning);
+	box.setWindowTitle(tr("Warning"));
+	box.exec();
 }
 
 void MainWindow::updateThumbnailQueueStatus(int size) {
@@ -914,17 +1152,6 @@ void MainWindow::updateThumbnailQueueStatus(int size) {
 	}
 }
 
-QIcon MainWindow::getCachedFileIcon(const QString &full_path) {
-	auto cached_icon = fileIconCache.constFind(full_path);
-	if (cached_icon != fileIconCache.constEnd()) {
-		return cached_icon.value();
-	}
-
-	QIcon icon = iconProvider.icon(QFileInfo(full_path));
-	fileIconCache.insert(full_path, icon);
-	return icon;
-}
-
 void MainWindow::closePreviewPopup() {
 	if (previewPopup) {
 		previewPopupPosition = previewPopup->pos();
@@ -945,15 +1172,56 @@ void MainWindow::executeSearch(const QString &text, bool and_join) {
 	ui->clearSearchButton->setEnabled(true);
 	ui->toolbarHintLabel->setText(tr("Catalog"));
 	closePreviewPopup();
-	QSqlQuery files = db->searchFiles(text, and_join, selected_catalog >= 0 ? selected_catalog : -1);
 	in_search_mode = true;
-	ShowFiles(files, true);
+	cancelSearch();
+	prepareFileList(true);
+	search_result_count = 0;
+	ui->resultsTitleLabel->setText(tr("Search results"));
+	ui->resultsSummaryLabel->setText(tr("Searching for \"%1\"...").arg(text));
+	int cat_id = selected_catalog >= 0 ? selected_catalog : -1;
+	QMetaObject::invokeMethod(searchWorker, "search", Qt::QueuedConnection, Q_ARG(int, search_generation), Q_ARG(QString, text),
+				  Q_ARG(bool, and_join), Q_ARG(int, cat_id));
+}
+
+/**
+ * @brief Stop the search in flight, if any. Late pages are dropped by generation.
+ */
+void MainWindow::cancelSearch() {
+	search_generation++;
+	searchWorker->cancel(search_generation);
+}
+
+void MainWindow::searchInputChanged() {
+	if (searchInput) {
+		executeSearch(searchInput->text().trimmed(), current_search_and_join);
+	}
+}
+
+/**
+ * @brief A page of search results or folder files; both share the generation.
+ */
+void MainWindow::appendSearchResults(int generation, QVector<FileRow> rows) {
+	if (generation != search_generation) {
+		return;
+	}
+	fileModel->appendRows(rows);
+	search_result_count += rows.size();
+	updateResultsSummary(search_result_count);
+}
+
+void MainWindow::searchFinished(int generation, int total) {
+	if (generation != search_generation) {
+		return;
+	}
+	ui->fileList->setSortingEnabled(true);
+	updateResultsSummary(total);
+	thumbPriorityTimer->start();
 }
 
 void MainWindow::updateBrowseContext() {
-	QTreeWidgetItem *folder_item = ui->directoryTree->currentItem();
-	if (folder_item != NULL) {
-		ui->foldersSubtitleLabel->setText(tr("Browsing %1").arg(folder_item->text(0)));
+	QModelIndex folder = ui->directoryTree->currentIndex();
+	if (folder.isValid()) {
+		ui->foldersSubtitleLabel->setText(tr("Browsing %1").arg(folder.data().toString()));
 	} else if (ui->catalogList->currentIndex() >= 0) {
 		ui->foldersSubtitleLabel->setText(tr("Catalog: %1").arg(ui->catalogList->currentText()));
 	} else {
@@ -976,8 +1244,8 @@ void MainWindow::updateResultsSummary(int row_count) {
 	}
 
 	ui->resultsTitleLabel->setText(tr("Files"));
-	QTreeWidgetItem *folder_item = ui->directoryTree->currentItem();
-	QString scope = folder_item != NULL ? folder_item->text(0) : tr("the selected folder");
+	QModelIndex folder = ui->directoryTree->currentIndex();
+	QString scope = folder.isValid() ? folder.data().toString() : tr("the selected folder");
 	ui->resultsSummaryLabel->setText(tr("%1 file(s) in %2").arg(row_count).arg(scope));
 }
 
@@ -2,14 +2,23 @@
 #define MAINWINDOW_H
 
 #include "dbmanager.h"
+#include "directorytreemodel.h"
+#include "filelistmodel.h"
+#include "metricspanel.h"
 #include "scanner.h"
+#include "searchworker.h"
+#include "thumbnailcompactor.h"
 #include "thumbnailqueue.h"
 #include <QCheckBox>
+#include <QDialog>
 #include <QFileIconProvider>
 #include <QHash>
+#include <QLineEdit>
 #include <QMainWindow>
 #include <QPointer>
 #include <QPoint>
+#include <QThread>
+#include <QTimer>
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -24,12 +33,6 @@ class MainWindow : public QMainWindow {
 	MainWindow(QWidget *parent = nullptr);
 	~MainWindow();
 	void refresh();
-	void ShowFiles(QSqlQuery data, bool fullname);
-
-	enum FileListDataRole {
-		SecondaryTextRole = Qt::UserRole + 1,
-		EntryIdRole = Qt::UserRole + 2
-	};
 
       private slots:
 	void AddPath();
@@ -45,12 +48,26 @@ class MainWindow : public QMainWindow {
 	void Quit();
 	void ShowAbout();
 	void ShowSearchHelp();
-	void createPathEntry(QString string);
+	void showScanProgress(ScanProgress progress);
 	void catalogContextMenuRequested(QPoint);
 	void rescanCatalog();
 	void deleteCatalog();
 	void updateThumbnailQueueStatus(int size);
 	void toggleCatalogPanel(bool expanded);
+	void searchInputChanged();
+	void appendSearchResults(int generation, QVector<FileRow> rows);
+	void searchFinished(int generation, int total);
+	void chooseThumbnailFormat();
+	void compactThumbnails();
+	void offerScanResume();
+	void showScanError(QString message);
+	void refillThumbnailQueue();
+	void restartThumbnailRefill();
+	void prioritizeVisibleThumbnails();
+	void updateThumbnailStates(QVector<int> ready, QVector<int> failed);
+	void toggleMetricsLog(bool enabled);
+	void showDuplicates();
+	void logScanMetrics(ScanMetricsSnapshot snapshot);
 
       private:
 	QString db_file_path;
@@ -59,10 +76,21 @@ class MainWindow : public QMainWindow {
 	Scanner *scanner;
 	DBManager *db;
 	ThumbnailQueue *thumbQueue;
-	QIcon folderIcon;
+	ThumbnailCompactor *compactor;
+	FileListModel *fileModel;
+	DirectoryTreeModel *treeModel;
+	QThread *searchThread;
+	SearchWorker *searchWorker;
+	QTimer *searchDebounce;
+	QTimer *thumbPriorityTimer;
+	MetricsPanel *metricsPanel;
+	QPointer<QLineEdit> searchInput;
+	int search_generation;
+	int search_result_count;
+	int thumb_refill_after;
+	bool thumb_refill_exhausted;
 	QIcon driveIcon;
 	QFileIconProvider iconProvider;
-	QHash<QString, QIcon> fileIconCache;
 	QHash<int, QString> catalogNameCache;
 	QPointer<QCheckBox> previewToggle;
 	QPointer<QDialog> previewPopup;
@@ -74,17 +102,14 @@ class MainWindow : public QMainWindow {
 	Ui::MainWindow *ui;
 
 	void applyModernUi();
-	void buildTree(QTreeWidgetItem *parent, int catalog_id, int parent_id);
-	QIcon getCachedFileIcon(const QString &full_path);
+	void createThumbnailQueue();
+	void startRescan(int catalog_id, QString path);
 	void closePreviewPopup();
 	void executeSearch(const QString &text, bool and_join);
+	void cancelSearch();
+	void prepareFileList(bool fullname);
 	void updateBrowseContext();
 	void updateResultsSummary(int row_count);
 };
 
-class FileSizeColumn : public QTableWidgetItem {
-      public:
-	bool operator<(const QTableWidgetItem &other) const;
-};
-
 #endif // MAINWINDOW_H
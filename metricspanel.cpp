@@ -0,0 +1,81 @@
+#include "metricspanel.h"
+#include <QHeaderView>
+#include <QTreeWidget>
+
+namespace {
+QString timingText(const MetricTiming &timing) {
+	if (timing.count == 0) {
+		return QObject::tr("-");
+	}
+	return QObject::tr("%1 ms avg, %2 ms max, %3 calls")
+	    .arg(timing.averageMs(), 0, 'f', 2)
+	    .arg(timing.max_ns / 1e6, 0, 'f', 1)
+	    .arg(timing.count);
+}
+} // namespace
+
+MetricsPanel::MetricsPanel(QWidget *parent) : QDockWidget(tr("Scan metrics"), parent) {
+	setObjectName("metricsPanel");
+	tree = new QTreeWidget(this);
+	tree->setColumnCount(2);
+	tree->setHeaderLabels(QStringList() << tr("Metric") << tr("Value"));
+	tree->header()->setSectionResizeMode(0, QHeaderView::ResizeToContents);
+	tree->setRootIsDecorated(true);
+	tree->setSelectionMode(QAbstractItemView::NoSelection);
+	setWidget(tree);
+
+	state_row = addRow(tr("Scan"));
+	files_row = addRow(tr("Files"));
+	dirs_row = addRow(tr("Directories"));
+	file_rate_row = addRow(tr("Files/s"));
+	dir_rate_row = addRow(tr("Directories/s"));
+	listing_row = addRow(tr("Directory listing"));
+	commit_row = addRow(tr("Database commit"));
+	walker_queue_row = addRow(tr("Walker queue"));
+	thumbnail_queue_row = addRow(tr("Thumbnail queue"));
+	thumbnails_row = addRow(tr("Thumbnails"));
+	for (int i = 0; i < ThumbnailSourceCount; i++) {
+		source_rows.append(addRow(ScanMetrics::sourceName(ThumbnailSource(i)), thumbnails_row));
+	}
+	thumbnails_row->setExpanded(true);
+
+	ScanMetrics *metrics = ScanMetrics::instance();
+	connect(metrics, &ScanMetrics::updated, this, &MetricsPanel::showSnapshot);
+	connect(this, &QDockWidget::visibilityChanged, metrics, [metrics](bool visible) { metrics->setPublishing(visible); });
+}
+
+QTreeWidgetItem *MetricsPanel::addRow(const QString &name, QTreeWidgetItem *parent) {
+	QTreeWidgetItem *item = parent ? new QTreeWidgetItem(parent) : new QTreeWidgetItem(tree);
+	item->setText(0, name);
+	return item;
+}
+
+void MetricsPanel::showSnapshot(ScanMetricsSnapshot snapshot) {
+	QString elapsed = QString::number(snapshot.elapsed_ms / 1000.0, 'f', 1);
+	state_row->setText(1, snapshot.scanning ? tr("running, %1 s").arg(elapsed)
+						: snapshot.elapsed_ms > 0 ? tr("finished in %1 s").arg(elapsed) : tr("idle"));
+	files_row->setText(1, QString::number(snapshot.files));
+	dirs_row->setText(1, tr("%1 (%2 unchanged)").arg(snapshot.dirs).arg(snapshot.dirs_unchanged));
+	file_rate_row->setText(1, QString::number(snapshot.files_per_sec, 'f', 0));
+	dir_rate_row->setText(1, QString::number(snapshot.dirs_per_sec, 'f', 0));
+	listing_row->setText(1, timingText(snapshot.listing));
+	commit_row->setText(1, timingText(snapshot.commit));
+	walker_queue_row->setText(1, QString::number(snapshot.walker_queue));
+	thumbnail_queue_row->setText(1, QString::number(snapshot.thumbnail_queue));
+
+	qint64 made = 0;
+	qint64 failed = 0;
+	for (int i = 0; i < ThumbnailSourceCount; i++) {
+		const MetricTiming &timing = snapshot.thumbnail[i];
+		qint64 source_failed = snapshot.thumbnail_failed[i];
+		made += timing.count - source_failed;
+		failed += source_failed;
+		source_rows[i]->setText(1, timing.count == 0 ? tr("-")
+							     : tr("%1 ok, %2 failed, %3 ms avg")
+								   .arg(timing.count - source_failed)
+								   .arg(source_failed)
+								   .arg(timing.averageMs(), 0, 'f', 1));
+	}
+	// A file that fails in one source can still succeed in the next.
+	thumbnails_row->setText(1, tr("%1 ok, %2 failed attempts").arg(made).arg(failed));
+}
@@ -0,0 +1,42 @@
+#ifndef METRICSPANEL_H
+#define METRICSPANEL_H
+
+#include "scanmetrics.h"
+#include <QDockWidget>
+#include <QVector>
+
+class QTreeWidget;
+class QTreeWidgetItem;
+
+/**
+ * Dockable view of ScanMetrics.
+ *
+ * The metrics are only published while the panel is visible, so a hidden
+ * panel costs nothing.
+ */
+class MetricsPanel : public QDockWidget {
+	Q_OBJECT
+      public:
+	MetricsPanel(QWidget *parent = nullptr);
+
+      public slots:
+	void showSnapshot(ScanMetricsSnapshot snapshot);
+
+      private:
+	QTreeWidgetItem *addRow(const QString &name, QTreeWidgetItem *parent = nullptr);
+
+	QTreeWidget *tree;
+	QTreeWidgetItem *state_row;
+	QTreeWidgetItem *files_row;
+	QTreeWidgetItem *dirs_row;
+	QTreeWidgetItem *file_rate_row;
+	QTreeWidgetItem *dir_rate_row;
+	QTreeWidgetItem *listing_row;
+	QTreeWidgetItem *commit_row;
+	QTreeWidgetItem *walker_queue_row;
+	QTreeWidgetItem *thumbnail_queue_row;
+	QTreeWidgetItem *thumbnails_row;
+	QVector<QTreeWidgetItem *> source_rows;
+};
+
+#endif // METRICSPANEL_H
@@ -0,0 +1,48 @@
+#include "mimeclassifier.h"
+#include <QList>
+#include <QMimeType>
+
+namespace {
+// Suffixes remembered at most; the rest are looked up every time.
+const int max_cached_suffixes = 4096;
+} // namespace
+
+MimeClassifier::MimeClassifier() {}
+
+MimeClassifier &MimeClassifier::instance() {
+	static MimeClassifier classifier;
+	return classifier;
+}
+
+/**
+ * @brief MIME type name of the file at path. Safe to call from any thread.
+ */
+QString MimeClassifier::mimeTypeForFile(const QString &path) {
+	int slash = path.lastIndexOf('/');
+	int dot = path.lastIndexOf('.');
+	if (dot <= slash + 1 || dot == path.size() - 1) {
+		// No suffix, or a hidden file without one: globs on the whole
+		// name like "Makefile" still apply before the content is read.
+		return sniff(path);
+	}
+	QString suffix = path.mid(dot + 1).toLower();
+	{
+		QReadLocker locker(&lock);
+		auto cached = by_suffix.constFind(suffix);
+		if (cached != by_suffix.constEnd()) {
+			return cached.value().isEmpty() ? sniff(path) : cached.value();
+		}
+	}
+
+	QList<QMimeType> types = mime_db.mimeTypesForFileName("file." + suffix);
+	QString mime = types.size() == 1 ? types.first().name() : QString();
+	{
+		QWriteLocker locker(&lock);
+		if (by_suffix.size() < max_cached_suffixes) {
+			by_suffix.insert(suffix, mime);
+		}
+	}
+	return mime.isEmpty() ? sniff(path) : mime;
+}
+
+QString MimeClassifier::sniff(const QString &path) { return mime_db.mimeTypeForFile(path).name(); }
@@ -0,0 +1,31 @@
+#ifndef MIMECLASSIFIER_H
+#define MIMECLASSIFIER_H
+
+#include <QHash>
+#include <QMimeDatabase>
+#include <QReadWriteLock>
+#include <QString>
+
+/**
+ * Process wide, extension-first MIME type detection.
+ *
+ * The type of a file is looked up by its lowercase suffix, and the result
+ * for each suffix is cached. Files are only opened and sniffed when their
+ * suffix is unknown or maps to more than one type, e.g. ".ts".
+ */
+class MimeClassifier {
+      public:
+	static MimeClassifier &instance();
+	QString mimeTypeForFile(const QString &path);
+
+      private:
+	MimeClassifier();
+	QString sniff(const QString &path);
+
+	QMimeDatabase mime_db;
+	// suffix -> MIME type, empty when files with that suffix are sniffed.
+	QHash<QString, QString> by_suffix;
+	QReadWriteLock lock;
+};
+
+#endif // MIMECLASSIFIER_H
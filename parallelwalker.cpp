@@ -0,0 +1,200 @@
+#include "parallelwalker.h"
+#include "scanmetrics.h"
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QMutexLocker>
+
+WalkWorker::WalkWorker(ParallelWalker *walker, int index) : walker(walker), index(index) { setAutoDelete(true); }
+
+void WalkWorker::run() { walker->runWorker(index); }
+
+ParallelWalker::ParallelWalker(int thread_count, int queue_capacity) : pending(0), stopped(0) {
+	if (thread_count < 1)
+		thread_count = 1;
+	capacity = queue_capacity > 0 ? queue_capacity : 1;
+	for (int i = 0; i < thread_count; i++) {
+		queues.append(new WorkQueue());
+	}
+	pool.setMaxThreadCount(thread_count);
+}
+
+ParallelWalker::~ParallelWalker() {
+	stop();
+	pool.waitForDone();
+	qDeleteAll(queues);
+}
+
+/**
+ * @brief Directories of a previous scan, must be set before start().
+ * @param dir_mtimes directory path -> mtime stored when it was last listed
+ * @param known_subdirs directory path -> its subdirectories in the catalog
+ */
+void ParallelWalker::setSnapshot(const QHash<QString, qint64> &dir_mtimes, const QHash<QString, QList<QString>> &known_subdirs) {
+	this->dir_mtimes = dir_mtimes;
+	this->known_subdirs = known_subdirs;
+}
+
+/**
+ * @brief Subtrees to skip entirely, must be set before start().
+ *
+ * They are still reported with a batch flagged resumed, so the consumer
+ * sees every directory it waits for.
+ */
+void ParallelWalker::setCompleted(const QSet<QString> &completed) { this->completed = completed; }
+
+void ParallelWalker::start(const QString &root) {
+	pending.storeRelease(1);
+	{
+		QMutexLocker locker(&queues[0]->mutex);
+		queues[0]->dirs.append(root);
+	}
+	for (int i = 0; i < queues.size(); i++) {
+		pool.start(new WalkWorker(this, i));
+	}
+}
+
+/**
+ * @brief Take the next directory listing.
+ * @param batch
+ * @return false once the whole tree has been delivered or the walk was stopped
+ */
+bool ParallelWalker::next(ScanBatch &batch) {
+	QMutexLocker locker(&out_mutex);
+	while (output.isEmpty()) {
+		// Batches are queued before their directory is marked done, so an
+		// empty queue with nothing pending means the walk is complete.
+		if (stopped.loadAcquire() || pending.loadAcquire() == 0) {
+			return false;
+		}
+		out_not_empty.wait(&out_mutex, 50);
+	}
+	batch = output.dequeue();
+	out_not_full.wakeOne();
+	return true;
+}
+
+void ParallelWalker::stop() {
+	stopped.storeRelease(1);
+	{
+		QMutexLocker locker(&idle_mutex);
+		work_available.wakeAll();
+	}
+	QMutexLocker locker(&out_mutex);
+	out_not_empty.wakeAll();
+	out_not_full.wakeAll();
+}
+
+int ParallelWalker::queueDepth() {
+	QMutexLocker locker(&out_mutex);
+	return output.size();
+}
+
+void ParallelWalker::runWorker(int index) {
+	QString dir;
+	while (!stopped.loadAcquire()) {
+		if (!takeWork(index, dir)) {
+			QMutexLocker locker(&idle_mutex);
+			if (pending.loadAcquire() == 0) {
+				break;
+			}
+			work_available.wait(&idle_mutex, 20);
+			continue;
+		}
+
+		ScanBatch batch;
+		batch.directory = dir;
+		batch.resumed = completed.contains(dir);
+		QElapsedTimer timer;
+		timer.start();
+		batch.mtime = batch.resumed ? 0 : DirEnumerator::directoryMtime(dir);
+		batch.unchanged = false;
+		QList<QString> subdirs;
+		auto known = dir_mtimes.constFind(dir);
+		if (batch.resumed) {
+			// Not even stat'ed; the interrupted scan recorded it all.
+		} else if (known != dir_mtimes.constEnd() && batch.mtime > 0 && known.value() == batch.mtime) {
+			batch.unchanged = true;
+			// The catalog does not know which directories were symlinks,
+			// and those are never descended into.
+			for (const QString &subdir : known_subdirs.value(dir)) {
+				if (!QFileInfo(subdir).isSymLink()) {
+					subdirs.append(subdir);
+				}
+			}
+		} else {
+			DirEnumerator::list(dir, batch.entries);
+			for (const ScanEntry &entry : batch.entries) {
+				if (entry.is_dir && !entry.is_symlink) {
+					subdirs.append(entry.full_path);
+				}
+			}
+		}
+		batch.subdir_count = subdirs.size();
+		if (!batch.resumed) {
+			ScanMetrics::instance()->recordListing(timer.nsecsElapsed());
+		}
+		// The listing has to reach the consumer before any subdirectory can
+		// be picked up, otherwise a child could be written before its parent.
+		pushBatch(batch);
+		pushWork(index, subdirs);
+		finishDirectory();
+	}
+}
+
+bool ParallelWalker::takeWork(int index, QString &dir) {
+	{
+		WorkQueue *own = queues[index];
+		QMutexLocker locker(&own->mutex);
+		if (!own->dirs.isEmpty()) {
+			dir = own->dirs.takeLast();
+			return true;
+		}
+	}
+	for (int i = 1; i < queues.size(); i++) {
+		WorkQueue *victim = queues[(index + i) % queues.size()];
+		QMutexLocker locker(&victim->mutex);
+		if (!victim->dirs.isEmpty()) {
+			dir = victim->dirs.takeFirst();
+			return true;
+		}
+	}
+	return false;
+}
+
+void ParallelWalker::pushWork(int index, const QList<QString> &dirs) {
+	if (dirs.isEmpty()) {
+		return;
+	}
+	pending.fetchAndAddOrdered(dirs.size());
+	{
+		WorkQueue *own = queues[index];
+		QMutexLocker locker(&own->mutex);
+		own->dirs.append(dirs);
+	}
+	QMutexLocker locker(&idle_mutex);
+	work_available.wakeAll();
+}
+
+void ParallelWalker::pushBatch(ScanBatch &batch) {
+	QMutexLocker locker(&out_mutex);
+	while (output.size() >= capacity && !stopped.loadAcquire()) {
+		out_not_full.wait(&out_mutex);
+	}
+	if (stopped.loadAcquire()) {
+		return;
+	}
+	output.enqueue(batch);
+	out_not_empty.wakeOne();
+}
+
+void ParallelWalker::finishDirectory() {
+	if (pending.fetchAndAddOrdered(-1) != 1) {
+		return;
+	}
+	{
+		QMutexLocker locker(&idle_mutex);
+		work_available.wakeAll();
+	}
+	QMutexLocker locker(&out_mutex);
+	out_not_empty.wakeAll();
+}
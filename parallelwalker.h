@@ -0,0 +1,79 @@
+#ifndef PARALLELWALKER_H
+#define PARALLELWALKER_H
+
+#include "direnumerator.h"
+#include <QAtomicInt>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QQueue>
+#include <QSet>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QVector>
+#include <QWaitCondition>
+
+/**
+ * Walks a directory tree with a pool of workers.
+ *
+ * Every worker owns a deque of directories to list. It takes work from the
+ * back of its own deque and steals from the front of the others when it
+ * runs dry. Listings are handed to a single consumer through a bounded
+ * queue, in an order where a directory's batch always comes before the
+ * batches of its subdirectories.
+ *
+ * With a snapshot of the catalog, directories whose mtime still matches
+ * are not listed again; their known subdirectories are visited instead.
+ * Subtrees marked completed are not entered at all.
+ */
+class ParallelWalker {
+      public:
+	ParallelWalker(int thread_count, int queue_capacity);
+	~ParallelWalker();
+	void setSnapshot(const QHash<QString, qint64> &dir_mtimes, const QHash<QString, QList<QString>> &known_subdirs);
+	void setCompleted(const QSet<QString> &completed);
+	void start(const QString &root);
+	bool next(ScanBatch &batch);
+	void stop();
+	int queueDepth();
+
+      private:
+	friend class WalkWorker;
+	struct WorkQueue {
+		QMutex mutex;
+		QList<QString> dirs;
+	};
+
+	QVector<WorkQueue *> queues;
+	QThreadPool pool;
+	QAtomicInt pending;
+	QAtomicInt stopped;
+	QMutex idle_mutex;
+	QWaitCondition work_available;
+	QMutex out_mutex;
+	QWaitCondition out_not_empty;
+	QWaitCondition out_not_full;
+	QQueue<ScanBatch> output;
+	int capacity;
+	QHash<QString, qint64> dir_mtimes;
+	QHash<QString, QList<QString>> known_subdirs;
+	QSet<QString> completed;
+
+	void runWorker(int index);
+	bool takeWork(int index, QString &dir);
+	void pushWork(int index, const QList<QString> &dirs);
+	void pushBatch(ScanBatch &batch);
+	void finishDirectory();
+};
+
+class WalkWorker : public QRunnable {
+      public:
+	WalkWorker(ParallelWalker *walker, int index);
+	void run() override;
+
+      private:
+	ParallelWalker *walker;
+	int index;
+};
+
+#endif // PARALLELWALKER_H
@@ -0,0 +1,226 @@
+#include "scanmetrics.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <QTimer>
+
+namespace {
+QJsonObject timingJson(const MetricTiming &timing) {
+	QJsonObject object;
+	object.insert("count", double(timing.count));
+	object.insert("avg_ms", timing.averageMs());
+	object.insert("max_ms", timing.max_ns / 1e6);
+	return object;
+}
+} // namespace
+
+ScanMetrics::Timing::Timing() : count(0), total_ns(0), max_ns(0) {}
+
+void ScanMetrics::Timing::record(qint64 ns) {
+	count.fetchAndAddRelaxed(1);
+	total_ns.fetchAndAddRelaxed(ns);
+	qint64 seen = max_ns.loadRelaxed();
+	while (ns > seen && !max_ns.testAndSetRelaxed(seen, ns, seen)) {
+	}
+}
+
+MetricTiming ScanMetrics::Timing::read() const {
+	return MetricTiming{count.loadRelaxed(), total_ns.loadRelaxed(), max_ns.loadRelaxed()};
+}
+
+void ScanMetrics::Timing::reset() {
+	count.storeRelaxed(0);
+	total_ns.storeRelaxed(0);
+	max_ns.storeRelaxed(0);
+}
+
+ScanMetrics::ScanMetrics()
+    : files(0), dirs(0), dirs_unchanged(0), walker_queue(0), thumbnail_queue(0), scanning(0), scan_ms(0), last_ms(0), last_files(0),
+      last_dirs(0), timer(new QTimer(this)) {
+	for (int i = 0; i < ThumbnailSourceCount; i++) {
+		thumbnail_failed[i].storeRelaxed(0);
+	}
+	qRegisterMetaType<ScanMetricsSnapshot>("ScanMetricsSnapshot");
+	connect(timer, &QTimer::timeout, this, &ScanMetrics::publish);
+}
+
+ScanMetrics *ScanMetrics::instance() {
+	static ScanMetrics *metrics = new ScanMetrics();
+	return metrics;
+}
+
+QString ScanMetrics::sourceName(ThumbnailSource source) {
+	switch (source) {
+	case SourceQt:
+		return "Qt";
+	case SourceVideo:
+		return "Video";
+	case SourcePdf:
+		return "PDF";
+	case SourceExternal:
+		return "External";
+	case SourceFallback:
+		return "Fallback";
+	default:
+		return QString();
+	}
+}
+
+/**
+ * @brief Reset the counters and start the scan clock.
+ */
+void ScanMetrics::beginScan() {
+	files.storeRelaxed(0);
+	dirs.storeRelaxed(0);
+	dirs_unchanged.storeRelaxed(0);
+	walker_queue.storeRelaxed(0);
+	listing.reset();
+	commit.reset();
+	for (int i = 0; i < ThumbnailSourceCount; i++) {
+		thumbnail[i].reset();
+		thumbnail_failed[i].storeRelaxed(0);
+	}
+	{
+		QMutexLocker locker(&clock_mutex);
+		clock.start();
+		last_ms = 0;
+		last_files = 0;
+		last_dirs = 0;
+	}
+	scan_ms.storeRelaxed(0);
+	scanning.storeRelease(1);
+}
+
+/**
+ * @brief Stop the scan clock and emit scanFinished with the totals.
+ */
+void ScanMetrics::finishScan() {
+	{
+		QMutexLocker locker(&clock_mutex);
+		scan_ms.storeRelaxed(clock.isValid() ? clock.elapsed() : 0);
+	}
+	scanning.storeRelease(0);
+	walker_queue.storeRelaxed(0);
+	emit scanFinished(snapshot());
+}
+
+void ScanMetrics::addDirectory(int files, bool unchanged) {
+	this->files.fetchAndAddRelaxed(files);
+	dirs.fetchAndAddRelaxed(1);
+	if (unchanged) {
+		dirs_unchanged.fetchAndAddRelaxed(1);
+	}
+}
+
+void ScanMetrics::recordListing(qint64 ns) { listing.record(ns); }
+
+void ScanMetrics::recordCommit(qint64 ns) { commit.record(ns); }
+
+void ScanMetrics::recordThumbnail(ThumbnailSource source, qint64 ns, bool ok) {
+	thumbnail[source].record(ns);
+	if (!ok) {
+		thumbnail_failed[source].fetchAndAddRelaxed(1);
+	}
+}
+
+void ScanMetrics::setWalkerQueue(int depth) { walker_queue.storeRelaxed(depth); }
+
+void ScanMetrics::setThumbnailQueue(int depth) { thumbnail_queue.storeRelaxed(depth); }
+
+/**
+ * @brief Current values, with rates averaged over the whole scan.
+ */
+ScanMetricsSnapshot ScanMetrics::snapshot() {
+	ScanMetricsSnapshot snap = ScanMetricsSnapshot();
+	snap.scanning = scanning.loadAcquire() != 0;
+	{
+		QMutexLocker locker(&clock_mutex);
+		snap.elapsed_ms = snap.scanning && clock.isValid() ? clock.elapsed() : scan_ms.loadRelaxed();
+	}
+	snap.files = files.loadRelaxed();
+	snap.dirs = dirs.loadRelaxed();
+	snap.dirs_unchanged = dirs_unchanged.loadRelaxed();
+	double seconds = snap.elapsed_ms / 1000.0;
+	snap.files_per_sec = seconds > 0 ? snap.files / seconds : 0;
+	snap.dirs_per_sec = seconds > 0 ? snap.dirs / seconds : 0;
+	snap.listing = listing.read();
+	snap.commit = commit.read();
+	snap.walker_queue = walker_queue.loadRelaxed();
+	snap.thumbnail_queue = thumbnail_queue.loadRelaxed();
+	for (int i = 0; i < ThumbnailSourceCount; i++) {
+		snap.thumbnail[i] = thumbnail[i].read();
+		snap.thumbnail_failed[i] = thumbnail_failed[i].loadRelaxed();
+	}
+	return snap;
+}
+
+/**
+ * @brief Start or stop emitting updated() every interval_ms. Publishing
+ * costs nothing on the hot paths, it only reads the counters.
+ */
+void ScanMetrics::setPublishing(bool enabled, int interval_ms) {
+	if (enabled) {
+		timer->start(interval_ms);
+		publish();
+	} else {
+		timer->stop();
+	}
+}
+
+/**
+ * @brief Emit updated() with the rates of the last interval while a scan runs.
+ */
+void ScanMetrics::publish() {
+	ScanMetricsSnapshot snap = snapshot();
+	if (snap.scanning) {
+		QMutexLocker locker(&clock_mutex);
+		qint64 span = snap.elapsed_ms - last_ms;
+		if (span > 0 && snap.elapsed_ms >= last_ms) {
+			snap.files_per_sec = (snap.files - last_files) * 1000.0 / span;
+			snap.dirs_per_sec = (snap.dirs - last_dirs) * 1000.0 / span;
+			last_ms = snap.elapsed_ms;
+			last_files = snap.files;
+			last_dirs = snap.dirs;
+		}
+	}
+	emit updated(snap);
+}
+
+/**
+ * @brief Append snapshot as one JSON line to path.
+ */
+bool ScanMetrics::appendToLog(const QString &path, const ScanMetricsSnapshot &snapshot) {
+	QJsonObject thumbnails;
+	for (int i = 0; i < ThumbnailSourceCount; i++) {
+		if (snapshot.thumbnail[i].count == 0) {
+			continue;
+		}
+		QJsonObject source = timingJson(snapshot.thumbnail[i]);
+		source.insert("failed", double(snapshot.thumbnail_failed[i]));
+		thumbnails.insert(sourceName(ThumbnailSource(i)).toLower(), source);
+	}
+	QJsonObject line;
+	line.insert("time", QDateTime::currentDateTime().toString(Qt::ISODate));
+	line.insert("elapsed_ms", double(snapshot.elapsed_ms));
+	line.insert("files", double(snapshot.files));
+	line.insert("dirs", double(snapshot.dirs));
+	line.insert("dirs_unchanged", double(snapshot.dirs_unchanged));
+	line.insert("files_per_sec", snapshot.files_per_sec);
+	line.insert("dirs_per_sec", snapshot.dirs_per_sec);
+	line.insert("listing", timingJson(snapshot.listing));
+	line.insert("commit", timingJson(snapshot.commit));
+	line.insert("thumbnail_queue", snapshot.thumbnail_queue);
+	line.insert("thumbnails", thumbnails);
+
+	QFile file(path);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+		qDebug() << "Cannot open metrics log" << path << file.errorString();
+		return false;
+	}
+	file.write(QJsonDocument(line).toJson(QJsonDocument::Compact));
+	file.write("\n");
+	return true;
+}
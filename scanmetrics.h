@@ -0,0 +1,117 @@
+#ifndef SCANMETRICS_H
+#define SCANMETRICS_H
+
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QMetaType>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+
+class QTimer;
+
+// Where a thumbnail attempt went.
+enum ThumbnailSource { SourceQt = 0, SourceVideo, SourcePdf, SourceExternal, SourceFallback, ThumbnailSourceCount };
+
+struct MetricTiming {
+	qint64 count;
+	qint64 total_ns;
+	qint64 max_ns;
+
+	double averageMs() const { return count > 0 ? total_ns / 1e6 / count : 0; }
+};
+
+struct ScanMetricsSnapshot {
+	bool scanning;
+	qint64 elapsed_ms;
+	qint64 files;
+	qint64 dirs;
+	qint64 dirs_unchanged;
+	// Over the last publish interval, or the whole scan once it finished.
+	double files_per_sec;
+	double dirs_per_sec;
+	// Reading one directory: its mtime, the listing and the stat calls.
+	MetricTiming listing;
+	MetricTiming commit;
+	int walker_queue;
+	int thumbnail_queue;
+	MetricTiming thumbnail[ThumbnailSourceCount];
+	qint64 thumbnail_failed[ThumbnailSourceCount];
+};
+
+/**
+ * Process-wide counters and timers for scans and thumbnails.
+ *
+ * The record functions are called on the hot paths of the scanner, the
+ * walker threads and the thumbnail workers and only touch atomics. On the
+ * thread that created the instance, snapshots are published through
+ * updated() while a listener asked for them with setPublishing().
+ *
+ * Call instance() once from the GUI or main thread before any scan starts.
+ */
+class ScanMetrics : public QObject {
+	Q_OBJECT
+      public:
+	static ScanMetrics *instance();
+	static QString sourceName(ThumbnailSource source);
+
+	void beginScan();
+	void finishScan();
+	void addDirectory(int files, bool unchanged);
+	void recordListing(qint64 ns);
+	void recordCommit(qint64 ns);
+	void recordThumbnail(ThumbnailSource source, qint64 ns, bool ok);
+	void setWalkerQueue(int depth);
+	void setThumbnailQueue(int depth);
+
+	ScanMetricsSnapshot snapshot();
+	void setPublishing(bool enabled, int interval_ms = 500);
+	static bool appendToLog(const QString &path, const ScanMetricsSnapshot &snapshot);
+
+      signals:
+	void updated(ScanMetricsSnapshot snapshot);
+	void scanFinished(ScanMetricsSnapshot snapshot);
+
+      private slots:
+	void publish();
+
+      private:
+	class Timing {
+	      public:
+		Timing();
+		void record(qint64 ns);
+		MetricTiming read() const;
+		void reset();
+
+	      private:
+		QAtomicInteger<qint64> count;
+		QAtomicInteger<qint64> total_ns;
+		QAtomicInteger<qint64> max_ns;
+	};
+
+	ScanMetrics();
+
+	QAtomicInteger<qint64> files;
+	QAtomicInteger<qint64> dirs;
+	QAtomicInteger<qint64> dirs_unchanged;
+	QAtomicInt walker_queue;
+	QAtomicInt thumbnail_queue;
+	QAtomicInt scanning;
+	QAtomicInteger<qint64> scan_ms;
+	Timing listing;
+	Timing commit;
+	Timing thumbnail[ThumbnailSourceCount];
+	QAtomicInteger<qint64> thumbnail_failed[ThumbnailSourceCount];
+
+	// Guards the scan clock and the values of the previous publish.
+	QMutex clock_mutex;
+	QElapsedTimer clock;
+	qint64 last_ms;
+	qint64 last_files;
+	qint64 last_dirs;
+	QTimer *timer;
+};
+
+Q_DECLARE_METATYPE(ScanMetricsSnapshot)
+
+#endif // SCANMETRICS_H
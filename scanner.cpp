@@ -1,11 +1,14 @@
 #include "scanner.h"
+#include "contenthasher.h"
 #include "dbmanager.h"
+#include "parallelwalker.h"
+#include "scanmetrics.h"
 #include "thumbnailqueue.h"
 #include <QDebug>
-#include <QDirIterator>
+#include <QDir>
+#include <QElapsedTimer>
 #include <QFileInfo>
-#include <QMimeDatabase>
-#include <QtWidgets>
+#include <QMap>
 
 Scanner::Scanner(QObject *parent, QString db_path) : QThread(parent) {
 	this->f_running = false;
@@ -14,6 +17,13 @@ Scanner::Scanner(QObject *parent, QString db_path) : QThread(parent) {
 	catalog_id = -1;
 	with_thumbs = true;
 	thumb_queue = nullptr;
+	batch_size = 1000;
+	flush_interval = 500;
+	thread_count = 1;
+	incremental = false;
+	with_hashes = false;
+	progress_interval = 100;
+	qRegisterMetaType<ScanProgress>("ScanProgress");
 }
 
 void Scanner::setCatalogName(QString cname) { this->catalog_name = cname; }
@@ -28,14 +38,74 @@ void Scanner::withThumbs(bool state) { with_thumbs = state; }
 
 void Scanner::setThumbnailQueue(ThumbnailQueue *queue) { thumb_queue = queue; }
 
-bool Scanner::needsThumbnail(const QFileInfo &info) {
-	if (info.isDir())
-		return false;
+/**
+ * @brief Configure how the scanner groups rows into transactions.
+ * @param batch_size rows per commit
+ * @param flush_interval_ms commit at least this often, 0 to only commit on size
+ */
+void Scanner::setBatchOptions(int batch_size, int flush_interval_ms) {
+	this->batch_size = batch_size;
+	this->flush_interval = flush_interval_ms;
+}
+
+/**
+ * @brief Number of threads listing directories. 1 keeps the walk serial.
+ */
+void Scanner::setThreadCount(int count) { thread_count = count > 0 ? count : 1; }
 
-	QMimeDatabase mimeDb;
-	QMimeType mimeType = mimeDb.mimeTypeForFile(info.filePath());
-	QString mime = mimeType.name();
+/**
+ * @brief Skip directories whose mtime matches the catalog on rescans.
+ *
+ * Files changed in place inside such a directory are not noticed, a full
+ * rescan still compares every file.
+ */
+void Scanner::setIncremental(bool state) { incremental = state; }
 
+/**
+ * @brief Minimum time between two progress() snapshots during a scan.
+ */
+void Scanner::setProgressInterval(int interval_ms) { progress_interval = qMax(0, interval_ms); }
+
+/**
+ * @brief Hash files that may have duplicates once the walk completed.
+ */
+void Scanner::setHashing(bool state) { with_hashes = state; }
+
+/**
+ * @brief Hand thumbnail requests of the last batch over to the queue.
+ * @param committed false if the batch was rolled back
+ *
+ * Requests are held back until their rows are committed so workers
+ * never update an entry that is not visible to their connection yet.
+ * Blocks while the thumbnail queue is full, which keeps the scan from
+ * running arbitrarily far ahead of thumbnail generation.
+ */
+void Scanner::flushThumbnails(bool committed) {
+	if (committed && thumb_queue) {
+		for (const ThumbnailRequest &req : pending_thumbs) {
+			thumb_queue->addRequest(req);
+		}
+	}
+	pending_thumbs.clear();
+}
+
+/**
+ * @brief Fill in the type and extension of a file about to be written.
+ */
+void Scanner::classify(DirEntry &entry, const ScanEntry &item, MimeClassifier &classifier) {
+	if (item.is_dir) {
+		return;
+	}
+	entry.mime_type = classifier.mimeTypeForFile(item.full_path);
+	int dot = item.name.lastIndexOf('.');
+	entry.extension = dot > 0 ? item.name.mid(dot + 1).toLower() : QString();
+}
+
+bool Scanner::needsThumbnail(const DirEntry &entry) {
+	if (entry.is_directory || !with_thumbs || !thumb_queue)
+		return false;
+
+	const QString &mime = entry.mime_type;
 	return mime.startsWith("image/") || mime.startsWith("video/") || mime == "application/pdf";
 }
 
@@ -43,12 +113,7 @@ void Scanner::run() {
 	this->f_running = true;
 	QDir dir(this->scan_path);
 	if (!dir.exists()) {
-		QMessageBox box;
-		box.setText(tr("Directory does not exist"));
-		box.setStandardButtons(QMessageBox::Ok);
-		box.setIcon(QMessageBox::Warning);
-		box.setWindowTitle("Warning");
-		box.exec();
+		emit scanFailed(tr("Directory does not exist") + "\n" + this->scan_path);
 		this->stop();
 		return;
 	}
@@ -68,42 +133,437 @@ void Scanner::processDirectory(QString path) {
 	}
 	if (current_catalog_id == -1) {
 		qDebug() << "ERROR: catalog_id is still -1 after createCatalog!";
+		emit scanFailed(tr("Unable to create the catalog"));
 		delete db;
-		emit setProgressFilename("finished");
 		return;
 	}
-	QDir dir(path);
-	QDirIterator it(dir, QDirIterator::Subdirectories);
-	while (it.hasNext()) {
-		QString filename = it.next();
-		QFileInfo info(filename);
-
-		QString basename = info.fileName();
-		if (basename == "." || basename == "..") {
+	// Everything the catalog already holds, so rescans compare against the
+	// disk and parents resolve from memory. New directories are added as we go.
+	known = db->fetchIndex(current_catalog_id);
+	// Subtrees an interrupted run of this scan got through are skipped.
+	QSet<QString> checkpoints = db->fetchCheckpoints(current_catalog_id);
+	if (!checkpoints.isEmpty()) {
+		qDebug() << "Resuming scan," << checkpoints.size() << "subtrees already done";
+	}
+	// Directories that are not listed again still count towards progress.
+	bool count_stored = incremental || !checkpoints.isEmpty();
+	QHash<QString, qint64> dir_mtimes;
+	QHash<QString, QList<QString>> known_subdirs;
+	for (auto it = known.constBegin(); it != known.constEnd(); ++it) {
+		if (count_stored && !it.value().is_deleted) {
+			DirTotals &listing = stored_listings[parentPath(it.key())];
+			if (it.value().is_directory) {
+				listing.dirs++;
+			} else {
+				listing.files++;
+				listing.size += it.value().filesize;
+			}
+		}
+		if (!it.value().is_directory) {
 			continue;
 		}
+		path_ids.insert(it.key(), it.value().id);
+		if (incremental && !it.value().is_deleted) {
+			known_subdirs[parentPath(it.key())].append(it.key());
+			if (it.value().mtime > 0) {
+				dir_mtimes.insert(it.key(), it.value().mtime);
+			}
+		}
+	}
+	if (!checkpoints.isEmpty()) {
+		sumStoredSubtrees();
+	}
 
-		if (info.isDir()) {
-			emit setProgressFilename(filename);
+	// The walker lists directories on its own threads while this thread
+	// stays the only writer. Batches arrive parent first, so the parent of
+	// every entry is already in path_ids when it is written.
+	ScanMetrics *metrics = ScanMetrics::instance();
+	metrics->beginScan();
+	ParallelWalker walker(thread_count, 64);
+	walker.setSnapshot(dir_mtimes, known_subdirs);
+	walker.setCompleted(checkpoints);
+	walker.start(QDir::cleanPath(QDir(path).absolutePath()));
+	db->beginBatch(batch_size, flush_interval);
+	bool completed = true;
+	// Snapshots are coalesced: every batch updates the counts, only one
+	// per progress_interval is queued for the GUI thread.
+	ScanProgress state = ScanProgress();
+	QElapsedTimer scan_clock;
+	scan_clock.start();
+	qint64 last_report = -progress_interval;
+	ScanBatch batch;
+	while (walker.next(batch)) {
+		if (!f_running) {
+			walker.stop();
+			completed = false;
+			break;
 		}
-		if (db->dirEntryExists(info.absoluteFilePath())) {
-			continue;
+		storeBatch(db, batch, current_catalog_id);
+		DirTotals counted = batchTotals(batch);
+		state.directory = batch.directory;
+		state.dirs += 1 + counted.dirs;
+		state.files += counted.files;
+		state.bytes += counted.size;
+		metrics->addDirectory(counted.files, batch.unchanged);
+		qint64 now = scan_clock.elapsed();
+		if (now - last_report >= progress_interval) {
+			last_report = now;
+			state.elapsed_ms = now;
+			state.files_per_sec = now > 0 ? state.files * 1000.0 / now : 0;
+			emit progress(state);
 		}
+		metrics->setWalkerQueue(walker.queueDepth());
+	}
+	flushThumbnails(db->endBatch());
+	if (completed) {
+		tombstoneMissing(db, current_catalog_id);
+	}
+	// Rows written by an earlier, interrupted run never had their changes
+	// counted, and a full rescan is where stale totals get repaired.
+	if (completed && (!checkpoints.isEmpty() || (!incremental && !known.isEmpty()))) {
+		dir_deltas.clear();
+		db->rollUpDirectoryTotals(current_catalog_id);
+	} else {
+		storeDirectoryTotals(db);
+	}
+	// Only once the totals are stored: until then a crash leaves the
+	// checkpoints behind, and the next run rolls the totals up again.
+	if (completed) {
+		db->clearCheckpoints(current_catalog_id);
+	}
+	metrics->finishScan();
+	qint64 walk_ms = scan_clock.elapsed();
+	state.files_per_sec = walk_ms > 0 ? state.files * 1000.0 / walk_ms : 0;
+	if (completed && with_hashes && f_running) {
+		// Size groups span every catalog, so hashing waits for the whole
+		// tree to be written.
+		state.hashing = true;
+		ContentHasher hasher(db, qMax(2, thread_count));
+		hasher.run([&](qint64 hashed) {
+			state.hashed = hashed;
+			qint64 now = scan_clock.elapsed();
+			if (now - last_report >= progress_interval) {
+				last_report = now;
+				state.elapsed_ms = now;
+				emit progress(state);
+			}
+			return f_running;
+		});
+		state.hashing = false;
+	}
+	known.clear();
+	path_ids.clear();
+	seen.clear();
+	unchanged_dirs.clear();
+	resumed_dirs.clear();
+	open_subtrees.clear();
+	dir_deltas.clear();
+	stored_listings.clear();
+	stored_subtrees.clear();
+	delete db;
+	state.elapsed_ms = scan_clock.elapsed();
+	state.finished = true;
+	emit progress(state);
+}
 
-		int parent = db->findParent(current_catalog_id, info.absolutePath());
-		int entry_id = db->createDirEntry(info.completeBaseName(), info.absolutePath(), info.absoluteFilePath(), info.size(),
-						  QByteArray(), info.isDir(), parent, current_catalog_id);
+/**
+ * @brief Write one directory listing.
+ *
+ * New paths are inserted, known ones are only touched when size, mtime or
+ * identity changed or they come back from a tombstone. The directory's own
+ * mtime is stored last, so an interrupted scan never marks it as done.
+ */
+void Scanner::storeBatch(DBManager *db, const ScanBatch &batch, int catalog_id) {
+	if (batch.resumed) {
+		resumed_dirs.insert(batch.directory);
+		checkpointSubtree(db, batch, catalog_id);
+		return;
+	}
+	if (batch.unchanged) {
+		unchanged_dirs.insert(batch.directory);
+		checkpointSubtree(db, batch, catalog_id);
+		return;
+	}
+	int dir_id = path_ids.value(batch.directory, -1);
+	MimeClassifier &classifier = MimeClassifier::instance();
+	for (const ScanEntry &item : batch.entries) {
+		DirEntry entry;
+		entry.name = DirEnumerator::completeBaseName(item.name);
+		entry.directory = batch.directory;
+		entry.full_path = item.full_path;
+		entry.filesize = item.size;
+		entry.is_directory = item.is_dir;
+		entry.parent_id = dir_id;
+		entry.catalog_id = catalog_id;
+		// A directory's mtime is only recorded once it has been listed.
+		entry.mtime = item.is_dir ? 0 : item.mtime;
+		entry.inode = item.inode;
+		entry.device = item.device;
+		entry.ctime = item.ctime;
+		entry.thumbnail_state = ThumbnailNone;
 
-		if (entry_id != -1 && with_thumbs && thumb_queue && needsThumbnail(info)) {
+		// Entries are marked pending before they are queued, so work cut
+		// short by a restart can be picked up from the database again.
+		bool queue_thumbnail = false;
+		auto existing = known.constFind(item.full_path);
+		if (existing == known.constEnd()) {
+			classify(entry, item, classifier);
+			queue_thumbnail = needsThumbnail(entry);
+			entry.thumbnail_state = queue_thumbnail ? ThumbnailPending : ThumbnailNone;
+			entry.id = db->batchDirEntry(entry);
+			if (entry.id != -1 && entry.is_directory) {
+				path_ids.insert(entry.full_path, entry.id);
+			}
+			if (entry.id != -1) {
+				countEntry(batch.directory, entry.is_directory, entry.filesize, 1);
+			}
+			queue_thumbnail = queue_thumbnail && entry.id != -1;
+		} else {
+			const IndexedEntry &row = existing.value();
+			entry.id = row.id;
+			seen.insert(row.id);
+			if (entry.is_directory) {
+				path_ids.insert(entry.full_path, entry.id);
+			}
+			// Rows from before change detection carry zeros; fill them in
+			// instead of treating every file as modified.
+			bool identity_known = row.inode != 0 || row.device != 0;
+			bool moved = (identity_known && (row.inode != entry.inode || row.device != entry.device)) ||
+				     row.is_directory != entry.is_directory;
+			bool content_changed =
+			    !entry.is_directory && (row.filesize != entry.filesize || (row.mtime != 0 && row.mtime != entry.mtime));
+			bool backfill = (!identity_known && (entry.inode != 0 || entry.device != 0)) ||
+					(!entry.is_directory && ((row.mtime == 0 && entry.mtime != 0) || !row.has_facets));
+			if (row.is_deleted || moved || content_changed || backfill) {
+				classify(entry, item, classifier);
+				queue_thumbnail = (content_changed || moved) && needsThumbnail(entry);
+				entry.thumbnail_state = queue_thumbnail ? ThumbnailPending : ThumbnailNone;
+				if (db->batchUpdateDirEntry(entry, content_changed || moved)) {
+					if (!row.is_deleted) {
+						countEntry(batch.directory, row.is_directory, row.filesize, -1);
+					}
+					countEntry(batch.directory, entry.is_directory, entry.filesize, 1);
+				}
+			}
+		}
+
+		if (queue_thumbnail) {
 			ThumbnailRequest req;
-			req.entry_id = entry_id;
-			req.file_path = info.absoluteFilePath();
+			req.entry_id = entry.id;
+			req.file_path = item.full_path;
 			req.max_size = 256;
-			thumb_queue->addRequest(req);
+			req.mime_type = entry.mime_type;
+			pending_thumbs.append(req);
+		}
+		if (db->batchDue()) {
+			flushThumbnails(db->commitBatch());
 		}
 	}
-	delete db;
-	emit setProgressFilename("finished");
+	if (dir_id != -1 && batch.mtime > 0) {
+		db->batchDirectoryMtime(dir_id, batch.mtime);
+	}
+	checkpointSubtree(db, batch, catalog_id);
+}
+
+/**
+ * @brief Checkpoint every subtree the batch completes.
+ *
+ * A directory is done once its own listing and those of all its
+ * subdirectories are written. Batches arrive parent first, so each open
+ * directory only counts the subdirectories it still waits for. The
+ * checkpoint goes into the same transaction as the rows it covers.
+ */
+void Scanner::checkpointSubtree(DBManager *db, const ScanBatch &batch, int catalog_id) {
+	if (batch.subdir_count > 0) {
+		open_subtrees.insert(batch.directory, batch.subdir_count);
+		return;
+	}
+	QString dir = batch.directory;
+	for (;;) {
+		QString parent = parentPath(dir);
+		db->batchCheckpoint(catalog_id, dir, parent);
+		auto open = open_subtrees.find(parent);
+		if (parent == dir || open == open_subtrees.end() || --open.value() > 0) {
+			break;
+		}
+		open_subtrees.erase(open);
+		dir = parent;
+	}
+}
+
+/**
+ * @brief Whether path lies below a subtree skipped because an interrupted
+ * run already finished it.
+ */
+bool Scanner::inResumedSubtree(const QString &path) const {
+	QString dir = parentPath(path);
+	while (!dir.isEmpty()) {
+		if (resumed_dirs.contains(dir)) {
+			return true;
+		}
+		QString parent = parentPath(dir);
+		if (parent == dir) {
+			break;
+		}
+		dir = parent;
+	}
+	return false;
+}
+
+/**
+ * @brief Tombstone rows that were not found on disk.
+ *
+ * Children of directories skipped as unchanged were not looked at, and
+ * neither were subtrees finished by an interrupted run, so they are kept
+ * as they are.
+ */
+void Scanner::tombstoneMissing(DBManager *db, int catalog_id) {
+	QVector<int> missing;
+	for (auto it = known.constBegin(); it != known.constEnd(); ++it) {
+		if (it.value().is_deleted || seen.contains(it.value().id)) {
+			continue;
+		}
+		if (unchanged_dirs.contains(parentPath(it.key()))) {
+			continue;
+		}
+		if (!resumed_dirs.isEmpty() && inResumedSubtree(it.key())) {
+			continue;
+		}
+		missing.append(it.value().id);
+		countEntry(parentPath(it.key()), it.value().is_directory, it.value().filesize, -1);
+	}
+	if (!missing.isEmpty()) {
+		qDebug() << "Tombstoning" << missing.size() << "vanished entries";
+		db->tombstoneFiles(catalog_id, missing);
+	}
+}
+
+/**
+ * @brief Count an entry in or out of the totals of its directory.
+ * @param sign 1 when the entry appears, -1 when it goes away
+ */
+void Scanner::countEntry(const QString &directory, bool is_directory, qint64 size, int sign) {
+	DirTotals &delta = dir_deltas[directory];
+	if (is_directory) {
+		delta.dirs += sign;
+	} else {
+		delta.size += sign * size;
+		delta.files += sign;
+	}
+}
+
+/**
+ * @brief Add the changes of this scan to the stored directory totals.
+ *
+ * One bottom-up pass: a parent path is shorter than any of its children,
+ * so taking the longest paths first finishes every directory before its
+ * change moves on to the parent. Only directories on the ancestor chains
+ * of changed entries are written. For a new catalog that is every
+ * directory, each written once.
+ */
+void Scanner::storeDirectoryTotals(DBManager *db) {
+	QMap<int, QStringList> by_length;
+	for (auto it = dir_deltas.constBegin(); it != dir_deltas.constEnd(); ++it) {
+		by_length[it.key().size()].append(it.key());
+	}
+	QHash<int, DirTotals> totals;
+	while (!by_length.isEmpty()) {
+		QStringList paths = by_length.take(by_length.lastKey());
+		for (const QString &path : paths) {
+			DirTotals delta = dir_deltas.value(path);
+			auto dir = path_ids.constFind(path);
+			// Entries directly in the scanned directory have no row above them.
+			if (delta.isZero() || dir == path_ids.constEnd()) {
+				continue;
+			}
+			totals.insert(dir.value(), delta);
+			QString parent = parentPath(path);
+			if (parent == path) {
+				continue;
+			}
+			auto pending = dir_deltas.find(parent);
+			if (pending == dir_deltas.end()) {
+				dir_deltas.insert(parent, delta);
+				by_length[parent.size()].append(parent);
+			} else {
+				pending.value() += delta;
+			}
+		}
+	}
+	dir_deltas.clear();
+	db->addDirectoryTotals(totals);
+}
+
+/**
+ * @brief Files, bytes and subdirectories a batch accounts for.
+ *
+ * Directories skipped as unchanged are counted from their stored listing,
+ * and a subtree an interrupted run finished from everything stored below
+ * it, so progress and files/s cover the whole catalog.
+ */
+DirTotals Scanner::batchTotals(const ScanBatch &batch) const {
+	DirTotals counted = DirTotals();
+	if (batch.resumed) {
+		return stored_subtrees.value(batch.directory);
+	}
+	if (batch.unchanged) {
+		counted = stored_listings.value(batch.directory);
+		// Subdirectories are still walked and count themselves.
+		counted.dirs = 0;
+		return counted;
+	}
+	for (const ScanEntry &item : batch.entries) {
+		if (!item.is_dir) {
+			counted.files++;
+			counted.size += item.size;
+		}
+	}
+	return counted;
+}
+
+/**
+ * @brief Sum the stored listings up the tree for subtrees that are resumed.
+ *
+ * Same bottom-up pass as storeDirectoryTotals(), longest paths first.
+ */
+void Scanner::sumStoredSubtrees() {
+	stored_subtrees = stored_listings;
+	QMap<int, QStringList> by_length;
+	for (auto it = stored_subtrees.constBegin(); it != stored_subtrees.constEnd(); ++it) {
+		by_length[it.key().size()].append(it.key());
+	}
+	while (!by_length.isEmpty()) {
+		QStringList paths = by_length.take(by_length.lastKey());
+		for (const QString &path : paths) {
+			QString parent = parentPath(path);
+			if (parent.isEmpty() || parent == path) {
+				continue;
+			}
+			DirTotals subtree = stored_subtrees.value(path);
+			auto pending = stored_subtrees.find(parent);
+			if (pending == stored_subtrees.end()) {
+				stored_subtrees.insert(parent, subtree);
+				by_length[parent.size()].append(parent);
+			} else {
+				pending.value() += subtree;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Directory part of a path as the scanner stores it.
+ */
+QString Scanner::parentPath(const QString &path) {
+	int slash = path.lastIndexOf('/');
+	if (slash < 0) {
+		return QString();
+	}
+	QString parent = path.left(slash);
+	if (parent.isEmpty() || parent.endsWith(':')) {
+		parent = path.left(slash + 1);
+	}
+	return parent;
 }
 
 void Scanner::stop() { this->f_running = false; }
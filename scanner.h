@@ -2,9 +2,34 @@
 #define SCANNER_H
 
 #include "dbmanager.h"
+#include "direnumerator.h"
+#include "mimeclassifier.h"
 #include "thumbnailqueue.h"
+#include <QHash>
+#include <QMetaType>
+#include <QSet>
 #include <QThread>
-#include <QtWidgets>
+#include <QVector>
+
+/**
+ * Where a scan is, sent to the GUI a few times per second instead of once
+ * per directory.
+ */
+struct ScanProgress {
+	// Last directory written.
+	QString directory;
+	qint64 files;
+	qint64 dirs;
+	qint64 bytes;
+	qint64 elapsed_ms;
+	double files_per_sec;
+	// Set while files are hashed for duplicate detection after the walk;
+	// hashed counts the files read so far.
+	bool hashing;
+	qint64 hashed;
+	// Set on the last snapshot of a scan, after everything is committed.
+	bool finished;
+};
 
 class Scanner : public QThread {
 	Q_OBJECT
@@ -17,10 +42,16 @@ class Scanner : public QThread {
 	void setCatalogName(QString cname);
 	void setCatalogId(int id);
 	void setThumbnailQueue(ThumbnailQueue *queue);
+	void setBatchOptions(int batch_size, int flush_interval_ms);
+	void setThreadCount(int count);
+	void setIncremental(bool state);
+	void setProgressInterval(int interval_ms);
+	void setHashing(bool state);
 
       signals:
-	void setProgressFilename(QString);
+	void progress(ScanProgress progress);
 	void thumbnailQueueSize(int size);
+	void scanFailed(QString message);
 
       public slots:
 	void stop();
@@ -32,12 +63,43 @@ class Scanner : public QThread {
 	QString scan_path;
 	QString db_path;
 	QString catalog_name;
-	QLabel *progress_label;
 	int catalog_id;
 	ThumbnailQueue *thumb_queue;
+	int batch_size;
+	int flush_interval;
+	int thread_count;
+	bool incremental;
+	bool with_hashes;
+	int progress_interval;
+	QVector<ThumbnailRequest> pending_thumbs;
+	QHash<QString, IndexedEntry> known;
+	QHash<QString, int> path_ids;
+	QSet<int> seen;
+	QSet<QString> unchanged_dirs;
+	QSet<QString> resumed_dirs;
+	QHash<QString, int> open_subtrees;
+	// Change to the totals of each directory from its own children.
+	QHash<QString, DirTotals> dir_deltas;
+	// Live children of each directory as loaded at the start of the scan,
+	// directly in it and at any depth.
+	QHash<QString, DirTotals> stored_listings;
+	QHash<QString, DirTotals> stored_subtrees;
 	void run();
+	void flushThumbnails(bool committed);
+	void storeBatch(DBManager *db, const ScanBatch &batch, int catalog_id);
+	void tombstoneMissing(DBManager *db, int catalog_id);
+	void checkpointSubtree(DBManager *db, const ScanBatch &batch, int catalog_id);
+	bool inResumedSubtree(const QString &path) const;
+	void countEntry(const QString &directory, bool is_directory, qint64 size, int sign);
+	void storeDirectoryTotals(DBManager *db);
+	DirTotals batchTotals(const ScanBatch &batch) const;
+	void sumStoredSubtrees();
+	static QString parentPath(const QString &path);
 	void processDirectory(QString path);
-	bool needsThumbnail(const QFileInfo &info);
+	static void classify(DirEntry &entry, const ScanEntry &item, MimeClassifier &classifier);
+	bool needsThumbnail(const DirEntry &entry);
 };
 
+Q_DECLARE_METATYPE(ScanProgress)
+
 #endif // SCANNER_H
@@ -0,0 +1,113 @@
+#include "searchworker.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QSqlQuery>
+
+namespace {
+// The first page is small and flushed early so something shows up quickly.
+const int first_page_rows = 64;
+const int first_page_ms = 50;
+const int page_rows = 256;
+const int page_ms = 250;
+QAtomicInt worker_counter;
+} // namespace
+
+SearchWorker::SearchWorker(QString db_path) : db_path(db_path), db(nullptr), handle(nullptr), latest(0) {
+	qRegisterMetaType<QVector<FileRow>>("QVector<FileRow>");
+	connection_name = QString("search_worker_%1").arg(worker_counter.fetchAndAddOrdered(1));
+}
+
+SearchWorker::~SearchWorker() { closeDatabase(); }
+
+/**
+ * @brief Drop every search older than generation. Called from the GUI thread.
+ */
+void SearchWorker::cancel(int generation) {
+	latest.storeRelease(generation);
+	QMutexLocker locker(&handle_mutex);
+	DBManager::interrupt(handle);
+}
+
+void SearchWorker::setDatabase(QString db_path) {
+	closeDatabase();
+	this->db_path = db_path;
+}
+
+void SearchWorker::openDatabase() {
+	if (db != nullptr) {
+		return;
+	}
+	db = new DBManager(db_path, connection_name);
+	QMutexLocker locker(&handle_mutex);
+	handle = db->interruptHandle();
+}
+
+void SearchWorker::closeDatabase() {
+	if (db == nullptr) {
+		return;
+	}
+	{
+		QMutexLocker locker(&handle_mutex);
+		handle = nullptr;
+	}
+	delete db;
+	db = nullptr;
+	QSqlDatabase::removeDatabase(connection_name);
+}
+
+void SearchWorker::search(int generation, QString text, bool and_join, int cat_id) {
+	// Superseded while it was waiting in the event queue.
+	if (generation != latest.loadAcquire()) {
+		return;
+	}
+	openDatabase();
+	QSqlQuery query = db->searchFiles(text, and_join, cat_id);
+	stream(generation, query);
+}
+
+/**
+ * @brief Files of one folder, paged like search results so large folders
+ * never stall the GUI thread.
+ */
+void SearchWorker::listFolder(int generation, int parent_id, int cat_id) {
+	if (generation != latest.loadAcquire()) {
+		return;
+	}
+	openDatabase();
+	QSqlQuery query = db->fetchFiles(parent_id, cat_id);
+	stream(generation, query);
+}
+
+void SearchWorker::stream(int generation, QSqlQuery &query) {
+	QVector<FileRow> page;
+	int total = 0;
+	bool first = true;
+	QElapsedTimer timer;
+	timer.start();
+	while (query.next()) {
+		if (generation != latest.loadAcquire()) {
+			return;
+		}
+		FileRow row;
+		row.id = query.value("ids").toInt();
+		row.catalog_id = query.value("catalog_id").toInt();
+		row.full_path = query.value("full_path").toString();
+		row.filesize = query.value("filesize").toLongLong();
+		row.thumbnail_state = query.value("has_thumbnail").toInt();
+		page.append(row);
+		total++;
+		if (page.size() >= (first ? first_page_rows : page_rows) || timer.elapsed() >= (first ? first_page_ms : page_ms)) {
+			emit resultsReady(generation, page);
+			page.clear();
+			first = false;
+			timer.restart();
+		}
+	}
+	if (generation != latest.loadAcquire()) {
+		return;
+	}
+	if (!page.isEmpty()) {
+		emit resultsReady(generation, page);
+	}
+	emit finished(generation, total);
+}
@@ -0,0 +1,48 @@
+#ifndef SEARCHWORKER_H
+#define SEARCHWORKER_H
+
+#include "dbmanager.h"
+#include <QAtomicInt>
+#include <QMutex>
+#include <QObject>
+#include <QVector>
+
+class QSqlQuery;
+
+/**
+ * Runs searches and folder listings on its own thread and connection.
+ *
+ * Results are streamed in pages so the view can show the first matches
+ * while the query is still running. Every search carries a generation;
+ * cancel() bumps the expected generation and interrupts the running
+ * statement, so a new query never waits for the previous one.
+ */
+class SearchWorker : public QObject {
+	Q_OBJECT
+      public:
+	SearchWorker(QString db_path);
+	~SearchWorker();
+	void cancel(int generation);
+
+      public slots:
+	void search(int generation, QString text, bool and_join, int cat_id);
+	void listFolder(int generation, int parent_id, int cat_id);
+	void setDatabase(QString db_path);
+
+      signals:
+	void resultsReady(int generation, QVector<FileRow> rows);
+	void finished(int generation, int total);
+
+      private:
+	QString db_path;
+	QString connection_name;
+	DBManager *db;
+	void *handle;
+	QMutex handle_mutex;
+	QAtomicInt latest;
+	void openDatabase();
+	void closeDatabase();
+	void stream(int generation, QSqlQuery &query);
+};
+
+#endif // SEARCHWORKER_H
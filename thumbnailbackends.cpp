@@ -0,0 +1,208 @@
+#include "thumbnailbackends.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#include <QThread>
+#include <memory>
+
+#ifdef POORMAN_WITH_LIBAV
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+#endif
+
+#ifdef POORMAN_WITH_POPPLER
+#include <poppler-qt5.h>
+#endif
+
+namespace {
+// Packets to read while looking for a decodable keyframe.
+const int max_video_packets = 512;
+} // namespace
+
+bool ThumbnailBackends::handles(const QString &mimeType) {
+#ifdef POORMAN_WITH_LIBAV
+	if (mimeType.startsWith("video/")) {
+		return true;
+	}
+#endif
+#ifdef POORMAN_WITH_POPPLER
+	if (mimeType == "application/pdf") {
+		return true;
+	}
+#endif
+	Q_UNUSED(mimeType);
+	return false;
+}
+
+/**
+ * @brief Thumbnail from an in-process backend, or a null image.
+ */
+QImage ThumbnailBackends::generate(const QString &filePath, const QString &mimeType, int maxSize) {
+#ifdef POORMAN_WITH_LIBAV
+	if (mimeType.startsWith("video/")) {
+		QSemaphoreReleaser releaser(limiter(Video));
+		limiter(Video).acquire();
+		return videoFrame(filePath, maxSize);
+	}
+#endif
+#ifdef POORMAN_WITH_POPPLER
+	if (mimeType == "application/pdf") {
+		QSemaphoreReleaser releaser(limiter(Pdf));
+		limiter(Pdf).acquire();
+		return pdfPage(filePath, maxSize);
+	}
+#endif
+	Q_UNUSED(filePath);
+	Q_UNUSED(mimeType);
+	Q_UNUSED(maxSize);
+	return QImage();
+}
+
+/**
+ * @brief Concurrency limit of a backend, a quarter of the cores each.
+ */
+QSemaphore &ThumbnailBackends::limiter(Backend backend) {
+	static const int count = qMax(1, QThread::idealThreadCount() / 4);
+	static QSemaphore video(count);
+	static QSemaphore pdf(count);
+	static QSemaphore external(count);
+	switch (backend) {
+	case Video:
+		return video;
+	case Pdf:
+		return pdf;
+	default:
+		return external;
+	}
+}
+
+/**
+ * @brief Directory for external thumbnailer output, preferring tmpfs.
+ */
+QString ThumbnailBackends::scratchDir() {
+	static const QString dir = []() {
+		QStringList candidates;
+		candidates << qEnvironmentVariable("XDG_RUNTIME_DIR") << "/dev/shm";
+		for (const QString &candidate : candidates) {
+			QFileInfo info(candidate);
+			if (!candidate.isEmpty() && info.isDir() && info.isWritable()) {
+				return candidate;
+			}
+		}
+		return QDir::tempPath();
+	}();
+	return dir;
+}
+
+#ifdef POORMAN_WITH_LIBAV
+/**
+ * @brief Decode the first keyframe after 10% of the video.
+ *
+ * Only keyframes are decoded (AVDISCARD_NONKEY), so this costs a seek and
+ * a single intra frame instead of a run of the decoder.
+ */
+QImage ThumbnailBackends::videoFrame(const QString &filePath, int maxSize) {
+	AVFormatContext *format = nullptr;
+	if (avformat_open_input(&format, QFile::encodeName(filePath).constData(), nullptr, nullptr) < 0) {
+		return QImage();
+	}
+	std::shared_ptr<AVFormatContext> format_guard(format, [](AVFormatContext *ctx) { avformat_close_input(&ctx); });
+	if (avformat_find_stream_info(format, nullptr) < 0) {
+		return QImage();
+	}
+	int stream_index = av_find_best_stream(format, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+	if (stream_index < 0) {
+		return QImage();
+	}
+	AVStream *stream = format->streams[stream_index];
+	const AVCodec *codec = avcodec_find_decoder(stream->codecpar->codec_id);
+	if (codec == nullptr) {
+		return QImage();
+	}
+	AVCodecContext *decoder = avcodec_alloc_context3(codec);
+	std::shared_ptr<AVCodecContext> decoder_guard(decoder, [](AVCodecContext *ctx) { avcodec_free_context(&ctx); });
+	if (decoder == nullptr || avcodec_parameters_to_context(decoder, stream->codecpar) < 0) {
+		return QImage();
+	}
+	decoder->thread_count = 1;
+	decoder->skip_frame = AVDISCARD_NONKEY;
+	if (avcodec_open2(decoder, codec, nullptr) < 0) {
+		return QImage();
+	}
+
+	if (format->duration > 0) {
+		int64_t target = av_rescale_q(format->duration / 10, AV_TIME_BASE_Q, stream->time_base);
+		if (stream->start_time != AV_NOPTS_VALUE) {
+			target += stream->start_time;
+		}
+		av_seek_frame(format, stream_index, target, AVSEEK_FLAG_BACKWARD);
+	}
+
+	std::shared_ptr<AVPacket> packet(av_packet_alloc(), [](AVPacket *p) { av_packet_free(&p); });
+	std::shared_ptr<AVFrame> frame(av_frame_alloc(), [](AVFrame *f) { av_frame_free(&f); });
+	bool decoded = false;
+	for (int read = 0; read < max_video_packets && !decoded; read++) {
+		if (av_read_frame(format, packet.get()) < 0) {
+			avcodec_send_packet(decoder, nullptr);
+			decoded = avcodec_receive_frame(decoder, frame.get()) == 0;
+			break;
+		}
+		if (packet->stream_index == stream_index && avcodec_send_packet(decoder, packet.get()) == 0) {
+			decoded = avcodec_receive_frame(decoder, frame.get()) == 0;
+		}
+		av_packet_unref(packet.get());
+	}
+	if (!decoded || frame->width <= 0 || frame->height <= 0) {
+		return QImage();
+	}
+
+	QSize display(frame->width, frame->height);
+	if (frame->sample_aspect_ratio.num > 0 && frame->sample_aspect_ratio.den > 0) {
+		display.setWidth(qMax(1, int(frame->width * av_q2d(frame->sample_aspect_ratio))));
+	}
+	QSize target = display.width() > maxSize || display.height() > maxSize
+			   ? display.scaled(maxSize, maxSize, Qt::KeepAspectRatio)
+			   : display;
+	target = target.expandedTo(QSize(1, 1));
+	SwsContext *scaler = sws_getContext(frame->width, frame->height, AVPixelFormat(frame->format), target.width(),
+					    target.height(), AV_PIX_FMT_RGB32, SWS_AREA, nullptr, nullptr, nullptr);
+	if (scaler == nullptr) {
+		return QImage();
+	}
+	QImage image(target, QImage::Format_RGB32);
+	uint8_t *planes[1] = {image.bits()};
+	int strides[1] = {int(image.bytesPerLine())};
+	sws_scale(scaler, frame->data, frame->linesize, 0, frame->height, planes, strides);
+	sws_freeContext(scaler);
+	return image;
+}
+#endif
+
+#ifdef POORMAN_WITH_POPPLER
+/**
+ * @brief Render the first page at the resolution that fits maxSize.
+ */
+QImage ThumbnailBackends::pdfPage(const QString &filePath, int maxSize) {
+	std::unique_ptr<Poppler::Document> document(Poppler::Document::load(filePath));
+	if (!document || document->isLocked() || document->numPages() < 1) {
+		return QImage();
+	}
+	document->setRenderHint(Poppler::Document::Antialiasing);
+	document->setRenderHint(Poppler::Document::TextAntialiasing);
+	std::unique_ptr<Poppler::Page> page(document->page(0));
+	if (!page) {
+		return QImage();
+	}
+	QSizeF points = page->pageSizeF();
+	double longest = qMax(points.width(), points.height());
+	if (longest <= 0) {
+		return QImage();
+	}
+	double dpi = 72.0 * maxSize / longest;
+	return page->renderToImage(dpi, dpi);
+}
+#endif
@@ -0,0 +1,34 @@
+#ifndef THUMBNAILBACKENDS_H
+#define THUMBNAILBACKENDS_H
+
+#include <QImage>
+#include <QSemaphore>
+#include <QString>
+
+/**
+ * In-process thumbnail sources that replace external thumbnailers.
+ *
+ * Each backend is only compiled in when its library was found at build
+ * time (POORMAN_WITH_LIBAV, POORMAN_WITH_POPPLER). Every backend, the
+ * external thumbnailers included, has its own concurrency limit so a
+ * folder of videos cannot occupy every thumbnail thread at once.
+ */
+class ThumbnailBackends {
+      public:
+	enum Backend { Video, Pdf, External };
+
+	static bool handles(const QString &mimeType);
+	static QImage generate(const QString &filePath, const QString &mimeType, int maxSize);
+	static QSemaphore &limiter(Backend backend);
+	static QString scratchDir();
+
+      private:
+#ifdef POORMAN_WITH_LIBAV
+	static QImage videoFrame(const QString &filePath, int maxSize);
+#endif
+#ifdef POORMAN_WITH_POPPLER
+	static QImage pdfPage(const QString &filePath, int maxSize);
+#endif
+};
+
+#endif // THUMBNAILBACKENDS_H
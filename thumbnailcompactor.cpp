@@ -0,0 +1,54 @@
+#include "thumbnailcompactor.h"
+#include "dbmanager.h"
+#include "thumbnailmanager.h"
+#include <QDebug>
+#include <QSqlDatabase>
+
+namespace {
+const int chunk_size = 256;
+const char *connection_name = "thumbnail_compactor";
+} // namespace
+
+ThumbnailCompactor::ThumbnailCompactor(QObject *parent, QString db_path) : QThread(parent), db_path(db_path), cancelled(0) {}
+
+void ThumbnailCompactor::stop() { cancelled.storeRelease(1); }
+
+void ThumbnailCompactor::run() {
+	cancelled.storeRelease(0);
+	int checked = 0;
+	int converted = 0;
+	qint64 saved_bytes = 0;
+	{
+		DBManager db(db_path, connection_name);
+		int last_id = 0;
+		while (!cancelled.loadAcquire()) {
+			QVector<QPair<int, QByteArray>> thumbnails = db.fetchThumbnails(last_id, chunk_size);
+			if (thumbnails.isEmpty()) {
+				break;
+			}
+			last_id = thumbnails.last().first;
+
+			QVector<QPair<int, QByteArray>> smaller;
+			qint64 chunk_saved = 0;
+			for (const QPair<int, QByteArray> &thumbnail : thumbnails) {
+				QByteArray encoded = ThumbnailManager::reencode(thumbnail.second);
+				if (!encoded.isEmpty()) {
+					chunk_saved += thumbnail.second.size() - encoded.size();
+					smaller.append(qMakePair(thumbnail.first, encoded));
+				}
+			}
+			checked += thumbnails.size();
+			if (db.replaceThumbnails(smaller)) {
+				converted += smaller.size();
+				saved_bytes += chunk_saved;
+			}
+			emit progress(checked, converted);
+		}
+		if (converted > 0) {
+			qDebug() << "Re-encoded" << converted << "thumbnails, vacuuming";
+			db.vacuum();
+		}
+	}
+	QSqlDatabase::removeDatabase(connection_name);
+	emit compacted(converted, saved_bytes);
+}
@@ -0,0 +1,29 @@
+#ifndef THUMBNAILCOMPACTOR_H
+#define THUMBNAILCOMPACTOR_H
+
+#include <QAtomicInt>
+#include <QThread>
+
+/**
+ * Re-encodes stored thumbnails with the configured format and vacuums the
+ * database afterwards, so catalogs written with PNG thumbnails shrink.
+ */
+class ThumbnailCompactor : public QThread {
+	Q_OBJECT
+      public:
+	ThumbnailCompactor(QObject *parent, QString db_path);
+	void stop();
+
+      signals:
+	void progress(int checked, int converted);
+	void compacted(int converted, qint64 saved_bytes);
+
+      protected:
+	void run() override;
+
+      private:
+	QString db_path;
+	QAtomicInt cancelled;
+};
+
+#endif // THUMBNAILCOMPACTOR_H
@@ -1,133 +1,543 @@
 #include "thumbnailmanager.h"
+#include "mimeclassifier.h"
+#include "scanmetrics.h"
+#include "thumbnailbackends.h"
 #include <QBuffer>
 #include <QDebug>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QFileInfo>
 #include <QImage>
-#include <QMimeDatabase>
-#include <QMimeType>
+#include <QImageReader>
+#include <QImageWriter>
 #include <QProcess>
+#include <QSemaphore>
+#include <QStandardPaths>
 #include <QTemporaryFile>
+#include <QTransform>
+#include <QUrl>
+#include <QVector>
+#include <cstring>
 
 ThumbnailManager::ThumbnailManager() {}
 
-QString ThumbnailManager::detectMimeType(const QString &filePath) {
-	QMimeType mimeType = mimeDb.mimeTypeForFile(filePath);
-	return mimeType.name();
+namespace {
+// JPEG plugin quality while decoding: accurate DCT and smooth scaling.
+const int decode_quality = 75;
+// Time an external thumbnailer gets before it is killed.
+const int external_timeout_ms = 10000;
+// How long the thumbnailer directories are trusted before their mtimes are checked again.
+const int registry_check_ms = 5000;
+
+quint32 readUInt(const uchar *p, int size, bool little_endian) {
+	quint32 value = 0;
+	for (int i = 0; i < size; i++) {
+		value |= quint32(p[little_endian ? i : size - 1 - i]) << (8 * i);
+	}
+	return value;
+}
+
+/**
+ * @brief Embedded thumbnail of a JPEG file from its EXIF IFD1, if any.
+ * @param orientation set to the EXIF orientation of the main image
+ *
+ * Only the first 64 KiB are read; the APP1 segment cannot be larger.
+ */
+QByteArray readExifThumbnail(const QString &filePath, int &orientation) {
+	orientation = 1;
+	QFile f(filePath);
+	if (!f.open(QIODevice::ReadOnly)) {
+		return QByteArray();
+	}
+	const QByteArray head = f.read(65536 + 4);
+	const uchar *data = reinterpret_cast<const uchar *>(head.constData());
+	const int size = head.size();
+	if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+		return QByteArray();
+	}
+
+	// Find the Exif APP1 segment before the image data starts.
+	int pos = 2;
+	const uchar *tiff = nullptr;
+	int tiff_size = 0;
+	while (pos + 4 <= size && data[pos] == 0xFF) {
+		uchar marker = data[pos + 1];
+		int length = readUInt(data + pos + 2, 2, false);
+		if (marker == 0xDA || length < 2) {
+			break;
+		}
+		if (marker == 0xE1 && length >= 8 && pos + 2 + length <= size && memcmp(data + pos + 4, "Exif\0\0", 6) == 0) {
+			tiff = data + pos + 10;
+			tiff_size = length - 8;
+			break;
+		}
+		pos += 2 + length;
+	}
+	if (tiff == nullptr || tiff_size < 8) {
+		return QByteArray();
+	}
+
+	bool le = tiff[0] == 'I' && tiff[1] == 'I';
+	if (!le && !(tiff[0] == 'M' && tiff[1] == 'M')) {
+		return QByteArray();
+	}
+	// Offsets come from the file, so every bounds check subtracts from the
+	// size instead of adding to the offset, which could wrap around.
+	const quint32 limit = quint32(tiff_size);
+	quint32 ifd = readUInt(tiff + 4, 4, le);
+	quint32 thumb_offset = 0;
+	quint32 thumb_length = 0;
+	// IFD0 holds the orientation, IFD1 the thumbnail. An IFD is a 2 byte
+	// entry count, 12 bytes per entry and the 4 byte offset of the next one.
+	for (int index = 0; index < 2 && ifd != 0 && ifd <= limit - 6; index++) {
+		quint32 count = readUInt(tiff + ifd, 2, le);
+		if (count > (limit - ifd - 6) / 12) {
+			return QByteArray();
+		}
+		for (quint32 i = 0; i < count; i++) {
+			const uchar *entry = tiff + ifd + 2 + i * 12;
+			int tag = readUInt(entry, 2, le);
+			int type = readUInt(entry + 2, 2, le);
+			quint32 value = type == 3 ? readUInt(entry + 8, 2, le) : readUInt(entry + 8, 4, le);
+			if (index == 0 && tag == 0x0112) {
+				orientation = value;
+			} else if (index == 1 && tag == 0x0201) {
+				thumb_offset = value;
+			} else if (index == 1 && tag == 0x0202) {
+				thumb_length = value;
+			}
+		}
+		ifd = readUInt(tiff + ifd + 2 + count * 12, 4, le);
+	}
+	if (thumb_offset == 0 || thumb_length == 0 || thumb_offset > limit || thumb_length > limit - thumb_offset) {
+		return QByteArray();
+	}
+	return QByteArray(reinterpret_cast<const char *>(tiff + thumb_offset), thumb_length);
+}
+
+bool hasTransparency(const QImage &image) {
+	if (!image.hasAlphaChannel()) {
+		return false;
+	}
+	QImage argb = image.convertToFormat(QImage::Format_ARGB32);
+	for (int y = 0; y < argb.height(); y++) {
+		const QRgb *line = reinterpret_cast<const QRgb *>(argb.constScanLine(y));
+		for (int x = 0; x < argb.width(); x++) {
+			if (qAlpha(line[x]) < 255) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+QImage applyOrientation(const QImage &image, int orientation) {
+	bool mirror = orientation == 2 || orientation == 7;
+	bool flip = orientation == 4 || orientation == 5;
+	int rotation = 0;
+	if (orientation == 3) {
+		rotation = 180;
+	} else if (orientation >= 5 && orientation <= 7) {
+		rotation = 90;
+	} else if (orientation == 8) {
+		rotation = 270;
+	}
+	QImage result = mirror || flip ? image.mirrored(mirror, flip) : image;
+	if (rotation != 0) {
+		result = result.transformed(QTransform().rotate(rotation));
+	}
+	return result;
+}
+
+/**
+ * @brief Average factor x factor pixel blocks.
+ *
+ * A cheap first step for full decodes; the inner loops are plain integer
+ * sums the compiler can vectorise. The exact size is reached with a smooth
+ * scale of the much smaller result.
+ */
+QImage boxDownscale(const QImage &source, int factor) {
+	QImage::Format format = source.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+	QImage src = source.convertToFormat(format);
+	const int width = src.width() / factor;
+	const int height = src.height() / factor;
+	const quint32 area = factor * factor;
+	QImage dst(width, height, format);
+	QVector<quint32> sums(width * 4);
+	for (int y = 0; y < height; y++) {
+		sums.fill(0);
+		quint32 *sum = sums.data();
+		for (int dy = 0; dy < factor; dy++) {
+			const QRgb *line = reinterpret_cast<const QRgb *>(src.constScanLine(y * factor + dy));
+			for (int x = 0; x < width; x++) {
+				const QRgb *block = line + x * factor;
+				for (int dx = 0; dx < factor; dx++) {
+					sum[x * 4] += qAlpha(block[dx]);
+					sum[x * 4 + 1] += qRed(block[dx]);
+					sum[x * 4 + 2] += qGreen(block[dx]);
+					sum[x * 4 + 3] += qBlue(block[dx]);
+				}
+			}
+		}
+		QRgb *out = reinterpret_cast<QRgb *>(dst.scanLine(y));
+		for (int x = 0; x < width; x++) {
+			out[x] = qRgba(sum[x * 4 + 1] / area, sum[x * 4 + 2] / area, sum[x * 4 + 3] / area, sum[x * 4] / area);
+		}
+	}
+	return dst;
+}
+} // namespace
+
+/**
+ * @brief Decode filePath at no more than maxSize pixels per side.
+ *
+ * Tries, cheapest first: the EXIF thumbnail of a JPEG if it is large
+ * enough, a reduced resolution decode for formats that support it (DCT
+ * scaling for JPEG), and a full decode with a box prefilter. Images that
+ * are already small enough are not enlarged.
+ */
+QImage ThumbnailManager::decodeScaled(const QString &filePath, int maxSize) {
+	QImageReader reader(filePath);
+	reader.setAutoTransform(true);
+	reader.setQuality(decode_quality);
+	const QSize size = reader.size();
+	const bool too_large = size.isValid() && (size.width() > maxSize || size.height() > maxSize);
+
+	if (too_large && reader.format() == "jpeg") {
+		int orientation = 1;
+		QImage embedded = QImage::fromData(readExifThumbnail(filePath, orientation), "JPEG");
+		// Letterboxed thumbnails do not match the aspect ratio of the image.
+		if (!embedded.isNull() && qMax(embedded.width(), embedded.height()) >= maxSize &&
+		    qAbs(double(embedded.width()) / embedded.height() - double(size.width()) / size.height()) < 0.02) {
+			return applyOrientation(embedded, orientation).scaled(maxSize, maxSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+		}
+	}
+
+	if (too_large && reader.supportsOption(QImageIOHandler::ScaledSize)) {
+		reader.setScaledSize(size.scaled(maxSize, maxSize, Qt::KeepAspectRatio));
+		QImage img = reader.read();
+		if (!img.isNull()) {
+			return img;
+		}
+	}
+
+	QImageReader full(filePath);
+	full.setAutoTransform(true);
+	QImage img = full.read();
+	if (img.isNull() || (img.width() <= maxSize && img.height() <= maxSize)) {
+		return img;
+	}
+	// Capped by the short side, so an elongated image keeps at least one pixel.
+	int factor = qMin(qMax(img.width(), img.height()) / (2 * maxSize), qMin(img.width(), img.height()));
+	if (factor >= 2) {
+		img = boxDownscale(img, factor);
+	}
+	return img.scaled(maxSize, maxSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
 }
 
 QByteArray ThumbnailManager::generateWithQt(const QString &filePath, int maxSize) {
-	QImage img(filePath);
-	if (img.isNull()) {
+	QImage scaled = decodeScaled(filePath, maxSize);
+	if (scaled.isNull()) {
 		return QByteArray();
 	}
 
-	QImage scaled = img.scaled(maxSize, maxSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+	return encodeThumbnail(scaled);
+}
+
+QMutex ThumbnailManager::format_mutex;
+ThumbnailFormat ThumbnailManager::current_format = {"JPEG", 80};
+
+/**
+ * @brief Set the encoding of new thumbnails. Unsupported formats fall back to JPEG.
+ */
+void ThumbnailManager::setFormat(const ThumbnailFormat &format) {
+	QMutexLocker locker(&format_mutex);
+	current_format.format = availableFormats().contains(QString::fromLatin1(format.format)) ? format.format : "JPEG";
+	current_format.quality = qBound(1, format.quality, 100);
+}
+
+ThumbnailFormat ThumbnailManager::format() {
+	QMutexLocker locker(&format_mutex);
+	return current_format;
+}
+
+/**
+ * @brief Thumbnail formats the installed image plugins can write.
+ */
+QStringList ThumbnailManager::availableFormats() {
+	static const QStringList formats = []() {
+		QList<QByteArray> writable = QImageWriter::supportedImageFormats();
+		QStringList result;
+		for (const char *candidate : {"jpeg", "webp", "png"}) {
+			if (writable.contains(candidate)) {
+				result << QString::fromLatin1(candidate).toUpper();
+			}
+		}
+		return result;
+	}();
+	return formats;
+}
+
+/**
+ * @brief Encode with the configured format.
+ *
+ * JPEG cannot store transparency, so images that use it are kept as PNG.
+ */
+QByteArray ThumbnailManager::encodeThumbnail(const QImage &image) {
+	ThumbnailFormat fmt = format();
+	if (fmt.format == "JPEG" && hasTransparency(image)) {
+		fmt.format = "PNG";
+	}
 	QByteArray ba;
 	QBuffer buffer(&ba);
 	buffer.open(QIODevice::WriteOnly);
-	scaled.save(&buffer, "PNG");
+	if (fmt.format == "PNG" || !image.save(&buffer, fmt.format.constData(), fmt.quality)) {
+		ba.clear();
+		buffer.seek(0);
+		image.save(&buffer, "PNG");
+	}
 	return ba;
 }
 
+/**
+ * @brief Stored thumbnail converted to the configured format.
+ * @return the new encoding, or an empty array when data is already in the
+ * format it would be written in, cannot be decoded, or would not get smaller
+ */
+QByteArray ThumbnailManager::reencode(const QByteArray &data) {
+	QBuffer buffer;
+	buffer.setData(data);
+	buffer.open(QIODevice::ReadOnly);
+	QByteArray stored = QImageReader::imageFormat(&buffer).toUpper();
+	QByteArray target = format().format;
+	if (stored == target) {
+		return QByteArray();
+	}
+	QImage image = QImage::fromData(data);
+	if (image.isNull()) {
+		return QByteArray();
+	}
+	// Transparent thumbnails are kept as PNG under JPEG, see encodeThumbnail().
+	if (stored == "PNG" && target == "JPEG" && hasTransparency(image)) {
+		return QByteArray();
+	}
+	QByteArray encoded = encodeThumbnail(image);
+	return encoded.size() < data.size() ? encoded : QByteArray();
+}
+
 #ifdef Q_OS_LINUX
-QString ThumbnailManager::findThumbnailer(const QString &mimeType) {
-	QStringList thumbnailerDirs = {"/usr/share/thumbnailers", "/usr/local/share/thumbnailers"};
+ThumbnailerRegistry::ThumbnailerRegistry() : loaded(false) {
+	dirs << "/usr/share/thumbnailers" << "/usr/local/share/thumbnailers";
+}
 
-	for (const QString &dir : thumbnailerDirs) {
+ThumbnailerRegistry &ThumbnailerRegistry::instance() {
+	static ThumbnailerRegistry registry;
+	return registry;
+}
+
+/**
+ * @brief Exec line of the thumbnailer registered for mimeType, or an empty string.
+ */
+QString ThumbnailerRegistry::find(const QString &mimeType) {
+	QMutexLocker locker(&mutex);
+	if (!loaded || isStale()) {
+		reload();
+	}
+	return exec_by_mime.value(mimeType);
+}
+
+bool ThumbnailerRegistry::isStale() {
+	if (!last_check.hasExpired(registry_check_ms)) {
+		return false;
+	}
+	last_check.start();
+	for (const QString &dir : dirs) {
+		QFileInfo info(dir);
+		QDateTime mtime = info.exists() ? info.lastModified() : QDateTime();
+		if (mtime != dir_mtimes.value(dir)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThumbnailerRegistry::reload() {
+	exec_by_mime.clear();
+	dir_mtimes.clear();
+	for (const QString &dir : dirs) {
+		QFileInfo info(dir);
+		dir_mtimes.insert(dir, info.exists() ? info.lastModified() : QDateTime());
 		QDir thumbDir(dir);
 		if (!thumbDir.exists())
 			continue;
 
-		QStringList thumbnailerFiles = thumbDir.entryList(QStringList() << "*.thumbnailer", QDir::Files);
+		QStringList thumbnailerFiles = thumbDir.entryList(QStringList() << "*.thumbnailer", QDir::Files, QDir::Name);
 		for (const QString &file : thumbnailerFiles) {
-			QString fullPath = thumbDir.absoluteFilePath(file);
-			QFile f(fullPath);
-			if (f.open(QIODevice::ReadOnly | QIODevice::Text)) {
-				QString content = f.readAll();
-				f.close();
-
-				if (content.contains(mimeType)) {
-					QStringList lines = content.split('\n');
-					for (const QString &line : lines) {
-						if (line.startsWith("Exec=")) {
-							QString exec = line.mid(5).trimmed();
-							QString cmd = exec.split(' ').first();
-							if (QFile::exists(cmd)) {
-								return exec;
-							}
-						}
-					}
-				}
-			}
+			parse(thumbDir.absoluteFilePath(file));
+		}
+	}
+	loaded = true;
+	last_check.start();
+	qDebug() << "Loaded thumbnailers for" << exec_by_mime.size() << "MIME types";
+}
+
+/**
+ * @brief Read the [Thumbnailer Entry] of one file. Earlier files win.
+ */
+void ThumbnailerRegistry::parse(const QString &path) {
+	QFile f(path);
+	if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		return;
+	}
+	QString exec;
+	QString tryExec;
+	QStringList mimeTypes;
+	bool inEntry = false;
+	while (!f.atEnd()) {
+		QString line = QString::fromUtf8(f.readLine()).trimmed();
+		if (line.startsWith('[')) {
+			inEntry = line == "[Thumbnailer Entry]";
+			continue;
+		}
+		if (!inEntry) {
+			continue;
+		}
+		if (line.startsWith("Exec=")) {
+			exec = line.mid(5).trimmed();
+		} else if (line.startsWith("TryExec=")) {
+			tryExec = line.mid(8).trimmed();
+		} else if (line.startsWith("MimeType=")) {
+			mimeTypes = line.mid(9).split(';', Qt::SkipEmptyParts);
+		}
+	}
+	if (exec.isEmpty() || mimeTypes.isEmpty()) {
+		return;
+	}
+
+	QString program = tryExec.isEmpty() ? exec.split(' ', Qt::SkipEmptyParts).first() : tryExec;
+	if (QFileInfo(program).isAbsolute() ? !QFile::exists(program) : QStandardPaths::findExecutable(program).isEmpty()) {
+		return;
+	}
+	for (const QString &mimeType : mimeTypes) {
+		QString name = mimeType.trimmed();
+		if (!exec_by_mime.contains(name)) {
+			exec_by_mime.insert(name, exec);
 		}
 	}
-	return QString();
 }
 
+/**
+ * @brief Run the external thumbnailer registered for mimeType.
+ *
+ * The output goes to a tmpfs scratch directory when one is available, and
+ * the number of thumbnailer processes is limited separately from the
+ * thumbnail pool.
+ */
 QByteArray ThumbnailManager::generateWithNative(const QString &filePath, const QString &mimeType, int maxSize) {
-	QString thumbnailerExec = findThumbnailer(mimeType);
+	QString thumbnailerExec = ThumbnailerRegistry::instance().find(mimeType);
 	if (thumbnailerExec.isEmpty()) {
 		return QByteArray();
 	}
 
-	QTemporaryFile tempFile;
-	if (!tempFile.open()) {
+	QTemporaryFile outFile(ThumbnailBackends::scratchDir() + "/poorman-thumb-XXXXXX.png");
+	if (!outFile.open()) {
 		return QByteArray();
 	}
-	QString outputPath = tempFile.fileName() + ".png";
-	tempFile.close();
-
-	QString exec = thumbnailerExec;
-	exec.replace("%s", QString::number(maxSize));
-	exec.replace("%u", filePath);
-	exec.replace("%i", filePath);
-	exec.replace("%o", outputPath);
+	outFile.close();
+	QString outputPath = outFile.fileName();
 
-	QStringList parts = exec.split(' ', Qt::SkipEmptyParts);
+	// Substitute per argument so paths with spaces stay one argument.
+	QStringList parts = thumbnailerExec.split(' ', Qt::SkipEmptyParts);
 	if (parts.isEmpty()) {
 		return QByteArray();
 	}
+	for (QString &part : parts) {
+		part.replace("%s", QString::number(maxSize));
+		part.replace("%u", QUrl::fromLocalFile(filePath).toString());
+		part.replace("%i", filePath);
+		part.replace("%o", outputPath);
+	}
+
+	QSemaphore &limiter = ThumbnailBackends::limiter(ThumbnailBackends::External);
+	QSemaphoreReleaser releaser(limiter);
+	limiter.acquire();
 
 	QString program = parts.takeFirst();
 	QProcess process;
 	process.start(program, parts);
 
-	if (!process.waitForFinished(4000)) {
+	if (!process.waitForFinished(external_timeout_ms)) {
 		process.kill();
 		process.waitForFinished(1000);
-		QFile::remove(outputPath);
 		return QByteArray();
 	}
 
-	if (process.exitCode() != 0) {
-		QFile::remove(outputPath);
+	if (process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0) {
 		return QByteArray();
 	}
 
-	QFile outFile(outputPath);
-	if (!outFile.open(QIODevice::ReadOnly)) {
+	if (!outFile.open()) {
 		return QByteArray();
 	}
-
-	QByteArray result = outFile.readAll();
-	outFile.close();
-	QFile::remove(outputPath);
-
-	return result;
+	return outFile.readAll();
 }
 #endif
 
-QByteArray ThumbnailManager::generateThumbnail(const QString &filePath, int maxSize) {
-	QString mimeType = detectMimeType(filePath);
+/**
+ * @brief Thumbnail of filePath, encoded, or an empty array.
+ * @param mimeType type stored by the scanner, detected here when empty
+ *
+ * In-process decoders come first: Qt for the image formats it reads, and
+ * the optional video and PDF backends. External thumbnailers are only
+ * started for everything else.
+ */
+QByteArray ThumbnailManager::generateThumbnail(const QString &filePath, int maxSize, QString mimeType) {
+	if (mimeType.isEmpty()) {
+		mimeType = MimeClassifier::instance().mimeTypeForFile(filePath);
+	}
+	ScanMetrics *metrics = ScanMetrics::instance();
+	QElapsedTimer timer;
+
+	bool qt_image = qtImageMimeTypes().contains(mimeType.toLatin1());
+	if (qt_image) {
+		timer.start();
+		QByteArray thumb = generateWithQt(filePath, maxSize);
+		metrics->recordThumbnail(SourceQt, timer.nsecsElapsed(), !thumb.isEmpty());
+		if (!thumb.isEmpty()) {
+			return thumb;
+		}
+	} else if (ThumbnailBackends::handles(mimeType)) {
+		timer.start();
+		QImage image = ThumbnailBackends::generate(filePath, mimeType, maxSize);
+		QByteArray thumb = image.isNull() ? QByteArray() : encodeThumbnail(image);
+		ThumbnailSource source = mimeType == "application/pdf" ? SourcePdf : SourceVideo;
+		metrics->recordThumbnail(source, timer.nsecsElapsed(), !thumb.isEmpty());
+		if (!thumb.isEmpty()) {
+			return thumb;
+		}
+	}
 
 #ifdef Q_OS_LINUX
-	QByteArray nativeThumb = generateWithNative(filePath, mimeType, maxSize);
-	if (!nativeThumb.isEmpty()) {
-		return nativeThumb;
+	timer.start();
+	QImage nativeThumb = QImage::fromData(generateWithNative(filePath, mimeType, maxSize));
+	QByteArray native = nativeThumb.isNull() ? QByteArray() : encodeThumbnail(nativeThumb);
+	metrics->recordThumbnail(SourceExternal, timer.nsecsElapsed(), !native.isEmpty());
+	if (!native.isEmpty()) {
+		return native;
 	}
 #endif
 
-	return generateWithQt(filePath, maxSize);
+	if (qt_image) {
+		return QByteArray();
+	}
+	timer.start();
+	QByteArray fallback = generateWithQt(filePath, maxSize);
+	metrics->recordThumbnail(SourceFallback, timer.nsecsElapsed(), !fallback.isEmpty());
+	return fallback;
+}
+
+const QList<QByteArray> &ThumbnailManager::qtImageMimeTypes() {
+	static const QList<QByteArray> types = QImageReader::supportedMimeTypes();
+	return types;
 }
@@ -2,21 +2,66 @@
 #define THUMBNAILMANAGER_H
 
 #include <QByteArray>
-#include <QMimeDatabase>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QImage>
+#include <QList>
+#include <QMutex>
 #include <QString>
+#include <QStringList>
+
+#ifdef Q_OS_LINUX
+/**
+ * Process wide MIME type -> Exec map of the installed .thumbnailer files.
+ *
+ * The files are parsed once and reloaded only when one of the thumbnailer
+ * directories changes its mtime. The directories are looked at no more
+ * than once every few seconds, not on every lookup.
+ */
+class ThumbnailerRegistry {
+      public:
+	static ThumbnailerRegistry &instance();
+	QString find(const QString &mimeType);
+
+      private:
+	ThumbnailerRegistry();
+	QStringList dirs;
+	QHash<QString, QDateTime> dir_mtimes;
+	QHash<QString, QString> exec_by_mime;
+	QElapsedTimer last_check;
+	QMutex mutex;
+	bool loaded;
+	bool isStale();
+	void reload();
+	void parse(const QString &path);
+};
+#endif
+
+// Image format and quality of stored thumbnails.
+struct ThumbnailFormat {
+	QByteArray format;
+	int quality;
+};
 
 class ThumbnailManager {
       public:
 	ThumbnailManager();
-	QByteArray generateThumbnail(const QString &filePath, int maxSize = 256);
+	QByteArray generateThumbnail(const QString &filePath, int maxSize = 256, QString mimeType = QString());
+	static void setFormat(const ThumbnailFormat &format);
+	static ThumbnailFormat format();
+	static QStringList availableFormats();
+	static QByteArray encodeThumbnail(const QImage &image);
+	static QByteArray reencode(const QByteArray &data);
 
       private:
-	QMimeDatabase mimeDb;
-	QString detectMimeType(const QString &filePath);
+	static QMutex format_mutex;
+	static ThumbnailFormat current_format;
+	QImage decodeScaled(const QString &filePath, int maxSize);
 	QByteArray generateWithQt(const QString &filePath, int maxSize);
+	static const QList<QByteArray> &qtImageMimeTypes();
 #ifdef Q_OS_LINUX
 	QByteArray generateWithNative(const QString &filePath, const QString &mimeType, int maxSize);
-	QString findThumbnailer(const QString &mimeType);
 #endif
 };
 
@@ -1,92 +1,390 @@
 #include "thumbnailqueue.h"
 #include "dbmanager.h"
+#include "scanmetrics.h"
 #include "thumbnailmanager.h"
+#include <QAtomicInt>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QSqlDatabase>
 #include <QThread>
 
-ThumbnailWorker::ThumbnailWorker(ThumbnailRequest request, QString db_path) : request(request), db_path(db_path) {
-	setAutoDelete(true);
+namespace {
+// A batch is written once it has this many thumbnails or its oldest one
+// has waited this long.
+const int writer_batch_size = 64;
+const int writer_batch_ms = 500;
+// Requests the scanner may queue before it has to wait, and requests
+// kept in the priority lane.
+const int bulk_capacity = 4096;
+const int urgent_capacity = 256;
+QAtomicInt writer_counter;
+} // namespace
+
+ThumbnailWriter::ThumbnailWriter(ThumbnailQueue *owner, QString db_path, QObject *parent)
+    : QThread(parent), owner(owner), db_path(db_path), in_flight(0), flush_waiters(0), stopping(false) {
+	connection_name = QString("thumbnail_writer_%1").arg(writer_counter.fetchAndAddOrdered(1));
 }
 
-void ThumbnailWorker::run() {
-	ThumbnailManager mgr;
-	QByteArray thumbnail = mgr.generateThumbnail(request.file_path, request.max_size);
+ThumbnailWriter::~ThumbnailWriter() { shutdown(); }
 
-	if (thumbnail.isEmpty()) {
-		emit thumbnailFailed(request.entry_id);
+/**
+ * @brief Queue a thumbnail for the next batch. Safe to call from any thread.
+ */
+void ThumbnailWriter::add(int entry_id, QByteArray thumbnail) {
+	QMutexLocker locker(&mutex);
+	queue.append(qMakePair(entry_id, thumbnail));
+	// The first entry starts the batch timer, a full batch ends it early.
+	if (queue.size() == 1 || queue.size() >= writer_batch_size) {
+		has_work.wakeOne();
+	}
+}
+
+/**
+ * @brief Block until everything queued so far is committed.
+ */
+void ThumbnailWriter::flush() {
+	QMutexLocker locker(&mutex);
+	if (!isRunning()) {
 		return;
 	}
+	flush_waiters++;
+	has_work.wakeOne();
+	while (!queue.isEmpty() || in_flight > 0) {
+		drained.wait(&mutex);
+	}
+	flush_waiters--;
+}
 
-	QString connectionName = QString("thumb_worker_%1").arg((quintptr)QThread::currentThreadId());
-	DBManager db(db_path, connectionName);
-	if (db.updateThumbnail(request.entry_id, thumbnail)) {
-		emit thumbnailReady(request.entry_id, thumbnail);
-	} else {
-		emit thumbnailFailed(request.entry_id);
+/**
+ * @brief Write what is left and stop the thread.
+ */
+void ThumbnailWriter::shutdown() {
+	{
+		QMutexLocker locker(&mutex);
+		stopping = true;
+		has_work.wakeOne();
+	}
+	wait();
+}
+
+void ThumbnailWriter::run() {
+	DBManager *db = new DBManager(db_path, connection_name);
+	for (;;) {
+		QVector<QPair<int, QByteArray>> batch;
+		{
+			QMutexLocker locker(&mutex);
+			while (queue.isEmpty() && !stopping) {
+				has_work.wait(&mutex);
+			}
+			if (queue.isEmpty()) {
+				break;
+			}
+			QElapsedTimer waited;
+			waited.start();
+			while (queue.size() < writer_batch_size && !stopping && flush_waiters == 0 &&
+			       waited.elapsed() < writer_batch_ms) {
+				has_work.wait(&mutex, writer_batch_ms - waited.elapsed());
+			}
+			batch.swap(queue);
+			in_flight = batch.size();
+		}
+
+		// A batch that failed to commit stays pending in the database.
+		owner->finishBatch(batch, db->updateThumbnails(batch));
+
+		{
+			QMutexLocker locker(&mutex);
+			in_flight = 0;
+			if (queue.isEmpty()) {
+				drained.wakeAll();
+			}
+		}
 	}
+	delete db;
+	QSqlDatabase::removeDatabase(connection_name);
 }
 
-ThumbnailQueue::ThumbnailQueue(QObject *parent, QString db_path) : QObject(parent), db_path(db_path), pending(0), completed(0), failed(0) {
+ThumbnailWorker::ThumbnailWorker(ThumbnailQueue *queue, ThumbnailWriter *writer) : queue(queue), writer(writer) {
+	setAutoDelete(true);
+}
+
+void ThumbnailWorker::run() {
+	ThumbnailManager mgr;
+	ThumbnailRequest request;
+	while (queue->takeRequest(request)) {
+		// A file on a drive that is not plugged in stays pending for later.
+		QFileInfo info(request.file_path);
+		if (!info.isFile() || !info.isReadable()) {
+			queue->skipRequest(request.entry_id);
+			continue;
+		}
+		QByteArray thumbnail = mgr.generateThumbnail(request.file_path, request.max_size, request.mime_type);
+		// An empty image tells the writer the file could not be decoded.
+		writer->add(request.entry_id, thumbnail);
+	}
+}
+
+ThumbnailQueue::ThumbnailQueue(QObject *parent, QString db_path)
+    : QObject(parent), db_path(db_path), workers(0), in_progress(0), completed(0), failed(0), skipped(0), work_requested(false),
+      stopping(false) {
+	qRegisterMetaType<QVector<int>>("QVector<int>");
 	int cores = QThread::idealThreadCount();
-	int maxThreads = cores > 0 ? cores / 2 : 2;
-	if (maxThreads < 1)
-		maxThreads = 1;
+	max_workers = cores > 0 ? cores / 2 : 2;
+	if (max_workers < 1)
+		max_workers = 1;
 
 	pool = new QThreadPool(this);
-	pool->setMaxThreadCount(maxThreads);
+	pool->setMaxThreadCount(max_workers);
+	writer = new ThumbnailWriter(this, db_path, this);
+	writer->start();
 
-	qDebug() << "ThumbnailQueue initialized with" << maxThreads << "worker threads";
+	qDebug() << "ThumbnailQueue initialized with" << max_workers << "worker threads";
 }
 
 ThumbnailQueue::~ThumbnailQueue() {
 	stop();
 	delete pool;
+	writer->shutdown();
 }
 
+/**
+ * @brief Queue a request, waiting while the bulk queue is full.
+ *
+ * Meant for the scanner thread; never call it from the GUI thread.
+ * Returns without queueing once the queue is stopped.
+ */
 void ThumbnailQueue::addRequest(ThumbnailRequest request) {
 	QMutexLocker locker(&mutex);
+	while (bulk.size() >= bulk_capacity && !stopping) {
+		not_full.wait(&mutex);
+	}
+	if (stopping || queued.contains(request.entry_id)) {
+		return;
+	}
+	queued.insert(request.entry_id);
+	bulk.enqueue(request);
+	startWorker();
+	reportSize(sizeLocked());
+}
 
-	ThumbnailWorker *worker = new ThumbnailWorker(request, db_path);
-	connect(worker, &ThumbnailWorker::thumbnailReady, this, &ThumbnailQueue::onThumbnailReady);
-	connect(worker, &ThumbnailWorker::thumbnailFailed, this, &ThumbnailQueue::onThumbnailFailed);
-
-	pending++;
-	pool->start(worker);
+/**
+ * @brief Queue as many requests as fit without waiting.
+ * @return number of requests taken, already queued ones included
+ */
+int ThumbnailQueue::offer(const QVector<ThumbnailRequest> &requests) {
+	QMutexLocker locker(&mutex);
+	work_requested = false;
+	int taken = 0;
+	for (const ThumbnailRequest &request : requests) {
+		if (stopping || bulk.size() >= bulk_capacity) {
+			break;
+		}
+		taken++;
+		if (queued.contains(request.entry_id)) {
+			continue;
+		}
+		queued.insert(request.entry_id);
+		bulk.enqueue(request);
+		startWorker();
+	}
+	reportSize(sizeLocked());
+	return taken;
+}
 
-	emit queueSizeChanged(pending);
+/**
+ * @brief Move requests to the front, e.g. for rows that are on screen.
+ *
+ * Requests already waiting in the bulk queue are moved over, new ones are
+ * added. The priority lane keeps only the most recent urgent_capacity
+ * requests; older ones stay pending in the database.
+ */
+void ThumbnailQueue::prioritize(const QVector<ThumbnailRequest> &requests) {
+	QMutexLocker locker(&mutex);
+	if (stopping || requests.isEmpty()) {
+		return;
+	}
+	QSet<int> wanted;
+	for (const ThumbnailRequest &request : requests) {
+		wanted.insert(request.entry_id);
+	}
+	for (auto it = bulk.begin(); it != bulk.end();) {
+		if (wanted.contains(it->entry_id)) {
+			queued.remove(it->entry_id);
+			it = bulk.erase(it);
+		} else {
+			++it;
+		}
+	}
+	for (auto it = urgent.begin(); it != urgent.end();) {
+		if (wanted.contains(it->entry_id)) {
+			queued.remove(it->entry_id);
+			it = urgent.erase(it);
+		} else {
+			++it;
+		}
+	}
+	for (const ThumbnailRequest &request : requests) {
+		// Being generated right now.
+		if (queued.contains(request.entry_id)) {
+			continue;
+		}
+		queued.insert(request.entry_id);
+		urgent.enqueue(request);
+		startWorker();
+	}
+	while (urgent.size() > urgent_capacity) {
+		queued.remove(urgent.dequeue().entry_id);
+	}
+	not_full.wakeAll();
+	reportSize(sizeLocked());
 }
 
 int ThumbnailQueue::queueSize() {
 	QMutexLocker locker(&mutex);
-	return pending;
+	return sizeLocked();
 }
 
-void ThumbnailQueue::stop() { pool->waitForDone(); }
-
-void ThumbnailQueue::onThumbnailReady(int entry_id, QByteArray data) {
+/**
+ * @brief Room left in the bulk queue.
+ */
+int ThumbnailQueue::spareCapacity() {
 	QMutexLocker locker(&mutex);
-	pending--;
-	completed++;
+	return stopping ? 0 : bulk_capacity - bulk.size();
+}
 
-	emit queueSizeChanged(pending);
+/**
+ * @brief Block until every queued request is generated and written.
+ */
+void ThumbnailQueue::waitForIdle() {
+	{
+		QMutexLocker locker(&mutex);
+		while (sizeLocked() > 0 && !stopping) {
+			idle.wait(&mutex);
+		}
+	}
+	writer->flush();
+}
 
-	if (pending == 0) {
-		qDebug() << "Thumbnail queue complete:" << completed << "generated," << failed << "failed";
-		emit allComplete();
+/**
+ * @brief Drop queued requests, finish the ones being generated and write
+ * everything out. The dropped entries stay pending in the database.
+ */
+void ThumbnailQueue::stop() {
+	{
+		QMutexLocker locker(&mutex);
+		stopping = true;
+		for (const ThumbnailRequest &request : urgent) {
+			queued.remove(request.entry_id);
+		}
+		for (const ThumbnailRequest &request : bulk) {
+			queued.remove(request.entry_id);
+		}
+		urgent.clear();
+		bulk.clear();
+		not_full.wakeAll();
+		idle.wakeAll();
 	}
+	pool->waitForDone();
+	writer->flush();
 }
 
-void ThumbnailQueue::onThumbnailFailed(int entry_id) {
+/**
+ * @brief Next request for a worker, visible rows first.
+ * @return false when the worker should exit
+ */
+bool ThumbnailQueue::takeRequest(ThumbnailRequest &request) {
 	QMutexLocker locker(&mutex);
-	pending--;
-	failed++;
+	if (stopping || (urgent.isEmpty() && bulk.isEmpty())) {
+		workers--;
+		return false;
+	}
+	if (!urgent.isEmpty()) {
+		request = urgent.dequeue();
+	} else {
+		request = bulk.dequeue();
+		if (bulk.size() == bulk_capacity - 1) {
+			not_full.wakeAll();
+		}
+	}
+	in_progress++;
+	if (bulk.size() <= bulk_capacity / 4 && !work_requested) {
+		work_requested = true;
+		emit needsWork();
+	}
+	return true;
+}
 
-	qDebug() << "Thumbnail generation failed for entry" << entry_id;
+void ThumbnailQueue::finishRequest(int entry_id, bool generated) {
+	QMutexLocker locker(&mutex);
+	if (generated) {
+		completed++;
+	} else {
+		failed++;
+		qDebug() << "Thumbnail generation failed for entry" << entry_id;
+	}
+	releaseLocked(entry_id);
+}
+
+/**
+ * @brief Finish the requests of a batch the writer is done with and tell
+ * views which entries changed state.
+ */
+void ThumbnailQueue::finishBatch(const QVector<QPair<int, QByteArray>> &batch, bool committed) {
+	QVector<int> ready;
+	QVector<int> failed_ids;
+	for (const QPair<int, QByteArray> &thumbnail : batch) {
+		bool generated = committed && !thumbnail.second.isEmpty();
+		finishRequest(thumbnail.first, generated);
+		if (generated) {
+			ready.append(thumbnail.first);
+		} else if (committed) {
+			failed_ids.append(thumbnail.first);
+		}
+	}
+	if (committed) {
+		emit thumbnailsStored(ready, failed_ids);
+	}
+}
 
-	emit queueSizeChanged(pending);
+/**
+ * @brief Give up on a request whose file cannot be read right now. The
+ * entry stays pending in the database.
+ */
+void ThumbnailQueue::skipRequest(int entry_id) {
+	QMutexLocker locker(&mutex);
+	skipped++;
+	releaseLocked(entry_id);
+}
 
-	if (pending == 0) {
-		qDebug() << "Thumbnail queue complete:" << completed << "generated," << failed << "failed";
+/**
+ * @brief Forget a request taken by a worker. Called with the mutex held.
+ */
+void ThumbnailQueue::releaseLocked(int entry_id) {
+	queued.remove(entry_id);
+	in_progress--;
+	int size = sizeLocked();
+	reportSize(size);
+	if (size == 0) {
+		qDebug() << "Thumbnail queue complete:" << completed << "generated," << failed << "failed," << skipped << "unreachable";
+		idle.wakeAll();
 		emit allComplete();
 	}
 }
+
+/**
+ * @brief Start another pool task if one is allowed. Called with the mutex held.
+ */
+void ThumbnailQueue::startWorker() {
+	if (workers < max_workers) {
+		workers++;
+		pool->start(new ThumbnailWorker(this, writer));
+	}
+}
+
+int ThumbnailQueue::sizeLocked() const { return urgent.size() + bulk.size() + in_progress; }
+
+void ThumbnailQueue::reportSize(int size) {
+	ScanMetrics::instance()->setThumbnailQueue(size);
+	emit queueSizeChanged(size);
+}
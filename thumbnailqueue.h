@@ -3,55 +3,130 @@
 
 #include <QMutex>
 #include <QObject>
+#include <QPair>
 #include <QQueue>
+#include <QRunnable>
+#include <QSet>
 #include <QThread>
 #include <QThreadPool>
+#include <QVector>
+#include <QWaitCondition>
 
 struct ThumbnailRequest {
 	int entry_id;
 	QString file_path;
 	int max_size;
+	// As stored by the scanner; detected by the worker when empty.
+	QString mime_type;
 };
 
-class ThumbnailWorker : public QObject, public QRunnable {
+class ThumbnailQueue;
+
+/**
+ * Owns the only database connection used for thumbnails.
+ *
+ * Workers hand over encoded images with add(); the writer thread collects
+ * them and stores each batch in a single transaction, so the pool threads
+ * never contend for the SQLite write lock. Requests are reported finished
+ * to the queue once their batch is committed.
+ */
+class ThumbnailWriter : public QThread {
 	Q_OBJECT
       public:
-	ThumbnailWorker(ThumbnailRequest request, QString db_path);
-	void run() override;
+	ThumbnailWriter(ThumbnailQueue *owner, QString db_path, QObject *parent = nullptr);
+	~ThumbnailWriter();
+	void add(int entry_id, QByteArray thumbnail);
+	void flush();
+	void shutdown();
 
-      signals:
-	void thumbnailReady(int entry_id, QByteArray data);
-	void thumbnailFailed(int entry_id);
+      protected:
+	void run() override;
 
       private:
-	ThumbnailRequest request;
+	ThumbnailQueue *owner;
 	QString db_path;
+	QString connection_name;
+	QMutex mutex;
+	QWaitCondition has_work;
+	QWaitCondition drained;
+	QVector<QPair<int, QByteArray>> queue;
+	int in_flight;
+	int flush_waiters;
+	bool stopping;
 };
 
+/**
+ * Pool task that keeps generating thumbnails until the queue runs dry, so
+ * the number of tasks is bounded by the pool size, not the backlog.
+ */
+class ThumbnailWorker : public QRunnable {
+      public:
+	ThumbnailWorker(ThumbnailQueue *queue, ThumbnailWriter *writer);
+	void run() override;
+
+      private:
+	ThumbnailQueue *queue;
+	ThumbnailWriter *writer;
+};
+
+/**
+ * Bounded thumbnail backlog with a priority lane.
+ *
+ * addRequest() blocks the caller while the bulk queue is full, which is
+ * how a scan slows down to the pace of thumbnail generation. Requests for
+ * rows the user is looking at go through prioritize() and are served
+ * before the bulk backlog. Entries waiting here are marked pending in the
+ * database, so anything dropped on shutdown is offered again next time
+ * through needsWork() and DBManager::pendingThumbnails().
+ */
 class ThumbnailQueue : public QObject {
 	Q_OBJECT
       public:
 	ThumbnailQueue(QObject *parent, QString db_path);
 	~ThumbnailQueue();
 	void addRequest(ThumbnailRequest request);
+	int offer(const QVector<ThumbnailRequest> &requests);
+	void prioritize(const QVector<ThumbnailRequest> &requests);
 	int queueSize();
+	int spareCapacity();
+	void waitForIdle();
 	void stop();
 
       signals:
 	void queueSizeChanged(int size);
 	void allComplete();
-
-      private slots:
-	void onThumbnailReady(int entry_id, QByteArray data);
-	void onThumbnailFailed(int entry_id);
+	void needsWork();
+	void thumbnailsStored(QVector<int> ready, QVector<int> failed);
 
       private:
+	friend class ThumbnailWorker;
+	friend class ThumbnailWriter;
+	bool takeRequest(ThumbnailRequest &request);
+	void finishRequest(int entry_id, bool generated);
+	void finishBatch(const QVector<QPair<int, QByteArray>> &batch, bool committed);
+	void skipRequest(int entry_id);
+	void releaseLocked(int entry_id);
+	void startWorker();
+	int sizeLocked() const;
+	void reportSize(int size);
+
 	QThreadPool *pool;
+	ThumbnailWriter *writer;
 	QString db_path;
 	QMutex mutex;
-	int pending;
+	QWaitCondition not_full;
+	QWaitCondition idle;
+	QQueue<ThumbnailRequest> urgent;
+	QQueue<ThumbnailRequest> bulk;
+	QSet<int> queued;
+	int max_workers;
+	int workers;
+	int in_progress;
 	int completed;
 	int failed;
+	int skipped;
+	bool work_requested;
+	bool stopping;
 };
 
 #endif // THUMBNAILQUEUE_H
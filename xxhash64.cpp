@@ -0,0 +1,109 @@
+#include "xxhash64.h"
+#include <cstring>
+
+namespace {
+const uint64_t prime1 = 11400714785074694791ULL;
+const uint64_t prime2 = 14029467366897019727ULL;
+const uint64_t prime3 = 1609587929392839161ULL;
+const uint64_t prime4 = 9650029242287828579ULL;
+const uint64_t prime5 = 2870177450012600261ULL;
+
+inline uint64_t rotl(uint64_t value, int bits) { return (value << bits) | (value >> (64 - bits)); }
+
+inline uint64_t read64(const unsigned char *p) {
+	uint64_t value = 0;
+	for (int i = 7; i >= 0; i--) {
+		value = (value << 8) | p[i];
+	}
+	return value;
+}
+
+inline uint32_t read32(const unsigned char *p) { return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24; }
+
+inline uint64_t mix(uint64_t acc, uint64_t input) {
+	acc += input * prime2;
+	acc = rotl(acc, 31);
+	return acc * prime1;
+}
+
+inline uint64_t mergeRound(uint64_t acc, uint64_t value) {
+	acc ^= mix(0, value);
+	return acc * prime1 + prime4;
+}
+} // namespace
+
+Xxh64::Xxh64(uint64_t seed) : seed(seed), total(0), buffered(0) {
+	acc[0] = seed + prime1 + prime2;
+	acc[1] = seed + prime2;
+	acc[2] = seed;
+	acc[3] = seed - prime1;
+}
+
+void Xxh64::update(const void *data, size_t size) {
+	const unsigned char *p = static_cast<const unsigned char *>(data);
+	const unsigned char *end = p + size;
+	total += size;
+	if (buffered + size < 32) {
+		memcpy(buffer + buffered, p, size);
+		buffered += size;
+		return;
+	}
+	if (buffered > 0) {
+		size_t fill = 32 - buffered;
+		memcpy(buffer + buffered, p, fill);
+		p += fill;
+		for (int i = 0; i < 4; i++) {
+			acc[i] = mix(acc[i], read64(buffer + 8 * i));
+		}
+		buffered = 0;
+	}
+	for (; end - p >= 32; p += 32) {
+		for (int i = 0; i < 4; i++) {
+			acc[i] = mix(acc[i], read64(p + 8 * i));
+		}
+	}
+	buffered = size_t(end - p);
+	memcpy(buffer, p, buffered);
+}
+
+uint64_t Xxh64::digest() const {
+	uint64_t h;
+	if (total >= 32) {
+		h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+		for (int i = 0; i < 4; i++) {
+			h = mergeRound(h, acc[i]);
+		}
+	} else {
+		h = seed + prime5;
+	}
+	h += total;
+
+	const unsigned char *p = buffer;
+	const unsigned char *end = buffer + buffered;
+	for (; end - p >= 8; p += 8) {
+		h ^= mix(0, read64(p));
+		h = rotl(h, 27) * prime1 + prime4;
+	}
+	if (end - p >= 4) {
+		h ^= uint64_t(read32(p)) * prime1;
+		h = rotl(h, 23) * prime2 + prime3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		h ^= *p * prime5;
+		h = rotl(h, 11) * prime1;
+	}
+
+	h ^= h >> 33;
+	h *= prime2;
+	h ^= h >> 29;
+	h *= prime3;
+	h ^= h >> 32;
+	return h;
+}
+
+uint64_t Xxh64::hash(const void *data, size_t size, uint64_t seed) {
+	Xxh64 state(seed);
+	state.update(data, size);
+	return state.digest();
+}
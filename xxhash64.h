@@ -0,0 +1,28 @@
+#ifndef XXHASH64_H
+#define XXHASH64_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Streaming XXH64, the 64-bit xxHash.
+ *
+ * Fast enough that hashing is bound by the disk, and stable across
+ * platforms, so hashes stored in a catalog stay comparable.
+ */
+class Xxh64 {
+      public:
+	explicit Xxh64(uint64_t seed = 0);
+	void update(const void *data, size_t size);
+	uint64_t digest() const;
+	static uint64_t hash(const void *data, size_t size, uint64_t seed = 0);
+
+      private:
+	uint64_t seed;
+	uint64_t acc[4];
+	uint64_t total;
+	unsigned char buffer[32];
+	size_t buffered;
+};
+
+#endif // XXHASH64_H